@@ -0,0 +1,603 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "forge/array.h"
+#include "forge/cmd.h"
+#include "forge/colors.h"
+#include "forge/cstr.h"
+
+#include "bench.h"
+#include "config.h"
+#include "paths.h"
+#include "utils.h"
+
+// One run of one forge command.
+typedef struct {
+        const char *phase;
+        size_t      run;
+        int         ok;
+        int         status;    // exit code, or -signal
+        double      wall_ms;
+        double      user_ms;
+        double      sys_ms;
+        long        maxrss_kb;
+} bench_sample;
+
+DYN_ARRAY_TYPE(bench_sample, bench_sample_array);
+
+// The directories that forge is pointed at through bind mounts.
+static const struct {
+        const char *sub;
+        const char *target;
+} bench_mounts[] = {
+        {"db",      DATABASE_DIR},
+        {"src",     C_MODULE_DIR_PARENT},
+        {"lib",     MODULE_LIB_DIR},
+        {"sources", PKG_SOURCE_DIR},
+        {"binpkgs", BINPKG_CACHE_DIR},
+};
+
+// The commands that are timed, in the order they run.
+static const struct {
+        const char *phase;
+        const char *cmd;
+        int         builds;   // takes --jobs and --no-cache
+        int         per_root; // gets every root package as argument
+} bench_phases[] = {
+        {"startup",   "lib",       0, 0},
+        {"list",      "list",      0, 0},
+        {"search",    "search",    0, 0},
+        {"deps",      "deps",      0, 0},
+        {"install",   "install",   1, 1},
+        {"update",    "update",    1, 0},
+        {"uninstall", "uninstall", 0, 1},
+        {"clean",     "clean",     0, 0},
+};
+
+#define BENCH_NPHASES (sizeof(bench_phases)/sizeof(*bench_phases))
+
+bench_opts
+bench_opts_default(void)
+{
+        return (bench_opts) {
+                .pkgs = 100,
+                .fanout = 3,
+                .depth = 5,
+                .files = 10,
+                .runs = 1,
+                .seed = 1,
+                .jobs = 1,
+                .no_cache = 0,
+                .keep = 0,
+                .out = "-",
+        };
+}
+
+static int
+parse_size(const char *s,
+           size_t     *out)
+{
+        if (!s || !*s) return 0;
+
+        char *end = NULL;
+        errno = 0;
+        unsigned long n = strtoul(s, &end, 10);
+        if (errno || *end || s[0] == '-') return 0;
+
+        *out = (size_t)n;
+        return 1;
+}
+
+int
+bench_opts_set(bench_opts *opts,
+               const char *key,
+               const char *value)
+{
+        size_t n = 0;
+
+        if (!strcmp(key, "out")) {
+                if (!value || !*value) return 0;
+                opts->out = value;
+                return 1;
+        }
+        if (!strcmp(key, "keep")) {
+                opts->keep = !value || strcmp(value, "0");
+                return 1;
+        }
+
+        if (!parse_size(value, &n)) return 0;
+
+        if      (!strcmp(key, "pkgs"))   opts->pkgs = n;
+        else if (!strcmp(key, "fanout")) opts->fanout = n;
+        else if (!strcmp(key, "depth"))  opts->depth = n;
+        else if (!strcmp(key, "files"))  opts->files = n;
+        else if (!strcmp(key, "runs"))   opts->runs = n;
+        else if (!strcmp(key, "seed"))   opts->seed = (unsigned)n;
+        else return 0;
+
+        return 1;
+}
+
+static unsigned
+next_rand(unsigned *state)
+{
+        // xorshift32, only needs to be repeatable.
+        unsigned x = *state ? *state : 0x9e3779b9u;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        return *state = x;
+}
+
+static char *
+bench_pkg_name(size_t i)
+{
+        char buf[64] = {0};
+        snprintf(buf, sizeof(buf), "bench@p%05zu", i);
+        return strdup(buf);
+}
+
+static int
+write_module(const char      *dir,
+             const char      *name,
+             const str_array *deps,
+             const char      *root,
+             size_t           files)
+{
+        char *fp = forge_cstr_builder(dir, "/", name, ".c", NULL);
+        FILE *f = fopen(fp, "w");
+        free(fp);
+        if (!f) {
+                return 0;
+        }
+
+        fprintf(f, "#include <forge/forge.h>\n\n");
+        fprintf(f, "char *deps[] = {");
+        for (size_t i = 0; i < deps->len; ++i) {
+                fprintf(f, "\"%s\", ", deps->data[i]);
+        }
+        fprintf(f, "NULL};\n\n");
+
+        fprintf(f, "char *getname(void) { return \"%s\"; }\n", name);
+        fprintf(f, "char *getver(void) { return \"1.0.0\"; }\n");
+        fprintf(f, "char *getdesc(void) { return \"Synthetic package for forge bench\"; }\n");
+        fprintf(f, "char **getdeps(void) { return deps; }\n");
+        fprintf(f, "char *download(void) {\n"
+                   "        return cmd(\"mkdir -p %s-src\") ? \"%s-src\" : NULL;\n"
+                   "}\n", name, name);
+        fprintf(f, "int build(void) { return 1; }\n");
+        fprintf(f, "int install(void) {\n"
+                   "        return cmd(\"d=\\\"$DESTDIR%s/%s\\\" && mkdir -p \\\"$d\\\" && i=0 && \"\n"
+                   "                   \"while [ $i -lt %zu ]; do echo %s > \\\"$d/f$i\\\"; i=$((i+1)); done\");\n"
+                   "}\n", root, name, files, name);
+        fprintf(f, "int uninstall(void) { return 1; }\n");
+        fprintf(f, "int update(void) { return 1; }\n");
+        fprintf(f, "int get_changes(void) { return 1; }\n\n");
+
+        fprintf(f, "FORGE_GLOBAL pkg package = {\n"
+                   "        .name = getname,\n"
+                   "        .ver = getver,\n"
+                   "        .desc = getdesc,\n"
+                   "        .web = NULL,\n"
+                   "        .deps = getdeps,\n"
+                   "        .msgs = NULL,\n"
+                   "        .suggested = NULL,\n"
+                   "        .rebuild = NULL,\n"
+                   "        .download = download,\n"
+                   "        .build = build,\n"
+                   "        .install = install,\n"
+                   "        .uninstall = uninstall,\n"
+                   "        .update = update,\n"
+                   "        .get_changes = get_changes,\n"
+                   "};\n");
+
+        return fclose(f) == 0;
+}
+
+// Generate the synthetic repository. Packages are spread over
+// `depth` layers, and every package depends on one package of
+// the layer right below it (so the graph really is that deep)
+// plus `fanout - 1` random ones from any layer below. The
+// packages nothing depends on end up in `roots`.
+static int
+generate_repo(const bench_opts *opts,
+              const char       *moddir,
+              const char       *root,
+              str_array        *roots)
+{
+        size_t depth = opts->depth ? opts->depth : 1;
+        size_t *layer_start = (size_t *)calloc(depth + 1, sizeof(size_t));
+        int *needed = (int *)calloc(opts->pkgs, sizeof(int));
+        unsigned rng = opts->seed;
+        int ok = 1;
+
+        for (size_t l = 0; l <= depth; ++l) {
+                layer_start[l] = l * opts->pkgs / depth;
+        }
+
+        for (size_t l = 0; ok && l < depth; ++l) {
+                for (size_t i = layer_start[l]; ok && i < layer_start[l + 1]; ++i) {
+                        size_t_array picked = dyn_array_empty(size_t_array);
+
+                        size_t below = layer_start[l]; // packages in lower layers
+                        size_t prev = l > 0 ? layer_start[l] - layer_start[l - 1] : 0;
+                        size_t want = opts->fanout < below ? opts->fanout : below;
+
+                        if (want > 0 && prev > 0) {
+                                dyn_array_append(picked, layer_start[l - 1] + next_rand(&rng) % prev);
+                        }
+                        while (picked.len < want) {
+                                size_t d = next_rand(&rng) % below;
+                                int dup = 0;
+                                for (size_t k = 0; !dup && k < picked.len; ++k) {
+                                        dup = picked.data[k] == d;
+                                }
+                                if (!dup) dyn_array_append(picked, d);
+                        }
+
+                        str_array deps = dyn_array_empty(str_array);
+                        for (size_t k = 0; k < picked.len; ++k) {
+                                needed[picked.data[k]] = 1;
+                                dyn_array_append(deps, bench_pkg_name(picked.data[k]));
+                        }
+
+                        char *name = bench_pkg_name(i);
+                        ok = write_module(moddir, name, &deps, root, opts->files);
+                        free(name);
+
+                        for (size_t k = 0; k < deps.len; ++k) {
+                                free(deps.data[k]);
+                        }
+                        dyn_array_free(deps);
+                        dyn_array_free(picked);
+                }
+        }
+
+        for (size_t i = 0; ok && i < opts->pkgs; ++i) {
+                if (!needed[i]) {
+                        dyn_array_append(*roots, bench_pkg_name(i));
+                }
+        }
+
+        free(layer_start);
+        free(needed);
+
+        return ok;
+}
+
+// Make forge see the scratch directories instead of the real ones.
+static int
+enter_scratch(const char *scratch)
+{
+        if (unshare(CLONE_NEWNS) == -1) {
+                perror("unshare(CLONE_NEWNS)");
+                return 0;
+        }
+        // Keep our mounts from propagating back to the host.
+        if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1) {
+                perror("mount(MS_PRIVATE)");
+                return 0;
+        }
+
+        for (size_t i = 0; i < sizeof(bench_mounts)/sizeof(*bench_mounts); ++i) {
+                char *src = forge_cstr_builder(scratch, "/", bench_mounts[i].sub, NULL);
+                int ok = mkdir_p_wmode(bench_mounts[i].target, 0755) == 0
+                        && mount(src, bench_mounts[i].target, NULL, MS_BIND, NULL) == 0;
+                if (!ok) {
+                        fprintf(stderr, "could not mount %s over %s: %s\n",
+                                src, bench_mounts[i].target, strerror(errno));
+                }
+                free(src);
+                if (!ok) return 0;
+        }
+
+        return 1;
+}
+
+static double
+tv_to_ms(struct timeval tv)
+{
+        return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Run this forge binary with `argv` and measure it.
+static bench_sample
+run_forge(const char         *logdir,
+          const char         *phase,
+          size_t              run,
+          const char *const  *argv)
+{
+        bench_sample s = {
+                .phase = phase,
+                .run = run,
+                .ok = 0,
+                .status = -1,
+        };
+
+        char runstr[32] = {0};
+        snprintf(runstr, sizeof(runstr), "%zu", run);
+        char *log = forge_cstr_builder(logdir, "/", phase, "-", runstr, ".log", NULL);
+
+        fprintf(stderr, YELLOW BOLD "*" RESET " bench: %s (run %zu)", phase, run);
+        fflush(NULL);
+
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+
+        pid_t pid = fork();
+        if (pid == -1) {
+                perror("fork");
+                free(log);
+                return s;
+        }
+
+        if (pid == 0) {
+                int fd = open(log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                int null = open("/dev/null", O_RDONLY);
+                if (fd != -1) {
+                        dup2(fd, STDOUT_FILENO);
+                        dup2(fd, STDERR_FILENO);
+                }
+                if (null != -1) {
+                        dup2(null, STDIN_FILENO);
+                }
+                execv("/proc/self/exe", (char *const *)argv);
+                perror("execv");
+                _exit(127);
+        }
+
+        int status = 0;
+        struct rusage ru = {0};
+        while (wait4(pid, &status, 0, &ru) == -1 && errno == EINTR);
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+
+        s.wall_ms = (t1.tv_sec - t0.tv_sec) * 1000.0 + (t1.tv_nsec - t0.tv_nsec) / 1e6;
+        s.user_ms = tv_to_ms(ru.ru_utime);
+        s.sys_ms = tv_to_ms(ru.ru_stime);
+        s.maxrss_kb = ru.ru_maxrss;
+        s.status = WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status);
+        s.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+        if (s.ok) {
+                fprintf(stderr, " %.1fms\n", s.wall_ms);
+                unlink(log);
+        } else {
+                fprintf(stderr, RED BOLD " failed" RESET " [log: %s]\n", log);
+        }
+        free(log);
+
+        return s;
+}
+
+static int
+cmp_double(const void *a,
+           const void *b)
+{
+        double x = *(const double *)a, y = *(const double *)b;
+        return (x > y) - (x < y);
+}
+
+static void
+write_json(FILE                     *f,
+           const bench_opts         *opts,
+           const bench_sample_array *samples)
+{
+        fprintf(f, "{\n");
+        fprintf(f, "  \"forge_version\": \"%s\",\n", PACKAGE_VERSION);
+        fprintf(f, "  \"params\": {\"pkgs\": %zu, \"fanout\": %zu, \"depth\": %zu, \"files\": %zu, "
+                   "\"runs\": %zu, \"seed\": %u, \"jobs\": %zu, \"cache\": %s},\n",
+                opts->pkgs, opts->fanout, opts->depth, opts->files,
+                opts->runs, opts->seed, opts->jobs, opts->no_cache ? "false" : "true");
+
+        fprintf(f, "  \"samples\": [\n");
+        for (size_t i = 0; i < samples->len; ++i) {
+                const bench_sample *s = &samples->data[i];
+                fprintf(f, "    {\"phase\": \"%s\", \"run\": %zu, \"ok\": %s, \"status\": %d, "
+                           "\"wall_ms\": %.3f, \"user_ms\": %.3f, \"sys_ms\": %.3f, \"maxrss_kb\": %ld}%s\n",
+                        s->phase, s->run, s->ok ? "true" : "false", s->status,
+                        s->wall_ms, s->user_ms, s->sys_ms, s->maxrss_kb,
+                        i + 1 < samples->len ? "," : "");
+        }
+        fprintf(f, "  ],\n");
+
+        fprintf(f, "  \"summary\": {\n");
+        double *walls = (double *)malloc((samples->len + 1) * sizeof(double));
+        for (size_t p = 0; p <= BENCH_NPHASES; ++p) {
+                const char *phase = p == 0 ? "rebuild" : bench_phases[p - 1].phase;
+                size_t n = 0;
+                for (size_t i = 0; i < samples->len; ++i) {
+                        if (samples->data[i].ok && !strcmp(samples->data[i].phase, phase)) {
+                                walls[n++] = samples->data[i].wall_ms;
+                        }
+                }
+                fprintf(f, "    \"%s\": ", phase);
+                if (n == 0) {
+                        fprintf(f, "null");
+                } else {
+                        qsort(walls, n, sizeof(double), cmp_double);
+                        double median = n % 2 ? walls[n / 2] : (walls[n / 2 - 1] + walls[n / 2]) / 2;
+                        fprintf(f, "{\"n\": %zu, \"min_ms\": %.3f, \"median_ms\": %.3f, \"max_ms\": %.3f}",
+                                n, walls[0], median, walls[n - 1]);
+                }
+                fprintf(f, "%s\n", p < BENCH_NPHASES ? "," : "");
+        }
+        free(walls);
+        fprintf(f, "  }\n");
+        fprintf(f, "}\n");
+}
+
+// Everything after the scratch directory is set up. Runs in
+// its own process because of the mount namespace.
+static int
+bench_in_scratch(const bench_opts *opts,
+                 const char       *scratch,
+                 const str_array  *roots)
+{
+        if (!enter_scratch(scratch)) {
+                return 0;
+        }
+
+        char *logdir = forge_cstr_builder(scratch, "/logs", NULL);
+        char jobs[64] = {0};
+        snprintf(jobs, sizeof(jobs), "--jobs=%zu", opts->jobs);
+
+        bench_sample_array samples = dyn_array_empty(bench_sample_array);
+
+        // Compiling the modules is only timed once, everything
+        // after that is what forge does on every invocation.
+        const char *rebuild[] = {"forge", "--rebuild", NULL};
+        dyn_array_append(samples, run_forge(logdir, "rebuild", 1, rebuild));
+        int ok = samples.data[0].ok;
+
+        const_str_array argv = dyn_array_empty(const_str_array);
+
+        for (size_t run = 1; ok && run <= opts->runs; ++run) {
+                for (size_t p = 0; ok && p < BENCH_NPHASES; ++p) {
+                        argv.len = 0;
+                        dyn_array_append(argv, "forge");
+                        dyn_array_append(argv, "--yes");
+                        if (bench_phases[p].builds) {
+                                dyn_array_append(argv, jobs);
+                                if (opts->no_cache) {
+                                        dyn_array_append(argv, "--no-cache");
+                                }
+                        }
+                        dyn_array_append(argv, bench_phases[p].cmd);
+
+                        if (bench_phases[p].per_root) {
+                                for (size_t i = 0; i < roots->len; ++i) {
+                                        dyn_array_append(argv, roots->data[i]);
+                                }
+                        } else if (!strcmp(bench_phases[p].phase, "search")) {
+                                dyn_array_append(argv, "p00");
+                        } else if (!strcmp(bench_phases[p].phase, "deps")) {
+                                dyn_array_append(argv, roots->data[0]);
+                        }
+                        dyn_array_append(argv, NULL);
+
+                        bench_sample s = run_forge(logdir, bench_phases[p].phase, run, argv.data);
+                        dyn_array_append(samples, s);
+                        ok = s.ok;
+                }
+        }
+
+        FILE *f = strcmp(opts->out, "-") ? fopen(opts->out, "w") : stdout;
+        if (!f) {
+                perror(opts->out);
+                ok = 0;
+        } else {
+                write_json(f, opts, &samples);
+                // We leave through _exit(), which does not flush.
+                if (f != stdout) fclose(f);
+                else fflush(stdout);
+        }
+
+        dyn_array_free(argv);
+        dyn_array_free(samples);
+        free(logdir);
+
+        return ok;
+}
+
+int
+bench_run(const bench_opts *opts)
+{
+        if (opts->pkgs == 0 || opts->runs == 0) {
+                fprintf(stderr, "bench: pkgs and runs must be at least 1\n");
+                return 0;
+        }
+
+        char tmpl[] = "/tmp/forge-bench-XXXXXX";
+        char *scratch = mkdtemp(tmpl);
+        if (!scratch) {
+                perror("mkdtemp");
+                return 0;
+        }
+
+        // The packages install into here, through the real merge.
+        char *root = forge_cstr_builder(scratch, "/root", NULL);
+        char *moddir = forge_cstr_builder(scratch, "/src/user_modules", NULL);
+        char *logdir = forge_cstr_builder(scratch, "/logs", NULL);
+
+        int ok = mkdir_p_wmode(moddir, 0755) == 0
+                && mkdir_p_wmode(root, 0755) == 0
+                && mkdir_p_wmode(logdir, 0755) == 0;
+        for (size_t i = 0; ok && i < sizeof(bench_mounts)/sizeof(*bench_mounts); ++i) {
+                char *dir = forge_cstr_builder(scratch, "/", bench_mounts[i].sub, NULL);
+                ok = mkdir_p_wmode(dir, 0755) == 0;
+                free(dir);
+        }
+
+        str_array roots = dyn_array_empty(str_array);
+
+        if (ok) {
+                fprintf(stderr, YELLOW BOLD "*" RESET " bench: generating %zu packages in %s\n", opts->pkgs, scratch);
+                ok = generate_repo(opts, moddir, root, &roots);
+        }
+        if (!ok) {
+                fprintf(stderr, "bench: could not set up %s: %s\n", scratch, strerror(errno));
+        }
+
+        if (ok) {
+                fflush(NULL);
+                pid_t pid = fork();
+                if (pid == -1) {
+                        perror("fork");
+                        ok = 0;
+                } else if (pid == 0) {
+                        _exit(bench_in_scratch(opts, scratch, &roots) ? 0 : 1);
+                } else {
+                        int status = 0;
+                        while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+                        ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                }
+        }
+
+        if (opts->keep || !ok) {
+                fprintf(stderr, YELLOW BOLD "*" RESET " bench: kept %s\n", scratch);
+        } else {
+                rmrf(scratch);
+        }
+
+        for (size_t i = 0; i < roots.len; ++i) {
+                free(roots.data[i]);
+        }
+        dyn_array_free(roots);
+        free(root);
+        free(moddir);
+        free(logdir);
+
+        return ok;
+}
@@ -0,0 +1,196 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "forge/cmd.h"
+#include "forge/cstr.h"
+#include "forge/io.h"
+
+#include "binpkg.h"
+#include "config.h"
+#include "paths.h"
+#include "sha256.h"
+#include "utils.h"
+
+// The C source that `so_path` was last compiled from, as
+// recorded by rebuild_pkgs(). Several module repositories can
+// have a module of the same name, in which case the one that
+// was compiled last is the one in the .so.
+static char *
+module_src(sqlite3    *db,
+           const char *so_path)
+{
+        sqlite3_stmt *stmt;
+        const char *sql = "SELECT src FROM ModuleBuilds WHERE so = ? ORDER BY rowid DESC LIMIT 1;";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+                return NULL;
+        }
+
+        char *src = NULL;
+        sqlite3_bind_text(stmt, 1, so_path, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char *s = (const char *)sqlite3_column_text(stmt, 0);
+                if (s && access(s, R_OK) == 0) {
+                        src = strdup(s);
+                }
+        }
+        sqlite3_finalize(stmt);
+
+        return src;
+}
+
+static void
+hash_field(sha256_ctx *c,
+           const char *s)
+{
+        // Include the terminator so that fields cannot run into each other.
+        sha256_update(c, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+char *
+binpkg_key(sqlite3        *db,
+           const modindex *mi,
+           const module   *m)
+{
+        sha256_ctx c;
+        sha256_init(&c);
+
+        hash_field(&c, m->name);
+        hash_field(&c, m->ver);
+
+        char *src = module_src(db, m->so_path);
+        int ok = src ? sha256_update_file(&c, src)
+                : sha256_update_file(&c, m->so_path);
+        free(src);
+        if (!ok) {
+                return NULL;
+        }
+
+        for (size_t i = 0; i < m->deps.len; ++i) {
+                const module *dep = modindex_find(mi, m->deps.data[i]);
+                hash_field(&c, m->deps.data[i]);
+                hash_field(&c, dep ? dep->ver : NULL);
+        }
+
+        // Compiler flags and the like.
+        (void)sha256_update_file(&c, FORGE_CONF_HEADER_FP);
+
+        char *hex = (char *)malloc(SHA256_HEX_SZ);
+        sha256_final_hex(&c, hex);
+
+        return hex;
+}
+
+static char *
+binpkg_path(const char *name,
+            const char *key,
+            const char *ext)
+{
+        return forge_cstr_builder(BINPKG_CACHE_DIR "/", name, "-", key, ext, NULL);
+}
+
+int
+binpkg_has(const char *name,
+           const char *key)
+{
+        char *archive = binpkg_path(name, key, ".tar.gz");
+        int has = access(archive, R_OK) == 0;
+        free(archive);
+        return has;
+}
+
+int
+binpkg_fetch(const char  *name,
+             const char  *key,
+             const char  *fakeroot,
+             char       **pkgname)
+{
+        char *archive = binpkg_path(name, key, ".tar.gz");
+        char *srcfp = binpkg_path(name, key, ".src");
+        int ok = 0;
+
+        if (!forge_io_filepath_exists(archive)) {
+                goto done;
+        }
+
+        char *src = forge_io_read_file_to_cstr(srcfp);
+        if (!src) {
+                goto done;
+        }
+        src[strcspn(src, "\n")] = '\0';
+
+        const char *tar[] = {"tar", "-C", fakeroot, "--numeric-owner", "-xpzf", archive, NULL};
+        ok = forge_cmd_run(tar, NULL, NULL);
+
+        if (ok && *src) {
+                *pkgname = src;
+        } else {
+                ok = 0;
+                free(src);
+        }
+
+ done:
+        free(archive);
+        free(srcfp);
+        return ok;
+}
+
+int
+binpkg_store(const char *name,
+             const char *key,
+             const char *fakeroot,
+             const char *pkgname)
+{
+        if (mkdir_p_wmode(BINPKG_CACHE_DIR, 0755) != 0) {
+                return 0;
+        }
+
+        char pid[32] = {0};
+        snprintf(pid, sizeof(pid), ".%ld", (long)getpid());
+
+        char *archive = binpkg_path(name, key, ".tar.gz");
+        char *srcfp = binpkg_path(name, key, ".src");
+        char *tmp_archive = forge_cstr_builder(archive, pid, NULL);
+        char *tmp_srcfp = forge_cstr_builder(srcfp, pid, NULL);
+
+        const char *tar[] = {"tar", "-C", fakeroot, "--exclude=./buildsrc", "-czf", tmp_archive, ".", NULL};
+
+        // The .src file goes first so that it always exists
+        // by the time the archive can be seen.
+        int ok = forge_cmd_run(tar, NULL, NULL)
+                && forge_io_write_file(tmp_srcfp, pkgname)
+                && rename(tmp_srcfp, srcfp) == 0
+                && rename(tmp_archive, archive) == 0;
+
+        if (!ok) {
+                unlink(tmp_archive);
+                unlink(tmp_srcfp);
+        }
+
+        free(archive);
+        free(srcfp);
+        free(tmp_archive);
+        free(tmp_srcfp);
+
+        return ok;
+}
@@ -0,0 +1,153 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <string.h>
+
+#include "buildstats.h"
+
+// How many of the most recent runs an estimate is based on.
+#define ESTIMATE_RUNS 5
+
+static const char *phase_names[PHASE__COUNT] = {
+        "download",
+        "build",
+        "install",
+        "merge",
+};
+
+const char *
+build_phase_name(build_phase phase)
+{
+        return phase < PHASE__COUNT ? phase_names[phase] : "unknown";
+}
+
+static int64_t
+tv_ms(struct timeval tv)
+{
+        return (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+void
+phase_begin(phase_timer *t)
+{
+        clock_gettime(CLOCK_MONOTONIC, &t->t0);
+        t->started = time(NULL);
+        getrusage(RUSAGE_SELF, &t->self0);
+        getrusage(RUSAGE_CHILDREN, &t->children0);
+}
+
+void
+phase_end(const phase_timer *t,
+          int                ok,
+          phase_stat        *out)
+{
+        struct timespec t1;
+        struct rusage self, children;
+
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        getrusage(RUSAGE_SELF, &self);
+        getrusage(RUSAGE_CHILDREN, &children);
+
+        out->ran = 1;
+        out->ok = ok;
+        out->started = (int64_t)t->started;
+        out->wall_ms = (int64_t)(t1.tv_sec - t->t0.tv_sec) * 1000
+                + (t1.tv_nsec - t->t0.tv_nsec) / 1000000;
+
+        // Everything that the phase ran (make, the compiler, ...)
+        // is a child that has been waited on by the time it ends.
+        out->user_ms = tv_ms(self.ru_utime) - tv_ms(t->self0.ru_utime)
+                + tv_ms(children.ru_utime) - tv_ms(t->children0.ru_utime);
+        out->sys_ms = tv_ms(self.ru_stime) - tv_ms(t->self0.ru_stime)
+                + tv_ms(children.ru_stime) - tv_ms(t->children0.ru_stime);
+}
+
+int
+buildstats_record(sqlite3          *db,
+                  const char       *name,
+                  const char       *ver,
+                  size_t            jobs,
+                  const phase_stat  phases[PHASE__COUNT])
+{
+        sqlite3_stmt *stmt;
+        const char *sql =
+                "INSERT INTO BuildStats "
+                "(pkg_name, version, phase, ok, started, wall_ms, user_ms, sys_ms, jobs) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?);";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+                return 0;
+        }
+
+        int ok = 1;
+        for (int i = 0; i < PHASE__COUNT; ++i) {
+                const phase_stat *p = &phases[i];
+                if (!p->ran) continue;
+
+                sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 2, ver, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 3, phase_names[i], -1, SQLITE_STATIC);
+                sqlite3_bind_int(stmt, 4, p->ok);
+                sqlite3_bind_int64(stmt, 5, p->started);
+                sqlite3_bind_int64(stmt, 6, p->wall_ms);
+                sqlite3_bind_int64(stmt, 7, p->user_ms);
+                sqlite3_bind_int64(stmt, 8, p->sys_ms);
+                sqlite3_bind_int64(stmt, 9, (sqlite3_int64)jobs);
+
+                if (sqlite3_step(stmt) != SQLITE_DONE) {
+                        ok = 0;
+                }
+                sqlite3_reset(stmt);
+        }
+        sqlite3_finalize(stmt);
+
+        return ok;
+}
+
+int64_t
+buildstats_estimate_ms(sqlite3    *db,
+                       const char *name,
+                       int         with_download)
+{
+        sqlite3_stmt *stmt;
+        const char *sql =
+                "SELECT phase, AVG(wall_ms) FROM ("
+                "  SELECT phase, wall_ms,"
+                "         ROW_NUMBER() OVER (PARTITION BY phase ORDER BY id DESC) AS rn"
+                "  FROM BuildStats WHERE pkg_name = ? AND ok = 1"
+                ") WHERE rn <= ? GROUP BY phase;";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+                return -1;
+        }
+
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, ESTIMATE_RUNS);
+
+        int64_t total = -1;
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char *phase = (const char *)sqlite3_column_text(stmt, 0);
+                if (!with_download && !strcmp(phase, phase_names[PHASE_DOWNLOAD])) {
+                        if (total == -1) total = 0;
+                        continue;
+                }
+                total = (total == -1 ? 0 : total) + (int64_t)sqlite3_column_double(stmt, 1);
+        }
+        sqlite3_finalize(stmt);
+
+        return total;
+}
@@ -0,0 +1,353 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+
+#include "copy.h"
+#include "sha256.h"
+
+#define COPY_BUF_SZ (128 * 1024)
+
+static const char *
+rel(const char *path)
+{
+        while (*path == '/') ++path;
+        return *path ? path : ".";
+}
+
+int
+copy_ctx_init(copy_ctx   *cc,
+              const char *root,
+              int         allow_move)
+{
+        struct stat st;
+
+        cc->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (cc->root_fd == -1) {
+                return 0;
+        }
+        if (fstat(cc->root_fd, &st) == -1) {
+                close(cc->root_fd);
+                return 0;
+        }
+
+        cc->root_dev = st.st_dev;
+        cc->allow_move = allow_move;
+        cc->dirs = forge_smap_create();
+
+        return 1;
+}
+
+void
+copy_ctx_destroy(copy_ctx *cc)
+{
+        close(cc->root_fd);
+        forge_smap_destroy(&cc->dirs);
+}
+
+int
+copy_mkparents(copy_ctx   *cc,
+               const char *dst)
+{
+        char path[PATH_MAX] = {0};
+        const char *r = rel(dst);
+        size_t n = strlen(r);
+
+        if (n >= sizeof(path)) {
+                errno = ENAMETOOLONG;
+                return 0;
+        }
+        memcpy(path, r, n + 1);
+
+        char *slash = strrchr(path, '/');
+        if (!slash) {
+                return 1; // lives directly in the root
+        }
+        *slash = '\0';
+
+        if (forge_smap_contains(&cc->dirs, path)) {
+                return 1;
+        }
+
+        // Walk down from the top, only touching directories we have not seen.
+        for (char *p = path; ; ++p) {
+                if (*p != '/' && *p != '\0') continue;
+
+                char c = *p;
+                *p = '\0';
+                if (!forge_smap_contains(&cc->dirs, path)) {
+                        if (mkdirat(cc->root_fd, path, 0755) == -1 && errno != EEXIST) {
+                                return 0;
+                        }
+                        forge_smap_insert(&cc->dirs, path, (void *)1);
+                }
+                *p = c;
+
+                if (c == '\0') break;
+        }
+
+        return 1;
+}
+
+int
+copy_mkdir(copy_ctx   *cc,
+           const char *dst,
+           mode_t      mode)
+{
+        const char *r = rel(dst);
+
+        if (forge_smap_contains(&cc->dirs, r)) {
+                return 1;
+        }
+        if (mkdirat(cc->root_fd, r, mode & 07777) == -1 && errno != EEXIST) {
+                return 0;
+        }
+        forge_smap_insert(&cc->dirs, r, (void *)1);
+
+        return 1;
+}
+
+int
+copy_symlink(copy_ctx   *cc,
+             const char *target,
+             const char *dst)
+{
+        const char *r = rel(dst);
+
+        if (symlinkat(target, cc->root_fd, r) == -1) {
+                if (errno != EEXIST) return 0;
+                unlinkat(cc->root_fd, r, 0);
+                if (symlinkat(target, cc->root_fd, r) == -1) return 0;
+        }
+
+        return 1;
+}
+
+// Copy `len` bytes at `off` from `in` to `out`, trying the
+// cheapest mechanism first. `*mech` remembers what worked so
+// that later ranges of the same file do not retry. Bytes that
+// pass through our buffer are also hashed into `h`, if given.
+static int
+copy_range(int in, int out, off_t off, off_t len, int *mech, sha256_ctx *h)
+{
+        off_t done = 0;
+
+        while (*mech == 0 && done < len) {
+                loff_t ioff = off + done, ooff = off + done;
+                ssize_t n = copy_file_range(in, &ioff, out, &ooff, (size_t)(len - done), 0);
+                if (n > 0) {
+                        done += n;
+                        continue;
+                }
+                if (n == 0) {
+                        return done == len; // file shrunk underneath us
+                }
+                if (errno == EINTR) continue;
+                if (errno != ENOSYS && errno != EXDEV && errno != EINVAL
+                    && errno != EOPNOTSUPP && errno != EBADF) {
+                        return 0;
+                }
+                *mech = 1;
+        }
+
+        if (*mech == 1 && done < len) {
+                if (lseek(out, off + done, SEEK_SET) == -1) return 0;
+                while (done < len) {
+                        off_t ioff = off + done;
+                        ssize_t n = sendfile(out, in, &ioff, (size_t)(len - done));
+                        if (n > 0) {
+                                done += n;
+                                continue;
+                        }
+                        if (n == 0) return 0;
+                        if (errno == EINTR) continue;
+                        if (errno != EINVAL && errno != ENOSYS) return 0;
+                        *mech = 2;
+                        break;
+                }
+        }
+
+        if (done < len) {
+                char *buf = (char *)malloc(COPY_BUF_SZ);
+                while (done < len) {
+                        size_t want = (size_t)(len - done) < COPY_BUF_SZ ? (size_t)(len - done) : COPY_BUF_SZ;
+                        ssize_t n = pread(in, buf, want, off + done);
+                        if (n == -1 && errno == EINTR) continue;
+                        if (n <= 0) {
+                                free(buf);
+                                return 0;
+                        }
+                        if (h) {
+                                sha256_update(h, buf, (size_t)n);
+                        }
+                        for (ssize_t w = 0; w < n;) {
+                                ssize_t m = pwrite(out, buf + w, (size_t)(n - w), off + done + w);
+                                if (m == -1 && errno == EINTR) continue;
+                                if (m <= 0) {
+                                        free(buf);
+                                        return 0;
+                                }
+                                w += m;
+                        }
+                        done += n;
+                }
+                free(buf);
+        }
+
+        return 1;
+}
+
+// Feed the `n` zero bytes of a hole into `h`.
+static void
+hash_zeros(sha256_ctx *h,
+           off_t       n)
+{
+        static const uint8_t zeros[4096] = {0};
+        while (n > 0) {
+                size_t k = n < (off_t)sizeof(zeros) ? (size_t)n : sizeof(zeros);
+                sha256_update(h, zeros, k);
+                n -= (off_t)k;
+        }
+}
+
+static int
+copy_data(int in, int out, const struct stat *st, sha256_ctx *h)
+{
+        if (st->st_size == 0) {
+                return 1;
+        }
+
+        // Reflink when the filesystem supports it. Nothing was
+        // read then, so the hash has to read the file itself.
+        if (ioctl(out, FICLONE, in) == 0) {
+                return !h || sha256_update_fd(h, in);
+        }
+
+        // When hashing, the bytes go through our own buffer
+        // so that every byte is only read once.
+        int mech = h ? 2 : 0;
+
+        // Only walk the holes if the file actually has some.
+        if ((off_t)st->st_blocks * 512 < st->st_size) {
+                off_t data = 0, hashed = 0;
+                while (data < st->st_size) {
+                        data = lseek(in, data, SEEK_DATA);
+                        if (data == -1) {
+                                if (errno == ENXIO) break; // trailing hole
+                                goto dense;
+                        }
+                        off_t hole = lseek(in, data, SEEK_HOLE);
+                        if (hole == -1) goto dense;
+                        if (h) hash_zeros(h, data - hashed);
+                        if (!copy_range(in, out, data, hole - data, &mech, h)) return 0;
+                        data = hashed = hole;
+                }
+                if (h) hash_zeros(h, st->st_size - hashed);
+                return ftruncate(out, st->st_size) == 0;
+        }
+
+ dense:
+        if (h) sha256_init(h); // start over with everything
+        return copy_range(in, out, 0, st->st_size, &mech, h);
+}
+
+int
+copy_regular(copy_ctx          *cc,
+             const char        *src,
+             const struct stat *st,
+             const char        *dst,
+             char              *hash)
+{
+        static unsigned long counter = 0;
+        const char *r = rel(dst);
+        sha256_ctx h;
+
+        if (cc->allow_move && st->st_dev == cc->root_dev) {
+                // A rename does not read the file, so this is
+                // the only time it is read.
+                sha256_init(&h);
+                if (hash && !sha256_update_file(&h, src)) {
+                        return 0;
+                }
+                if (renameat(AT_FDCWD, src, cc->root_fd, r) == 0) {
+                        if (hash) sha256_final_hex(&h, hash);
+                        return 1;
+                }
+                if (errno != EXDEV) return 0;
+        }
+
+        // Write next to the destination and rename over it, so that
+        // a running binary never sees a half written file.
+        char tmp[PATH_MAX] = {0};
+        const char *base = strrchr(r, '/');
+        int dirlen = base ? (int)(base - r) + 1 : 0;
+        if (snprintf(tmp, sizeof(tmp), "%.*s.forge-tmp.%ld.%lu",
+                     dirlen, r, (long)getpid(), counter++) >= (int)sizeof(tmp)) {
+                errno = ENAMETOOLONG;
+                return 0;
+        }
+
+        int in = open(src, O_RDONLY | O_CLOEXEC);
+        if (in == -1) {
+                return 0;
+        }
+
+        int out = openat(cc->root_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (out == -1) {
+                int err = errno;
+                close(in);
+                errno = err;
+                return 0;
+        }
+
+        sha256_init(&h);
+        int ok = copy_data(in, out, st, hash ? &h : NULL)
+                && fchmod(out, st->st_mode & 07777) == 0
+                && futimens(out, (struct timespec[2]){ st->st_atim, st->st_mtim }) == 0;
+
+        int err = errno;
+        close(in);
+        if (close(out) == -1 && ok) {
+                err = errno;
+                ok = 0;
+        }
+
+        if (ok && renameat(cc->root_fd, tmp, cc->root_fd, r) == 0) {
+                if (hash) sha256_final_hex(&h, hash);
+                return 1;
+        }
+
+        if (ok) err = errno;
+        unlinkat(cc->root_fd, tmp, 0);
+        errno = err;
+
+        return 0;
+}
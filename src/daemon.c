@@ -0,0 +1,345 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <grp.h>
+#include <limits.h>
+#include <pwd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "config.h"
+#include "daemon.h"
+#include "paths.h"
+
+#define DAEMON_SOCKET_FP DATABASE_DIR "/forge.sock"
+
+// A request is a single packet holding the client's working
+// directory and then its arguments, each NUL terminated, with
+// the client's stdin, stdout and stderr attached. The reply is
+// the exit status as an int32_t.
+#define REQUEST_MAX (64 * 1024)
+#define REQUEST_FDS 3
+
+// Requests being served at once. Beyond that, connections wait
+// in the listen backlog until one finishes.
+#define REQUESTS_MAX 32
+
+static volatile sig_atomic_t g_stop = 0;
+
+static int
+connect_daemon(void)
+{
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+                return -1;
+        }
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET_FP);
+
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+                close(fd);
+                return -1;
+        }
+
+        return fd;
+}
+
+static int
+append_field(char       *buf,
+             size_t     *len,
+             const char *s)
+{
+        size_t n = strlen(s) + 1;
+        if (*len + n > REQUEST_MAX) {
+                return 0;
+        }
+        memcpy(buf + *len, s, n);
+        *len += n;
+        return 1;
+}
+
+int
+daemon_forward(int argc, char **argv)
+{
+        if (getenv("FORGE_NO_DAEMON")) {
+                return -1;
+        }
+
+        static char buf[REQUEST_MAX];
+        size_t len = 0;
+
+        char cwd[PATH_MAX] = {0};
+        if (!getcwd(cwd, sizeof(cwd)) || !append_field(buf, &len, cwd)) {
+                return -1;
+        }
+        for (int i = 0; i < argc; ++i) {
+                if (!append_field(buf, &len, argv[i])) {
+                        return -1; // too big for one request, run it here
+                }
+        }
+
+        int fd = connect_daemon();
+        if (fd == -1) {
+                return -1;
+        }
+
+        union {
+                struct cmsghdr hdr;
+                char           buf[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+        } ctl;
+        memset(&ctl, 0, sizeof(ctl));
+
+        struct iovec iov = { .iov_base = buf, .iov_len = len };
+        struct msghdr msg = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = ctl.buf,
+                .msg_controllen = sizeof(ctl.buf),
+        };
+
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN(REQUEST_FDS * sizeof(int));
+        int fds[REQUEST_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+        memcpy(CMSG_DATA(c), fds, sizeof(fds));
+
+        if (sendmsg(fd, &msg, MSG_NOSIGNAL) != (ssize_t)len) {
+                close(fd);
+                return -1;
+        }
+
+        int32_t status = 0;
+        ssize_t n;
+        while ((n = recv(fd, &status, sizeof(status), 0)) == -1 && errno == EINTR);
+        close(fd);
+
+        if (n != (ssize_t)sizeof(status)) {
+                // It may have run part of the way already.
+                fprintf(stderr, "forge daemon stopped before finishing the command\n");
+                return 1;
+        }
+
+        return status;
+}
+
+// Become the user at the other end of the connection, so that
+// the command can do exactly what it could have done without
+// the daemon, and not what root could.
+static int
+become_peer(const struct ucred *peer)
+{
+        const struct passwd *pw = getpwuid(peer->uid);
+        int groups_ok = pw ? initgroups(pw->pw_name, peer->gid) == 0
+                : setgroups(0, NULL) == 0;
+
+        return groups_ok
+                && setgid(peer->gid) == 0
+                && setuid(peer->uid) == 0;
+}
+
+// Runs in a fork of the daemon for every connection.
+static void
+serve_request(int                   conn,
+              const daemon_handler *h)
+{
+        struct ucred peer;
+        socklen_t peer_len = sizeof(peer);
+        if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) != 0
+            || peer_len != sizeof(peer)) {
+                return;
+        }
+
+        static char buf[REQUEST_MAX + 1];
+        union {
+                struct cmsghdr hdr;
+                char           buf[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+        } ctl;
+
+        struct iovec iov = { .iov_base = buf, .iov_len = REQUEST_MAX };
+        struct msghdr msg = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = ctl.buf,
+                .msg_controllen = sizeof(ctl.buf),
+        };
+
+        ssize_t len = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        if (len <= 0 || !c || c->cmsg_type != SCM_RIGHTS
+            || c->cmsg_len != CMSG_LEN(REQUEST_FDS * sizeof(int))) {
+                return;
+        }
+
+        int fds[REQUEST_FDS];
+        memcpy(fds, CMSG_DATA(c), sizeof(fds));
+
+        // Split up the fields, the first being the cwd.
+        buf[len] = '\0';
+        char *argv[REQUEST_MAX / 2 + 1];
+        int argc = 0;
+        for (char *p = buf; p < buf + len; p += strlen(p) + 1) {
+                argv[argc++] = p;
+        }
+        argv[argc] = NULL;
+
+        // The command gets its own process because it is free
+        // to exit() whenever, and we still need to report back.
+        pid_t pid = fork();
+        if (pid == 0) {
+                for (int i = 0; i < REQUEST_FDS; ++i) {
+                        dup2(fds[i], i);
+                        close(fds[i]);
+                }
+                close(conn);
+
+                if (!become_peer(&peer)) {
+                        perror("forge daemon: could not switch to the calling user");
+                        exit(1);
+                }
+
+                if (argc < 1 || chdir(argv[0]) != 0) {
+                        perror("chdir");
+                        exit(1);
+                }
+
+                int status = h->run(argc - 1, argv + 1, h->ud);
+                exit(status);
+        }
+
+        for (int i = 0; i < REQUEST_FDS; ++i) {
+                close(fds[i]);
+        }
+
+        int32_t status = 1;
+        int ws;
+        if (pid > 0 && waitpid(pid, &ws, 0) == pid) {
+                status = WIFEXITED(ws) ? WEXITSTATUS(ws) : 128 + WTERMSIG(ws);
+        }
+
+        (void)send(conn, &status, sizeof(status), MSG_NOSIGNAL);
+}
+
+static void
+on_stop(int sig)
+{
+        (void)sig;
+        g_stop = 1;
+}
+
+int
+daemon_serve(const daemon_handler *h)
+{
+        int other = connect_daemon();
+        if (other != -1) {
+                close(other);
+                fprintf(stderr, "forge daemon is already running\n");
+                return 0;
+        }
+
+        // Nobody is listening, so any socket left is stale.
+        (void)unlink(DAEMON_SOCKET_FP);
+
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+                perror("socket");
+                return 0;
+        }
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DAEMON_SOCKET_FP);
+
+        // Only read-only commands are served, which anybody may run.
+        // Each one runs as whoever asked for it (see become_peer()).
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+            || chmod(DAEMON_SOCKET_FP, 0666) != 0
+            || listen(fd, 64) != 0) {
+                perror("could not listen on " DAEMON_SOCKET_FP);
+                close(fd);
+                return 0;
+        }
+
+        // No SA_RESTART, so that accept() returns on a signal.
+        struct sigaction sa = { .sa_handler = on_stop };
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+
+        printf("forge daemon listening on %s\n", DAEMON_SOCKET_FP);
+        fflush(stdout);
+
+        size_t active = 0;
+
+        while (!g_stop) {
+                // Reap finished requests, and wait for one if there
+                // are too many, so that clients cannot make us fork
+                // without end.
+                while (active > 0 && waitpid(-1, NULL, WNOHANG) > 0) {
+                        --active;
+                }
+                if (active >= REQUESTS_MAX) {
+                        if (waitpid(-1, NULL, 0) > 0) {
+                                --active;
+                        }
+                        continue;
+                }
+
+                int conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+                if (conn == -1) {
+                        if (errno != EINTR) perror("accept");
+                        continue;
+                }
+
+                if (h->refresh) {
+                        h->refresh(h->ud);
+                }
+
+                pid_t pid = fork();
+                if (pid == 0) {
+                        close(fd);
+                        signal(SIGINT, SIG_DFL);
+                        signal(SIGTERM, SIG_DFL);
+                        serve_request(conn, h);
+                        _exit(0);
+                } else if (pid == -1) {
+                        perror("fork");
+                } else {
+                        ++active;
+                }
+
+                close(conn);
+        }
+
+        (void)unlink(DAEMON_SOCKET_FP);
+        close(fd);
+
+        return 1;
+}
@@ -22,38 +22,40 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #include "depgraph.h"
 #include "forge/forge.h"
 
-depgraph_node *
-depgraph_node_alloc(const char *name)
+static ssize_t
+get_index_of_pkg(const depgraph *dg,
+                 const char     *name)
 {
-        depgraph_node *n = (depgraph_node *)malloc(sizeof(depgraph_node));
-        n->name = strdup(name);
-        n->next = NULL;
-        return n;
+        uintptr_t id = (uintptr_t)forge_smap_get(&dg->ids, name);
+        return id ? (ssize_t)(id - 1) : -1;
 }
 
-void
-depgraph_node_free(depgraph_node *n)
+ssize_t
+depgraph_find(const depgraph *dg,
+              const char     *name)
 {
-        free(n->name);
-        free(n);
-        n = NULL;
+        return get_index_of_pkg(dg, name);
 }
 
 depgraph
 depgraph_create(void)
 {
         return (depgraph) {
-                .tbl = (depgraph_node **)calloc(
-                        DEPGRAPH_DEFAULT_CAPACITY,
-                        sizeof(depgraph_node *)
-                ),
-                .cap = DEPGRAPH_DEFAULT_CAPACITY,
+                .names = (char **)malloc(DEPGRAPH_DEFAULT_CAPACITY * sizeof(char *)),
                 .len = 0,
-                .sz = 0,
+                .cap = DEPGRAPH_DEFAULT_CAPACITY,
+                .ids = forge_smap_create(),
+                .edge_from = dyn_array_empty(size_t_array),
+                .edge_to = dyn_array_empty(str_array),
+                .offsets = NULL,
+                .targets = NULL,
+                .frozen = 0,
         };
 }
 
@@ -61,16 +63,18 @@ void
 depgraph_destroy(depgraph *dg)
 {
         for (size_t i = 0; i < dg->len; ++i) {
-                depgraph_node *it = dg->tbl[i]->next;
-                while (it) {
-                        depgraph_node *tmp = it->next;
-                        depgraph_node_free(it);
-                        it = tmp;
-                }
-                depgraph_node_free(dg->tbl[i]);
+                free(dg->names[i]);
+        }
+        for (size_t i = 0; i < dg->edge_to.len; ++i) {
+                free(dg->edge_to.data[i]);
         }
 
-        free(dg->tbl);
+        free(dg->names);
+        forge_smap_destroy(&dg->ids);
+        dyn_array_free(dg->edge_from);
+        dyn_array_free(dg->edge_to);
+        free(dg->offsets);
+        free(dg->targets);
 }
 
 void
@@ -81,161 +85,154 @@ depgraph_insert_pkg(depgraph *dg, const char *name)
                 return;
         }
 
-        // Check for duplicates
-        for (size_t i = 0; i < dg->len; ++i) {
-                if (dg->tbl[i] && !strcmp(dg->tbl[i]->name, name)) {
-                        fprintf(stderr, "depgraph_insert_pkg: Duplicate package '%s'\n", name);
-                        return;
-                }
-        }
-
-        depgraph_node *n = depgraph_node_alloc(name);
-        if (!n) {
-                fprintf(stderr, "depgraph_insert_pkg: Failed to allocate node for '%s'\n", name);
+        if (get_index_of_pkg(dg, name) != -1) {
+                fprintf(stderr, "depgraph_insert_pkg: Duplicate package '%s'\n", name);
                 return;
         }
 
         if (dg->len >= dg->cap) {
                 size_t new_cap = !dg->cap ? 2 : dg->cap * 2;
-                depgraph_node **new_tbl = (depgraph_node **)realloc(dg->tbl, new_cap * sizeof(depgraph_node *));
-                if (!new_tbl) {
+                char **new_names = (char **)realloc(dg->names, new_cap * sizeof(char *));
+                if (!new_names) {
                         fprintf(stderr, "depgraph_insert_pkg: Failed to realloc tbl for '%s'\n", name);
-                        depgraph_node_free(n);
                         return;
                 }
-                dg->tbl = new_tbl;
-                for (size_t i = dg->len; i < new_cap; ++i) {
-                        dg->tbl[i] = NULL;
-                }
+                dg->names = new_names;
                 dg->cap = new_cap;
         }
 
-        dg->tbl[dg->len++] = n;
-        dg->sz++; // Increment total number of nodes
+        dg->names[dg->len] = strdup(name);
+        forge_smap_insert(&dg->ids, name, (void *)(uintptr_t)(dg->len + 1));
+        dg->len++;
+        dg->frozen = 0;
 }
 
-/* void */
-/* depgraph_insert_pkg(depgraph *dg, const char *name) */
-/* { */
-/*         // TODO: check for duplicates */
-
-/*         depgraph_node *n = depgraph_node_alloc(name); */
-
-/*         if (dg->len >= dg->cap) { */
-/*                 dg->cap = !dg->cap ? 2 : dg->cap*2; */
-/*                 dg->tbl = (depgraph_node **)realloc( */
-/*                         dg->tbl, */
-/*                         dg->cap * sizeof(depgraph_node *) */
-/*                 ); */
-/*                 for (size_t i = dg->len; i < dg->cap; ++i) { */
-/*                         dg->tbl[i] = NULL; */
-/*                 } */
-/*         } */
-
-/*         dg->tbl[dg->len++] = n; */
-/* } */
-
 void
 depgraph_add_dep(depgraph   *dg,
                  const char *from,
                  const char *to)
 {
-        // TODO: check for not found
-
-        for (size_t i = 0; i < dg->len; ++i) {
-                if (!strcmp(dg->tbl[i]->name, from)) {
-                        depgraph_node *new_node = depgraph_node_alloc(to);
-                        depgraph_node *tmp = dg->tbl[i]->next;
-                        dg->tbl[i]->next = new_node;
-                        new_node->next = tmp;
-                        break;
-                }
-        }
-}
-
-static ssize_t
-get_index_of_pkg(const depgraph *dg,
-                 const char     *name)
-{
-        for (size_t i = 0; i < dg->len; ++i) {
-                if (!strcmp(dg->tbl[i]->name, name)) {
-                        return i;
-                }
+        ssize_t index = get_index_of_pkg(dg, from);
+        if (index == -1) {
+                fprintf(stderr, "depgraph_add_dep: Unknown package '%s' (dependency '%s' dropped)\n", from, to);
+                return;
         }
 
-        return -1;
+        dyn_array_append(dg->edge_from, (size_t)index);
+        dyn_array_append(dg->edge_to, strdup(to));
+        dg->frozen = 0;
 }
 
-static void
-__depgraph_gen_order(const depgraph *dg, size_t_array *ar, size_t st, int *visited, int *rec_stack)
+void
+depgraph_freeze(depgraph *dg)
 {
-        if (rec_stack[st]) {
-                // Cycle detected
+        if (dg->frozen) {
                 return;
         }
 
-        if (visited[st]) {
-                // Node already processed
-                return;
+        free(dg->offsets);
+        free(dg->targets);
+
+        dg->offsets = (size_t *)calloc(dg->len + 1, sizeof(size_t));
+        dg->targets = (size_t *)malloc((dg->edge_from.len + 1) * sizeof(size_t));
+
+        // Count the edges per package, then prefix sum into offsets.
+        for (size_t i = 0; i < dg->edge_from.len; ++i) {
+                dg->offsets[dg->edge_from.data[i] + 1]++;
+        }
+        for (size_t i = 0; i < dg->len; ++i) {
+                dg->offsets[i + 1] += dg->offsets[i];
         }
 
-        rec_stack[st] = 1;
+        size_t *fill = (size_t *)malloc((dg->len + 1) * sizeof(size_t));
+        memcpy(fill, dg->offsets, (dg->len + 1) * sizeof(size_t));
 
-        // Process all dependencies
-        depgraph_node *it = dg->tbl[st]->next;
-        while (it) {
-                ssize_t index = get_index_of_pkg(dg, it->name);
+        // Walk the edges backwards so that the most recently added
+        // dependency comes first, which is the order the graph has
+        // always been traversed in.
+        for (size_t i = dg->edge_from.len; i-- > 0;) {
+                const char *to = dg->edge_to.data[i];
+                ssize_t index = get_index_of_pkg(dg, to);
                 if (index == -1) {
-                        //assert(0 && "Package not found in graph");
                         fprintf(stderr,
                                 "WARN: package %s was not found when constructing the dependency graph\n"
                                 "Continuing...\n",
-                                it->name);
-                        it = it->next;
+                                to);
                         continue;
                 }
-                __depgraph_gen_order(dg, ar, (size_t)index, visited, rec_stack);
-                it = it->next;
+                dg->targets[fill[dg->edge_from.data[i]]++] = (size_t)index;
         }
 
-        // Mark node as visited and remove from recursion stack
-        visited[st] = 1;
-        rec_stack[st] = 0;
+        // Close the gaps left by dangling edges.
+        size_t w = 0;
+        for (size_t i = 0; i < dg->len; ++i) {
+                size_t st = dg->offsets[i];
+                dg->offsets[i] = w;
+                for (size_t j = st; j < fill[i]; ++j) {
+                        dg->targets[w++] = dg->targets[j];
+                }
+        }
+        dg->offsets[dg->len] = w;
 
-        dyn_array_append(*ar, st);
+        free(fill);
+        dg->frozen = 1;
 }
 
 size_t_array
-depgraph_gen_order(const depgraph *dg)
+depgraph_gen_order(depgraph *dg)
 {
+        depgraph_freeze(dg);
+
         size_t_array ar = dyn_array_empty(size_t_array);
 
-        int *visited = (int *)calloc(dg->len, sizeof(int));
-        int *rec_stack = (int *)calloc(dg->len, sizeof(int));
+        // 0 = unvisited, 1 = on the stack, 2 = done. A dependency that is
+        // still on the stack is a cycle and is skipped.
+        unsigned char *state = (unsigned char *)calloc(dg->len, sizeof(unsigned char));
+        size_t *stack = (size_t *)malloc((dg->len + 1) * sizeof(size_t));
+        size_t *next = (size_t *)malloc((dg->len + 1) * sizeof(size_t));
 
         for (size_t i = 0; i < dg->len; ++i) {
-                if (!visited[i]) {
-                        __depgraph_gen_order(dg, &ar, i, visited, rec_stack);
+                if (state[i]) continue;
+
+                size_t sp = 0;
+                stack[sp] = i;
+                next[sp] = dg->offsets[i];
+                state[i] = 1;
+                ++sp;
+
+                while (sp > 0) {
+                        size_t st = stack[sp - 1];
+                        if (next[sp - 1] < dg->offsets[st + 1]) {
+                                size_t dep = dg->targets[next[sp - 1]++];
+                                if (state[dep]) continue;
+                                stack[sp] = dep;
+                                next[sp] = dg->offsets[dep];
+                                state[dep] = 1;
+                                ++sp;
+                        } else {
+                                state[st] = 2;
+                                dyn_array_append(ar, st);
+                                --sp;
+                        }
                 }
         }
 
-        free(visited);
-        free(rec_stack);
+        free(state);
+        free(stack);
+        free(next);
 
         return ar;
 }
 
 void
-depgraph_dump(const depgraph *dg)
+depgraph_dump(depgraph *dg)
 {
+        depgraph_freeze(dg);
+
         for (size_t i = 0; i < dg->len; ++i) {
-                printf("* %s", dg->tbl[i]->name);
-                depgraph_node *it = dg->tbl[i]->next;
-                if (it) { printf(" -> "); }
-                while (it) {
-                        printf("%s", it->name);
-                        it = it->next;
-                        if (it) { printf(" -> "); }
+                printf("* %s", dg->names[i]);
+                for (size_t j = dg->offsets[i]; j < dg->offsets[i + 1]; ++j) {
+                        printf(" -> %s", dg->names[dg->targets[j]]);
                 }
                 putchar('\n');
         }
@@ -27,6 +27,7 @@
 #include "flags.h"
 #include "config.h"
 #include "copying.h"
+#include "paths.h"
 #include "utils.h"
 
 #define INDENT printf("    ");
@@ -54,7 +55,11 @@ help_rebuild(void)
         INDENT printf("Doing this operation is required when adding\n");
         INDENT printf("and dropping repositories.\n");
         INDENT printf("What this option does is compile all C modules\n");
-        INDENT printf("into .so files for forge to link to during runtime.\n\n");
+        INDENT printf("into .so files for forge to link to during runtime.\n");
+        INDENT printf("Modules whose source, forge API headers and compiler\n");
+        INDENT printf("flags did not change since their last successful build\n");
+        INDENT printf("are skipped. The rest are compiled in parallel, up to\n");
+        INDENT printf("-j=n at a time (the number of processors by default).\n\n");
 
         INDENT printf("Example:\n");
         INDENT INDENT printf("forge -r\n");
@@ -101,11 +106,15 @@ help_search(void)
         INDENT printf("List packages by a name using regex.\n");
         INDENT printf("This command will search through all packages\n");
         INDENT printf("and will only display the ones where the name\n");
-        INDENT printf("gets a regex match with the names provided.\n\n");
+        INDENT printf("gets a regex match with the names provided.\n");
+        INDENT printf("With --%s, descriptions are matched as well.\n", FLAG_2HY_DESC);
+        INDENT printf("Plain text is looked up in a search index\n");
+        INDENT printf("instead of matching each package.\n\n");
 
         INDENT printf("Example:\n");
         INDENT INDENT printf("forge search malloc-nbytes\n");
         INDENT INDENT printf("forge search malloc-nbytes GNU\n");
+        INDENT INDENT printf("forge --%s search compiler\n", FLAG_2HY_DESC);
 }
 
 static void
@@ -115,6 +124,15 @@ help_install(void)
         INDENT printf("This command will install packages matching the names\n");
         INDENT printf("of the packages provided.\n\n");
 
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("Packages are built one after the other with their output\n");
+        INDENT INDENT printf("on the terminal. With --jobs they are installed as a\n");
+        INDENT INDENT printf("pipeline instead: sources are fetched ahead of the builds,\n");
+        INDENT INDENT printf("a finished package is moved onto the host filesystem while\n");
+        INDENT INDENT printf("the next one builds, and the output of each fetch and build\n");
+        INDENT INDENT printf("is written to a log file, which is removed on success\n");
+        INDENT INDENT printf("(see -h=--jobs).\n\n");
+
         INDENT printf("Example:\n");
         INDENT INDENT printf("forge install malloc-nbytes@ampire\n");
         INDENT INDENT printf("forge install malloc-nbytes@earl naskst@gf\n");
@@ -149,6 +167,11 @@ help_update(void)
         INDENT INDENT printf("(when you update, it will tell you when it does not\n");
         INDENT INDENT printf("know if there is an update available)\n\n");
 
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("The package stays installed while it is rebuilt. Then only\n");
+        INDENT INDENT printf("files that are new or changed (by size, mode and hash) are\n");
+        INDENT INDENT printf("written, and files the new version no longer has are removed.\n\n");
+
         INDENT printf("Note:\n");
         INDENT INDENT printf("If you have the main repository enabled, you can do\n");
         INDENT INDENT INDENT printf("forge --force update forge\n");
@@ -172,6 +195,54 @@ help_info(void)
         INDENT INDENT printf("forge info malloc-nbytes@earl\n");
 }
 
+static void
+help_stats(void)
+{
+        printf("help(%s [pkg...]):\n", CMD_STATS);
+        INDENT printf("Show how long the download, build, install and merge\n");
+        INDENT printf("phases of packages took, as recorded on every install.\n");
+        INDENT printf("With no packages, every package with any history is shown.\n");
+        INDENT printf("These times are also used to estimate install times and to\n");
+        INDENT printf("build the longest chains of packages first.\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("Installs that used the binary package cache are not recorded.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge stats\n");
+        INDENT INDENT printf("forge stats malloc-nbytes@earl\n");
+}
+
+static void
+help_bench(void)
+{
+        printf("help(%s [key=value...]):\n", CMD_BENCH);
+        INDENT printf("Measure forge itself. A repository of synthetic packages is\n");
+        INDENT printf("generated in /tmp and this forge binary is run against it\n");
+        INDENT printf("(rebuild, startup, list, search, deps, install, update,\n");
+        INDENT printf("uninstall and clean) with its own database, module and cache\n");
+        INDENT printf("directories. The results are written as JSON.\n\n");
+
+        INDENT printf("Parameters:\n");
+        INDENT INDENT printf("pkgs=n     number of packages (default 100)\n");
+        INDENT INDENT printf("fanout=n   dependencies per package (default 3)\n");
+        INDENT INDENT printf("depth=n    layers of the dependency graph (default 5)\n");
+        INDENT INDENT printf("files=n    files installed per package (default 10)\n");
+        INDENT INDENT printf("runs=n     how many times to run every command (default 1)\n");
+        INDENT INDENT printf("seed=n     seed for picking dependencies (default 1)\n");
+        INDENT INDENT printf("out=path   where to write the JSON, - for stdout (default -)\n");
+        INDENT INDENT printf("keep       keep the scratch directory afterwards\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("--%s and --%s are passed on to install and update.\n", FLAG_2HY_JOBS, FLAG_2HY_NO_CACHE);
+        INDENT INDENT printf("The host is not touched, the scratch directories are bind\n");
+        INDENT INDENT printf("mounted in a private mount namespace, which needs root.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge bench\n");
+        INDENT INDENT printf("forge -j=4 bench pkgs=500 fanout=4 depth=8 runs=3 out=bench.json\n");
+}
+
 static void
 help_add_repo(void)
 {
@@ -300,6 +371,103 @@ help_files(void)
         INDENT INDENT printf("forge files malloc-nbytes@earl\n");
 }
 
+static void
+help_desc(void)
+{
+        printf("help(--%s):\n", FLAG_2HY_DESC);
+        INDENT printf("Make `%s` match package descriptions as well as\n", CMD_SEARCH);
+        INDENT printf("package names.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge --%s %s compiler\n", FLAG_2HY_DESC, CMD_SEARCH);
+}
+
+static void
+help_format(void)
+{
+        printf("help(--%s=json|tsv|null|table):\n", FLAG_2HY_FORMAT);
+        INDENT printf("Print the results of %s, %s, %s, %s and %s in a\n",
+                      CMD_LIST, CMD_SEARCH, CMD_FILES, CMD_DEPS, CMD_LIST_DEPS);
+        INDENT printf("format meant for scripts. Rows are written as they are read\n");
+        INDENT printf("from the database and without colors.\n\n");
+
+        INDENT printf("json:  an array of objects, one per row\n");
+        INDENT printf("tsv:   one line per row, fields separated by tabs, with\n");
+        INDENT printf("       backslash, tab and newline escaped as \\\\, \\t and \\n\n");
+        INDENT printf("null:  every field terminated by a NUL byte\n");
+        INDENT printf("table: the default, for people\n\n");
+
+        INDENT printf("Fields:\n");
+        INDENT INDENT printf("%s, %s: name, version, description, installed\n", CMD_LIST, CMD_SEARCH);
+        INDENT INDENT printf("%s:         package, name, version, description, installed\n", CMD_DEPS);
+        INDENT INDENT printf("%s:        package, path\n", CMD_FILES);
+        INDENT INDENT printf("%s:    name, required_by (one row per dependent)\n\n", CMD_LIST_DEPS);
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge --%s=json list\n", FLAG_2HY_FORMAT);
+        INDENT INDENT printf("forge --%s=null files malloc-nbytes@earl | xargs -0 -n2 echo\n", FLAG_2HY_FORMAT);
+}
+
+static void
+help_verify(void)
+{
+        printf("help(%s [pkg...]):\n", CMD_VERIFY);
+        INDENT printf("Check the installed files of `pkg` (or of every installed\n");
+        INDENT printf("package) against what was recorded when they were installed.\n");
+        INDENT printf("Files that are missing, changed type or permissions, or whose\n");
+        INDENT printf("contents no longer match their SHA-256 are listed. Only files\n");
+        INDENT printf("whose size or mtime changed are read, unless --%s is given.\n", FLAG_2HY_FULL);
+        INDENT printf("Exits with 1 if any problem was found.\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("Hashes are recorded as files are installed, so packages\n");
+        INDENT INDENT printf("installed by older versions of forge are only checked by\n");
+        INDENT INDENT printf("size until they are reinstalled.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge %s\n", CMD_VERIFY);
+        INDENT INDENT printf("forge --%s %s malloc-nbytes@earl\n", FLAG_2HY_FULL, CMD_VERIFY);
+}
+
+static void
+help_owns(void)
+{
+        printf("help(%s <path...>):\n", CMD_OWNS);
+        INDENT printf("Find the package that installed each path.\n");
+        INDENT printf("Paths may be globs, which list every matching\n");
+        INDENT printf("installed file. With no paths, or a path of `-`,\n");
+        INDENT printf("paths are read from stdin, one per line.\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("Installing a package that would overwrite a file owned by\n");
+        INDENT INDENT printf("another package is refused unless --%s is given, in which\n", FLAG_2HY_FORCE);
+        INDENT INDENT printf("case the file changes owner.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge owns /usr/local/bin/earl\n");
+        INDENT INDENT printf("forge owns '/usr/local/lib/*.so'\n");
+        INDENT INDENT printf("find /usr/local/bin -type f | forge owns\n");
+}
+
+static void
+help_daemon(void)
+{
+        printf("help(%s):\n", CMD_DAEMON);
+        INDENT printf("Keep forge's modules and database loaded and answer the\n");
+        INDENT printf("read-only commands (%s, %s, %s, %s, %s, %s, %s\n",
+                      CMD_LIST, CMD_FILES, CMD_DEPS, CMD_INFO, CMD_SEARCH, CMD_OWNS, CMD_STATS);
+        INDENT printf("and %s) for every user over " DATABASE_DIR "/forge.sock.\n", CMD_LIST_DEPS);
+        INDENT printf("Those commands use the daemon whenever it is running and\n");
+        INDENT printf("otherwise run as usual. Stop it with Ctrl-C or SIGTERM.\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("Set FORGE_NO_DAEMON to always run commands in-process.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("sudo forge daemon &\n");
+        INDENT INDENT printf("forge info malloc-nbytes@earl\n");
+}
+
 static void
 help_api(void)
 {
@@ -541,6 +709,60 @@ help_pretend(void)
         INDENT INDENT printf("forge -op install malloc-nbytes@ampire malloc-nbytes@earl\n");
 }
 
+static void
+help_jobs(void)
+{
+        printf("help(-%s[=n], --%s[=n]):\n", FLAG_1HY_JOBS, FLAG_2HY_JOBS);
+        INDENT printf("Build up to `n` packages at the same time when installing.\n");
+        INDENT printf("The full set of packages (including dependencies) is\n");
+        INDENT printf("planned up front and packages that do not depend on each\n");
+        INDENT printf("other are built concurrently, each in its own fakeroot.\n");
+        INDENT printf("Up to `n` sources are also downloaded ahead of the builds.\n");
+        INDENT printf("Moving the files onto the host filesystem still happens\n");
+        INDENT printf("one package at a time. If `n` is omitted, the number of\n");
+        INDENT printf("available processors is used.\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("The output of each build is written to a log file\n");
+        INDENT INDENT printf("next to its fakeroot, which is removed on success.\n");
+        INDENT INDENT printf("All builds share one GNU make jobserver sized by\n");
+        INDENT INDENT printf("FORGE_PREFERRED_MAKEFILE_JFLAGS in conf.h, so running\n");
+        INDENT INDENT printf("several builds does not multiply the make jobs.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge -j install malloc-nbytes@earl\n");
+        INDENT INDENT printf("forge --jobs=4 install malloc-nbytes@earl malloc-nbytes@AnimX\n");
+}
+
+static void
+help_no_cache(void)
+{
+        printf("help(--%s):\n", FLAG_2HY_NO_CACHE);
+        INDENT printf("Do not use the binary package cache. Normally, after a package\n");
+        INDENT printf("is installed into its fakeroot, the fakeroot is archived to\n");
+        INDENT printf(BINPKG_CACHE_DIR ". Installing the exact same build again\n");
+        INDENT printf("(same module source, version, dependency versions and conf.h)\n");
+        INDENT printf("merges straight from that archive instead of rebuilding.\n");
+        INDENT printf("This option neither reads from nor writes to the cache.\n\n");
+
+        INDENT printf("Note:\n");
+        INDENT INDENT printf("`update` always rebuilds, but still refreshes the cache.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge --no-cache install malloc-nbytes@earl\n");
+}
+
+static void
+help_yes(void)
+{
+        printf("help(-%s, --%s):\n", FLAG_1HY_YES, FLAG_2HY_YES);
+        INDENT printf("Do not ask whether to continue before installing packages.\n");
+        INDENT printf("Useful when forge is not run from a terminal.\n\n");
+
+        INDENT printf("Example:\n");
+        INDENT INDENT printf("forge -y install malloc-nbytes@earl\n");
+}
+
 void
 forge_flags_help(const char *flag)
 {
@@ -581,6 +803,16 @@ forge_flags_help(const char *flag)
                 help_only,
                 help_keep_fakeroot,
                 help_pretend,
+                help_jobs,
+                help_no_cache,
+                help_stats,
+                help_bench,
+                help_yes,
+                help_desc,
+                help_owns,
+                help_daemon,
+                help_format,
+                help_verify,
         };
 
         size_t n = strlen(flag);
@@ -608,6 +840,22 @@ forge_flags_help(const char *flag)
                 hs[35]();
         } else if (n == 2 && flag[0] == '-' && flag[1] == FLAG_1HY_PRETEND[0]) {
                 hs[35]();
+        } else if (n > 3 && flag[0] == '-' && flag[1] == '-' && !strcmp(flag+2, FLAG_2HY_JOBS)) {
+                hs[36]();
+        } else if (n == 2 && flag[0] == '-' && flag[1] == FLAG_1HY_JOBS[0]) {
+                hs[36]();
+        } else if (n > 3 && flag[0] == '-' && flag[1] == '-' && !strcmp(flag+2, FLAG_2HY_NO_CACHE)) {
+                hs[37]();
+        } else if (n > 3 && flag[0] == '-' && flag[1] == '-' && !strcmp(flag+2, FLAG_2HY_YES)) {
+                hs[40]();
+        } else if (n == 2 && flag[0] == '-' && flag[1] == FLAG_1HY_YES[0]) {
+                hs[40]();
+        } else if (n > 3 && flag[0] == '-' && flag[1] == '-' && !strcmp(flag+2, FLAG_2HY_DESC)) {
+                hs[41]();
+        } else if (n > 3 && flag[0] == '-' && flag[1] == '-' && !strcmp(flag+2, FLAG_2HY_FORMAT)) {
+                hs[44]();
+        } else if (n > 3 && flag[0] == '-' && flag[1] == '-' && !strcmp(flag+2, FLAG_2HY_FULL)) {
+                hs[45]();
         }
 
         // commands
@@ -691,6 +939,16 @@ forge_flags_help(const char *flag)
                 hs[31]();
         } else if (!strcmp(flag, CMD_INFO)) {
                 hs[32]();
+        } else if (!strcmp(flag, CMD_STATS)) {
+                hs[38]();
+        } else if (!strcmp(flag, CMD_BENCH)) {
+                hs[39]();
+        } else if (!strcmp(flag, CMD_OWNS)) {
+                hs[42]();
+        } else if (!strcmp(flag, CMD_DAEMON)) {
+                hs[43]();
+        } else if (!strcmp(flag, CMD_VERIFY)) {
+                hs[45]();
         }
 
         else if (!strcmp(flag, "*")) {
@@ -743,8 +1001,14 @@ forge_flags_usage(void)
         printf(YELLOW BOLD "    -%s, --%s              R"                         RESET "  sync the C modules repository\n", FLAG_1HY_SYNC, FLAG_2HY_SYNC);
         printf(YELLOW BOLD "    -%s, --%s              R"                         RESET "  only install the package(s) without dependencies\n", FLAG_1HY_ONLY, FLAG_2HY_ONLY);
         printf(YELLOW BOLD "    -%s, --%s           "             RESET YELLOW BOLD " N" RESET " pretend install/uninstalling package(s)\n", FLAG_1HY_PRETEND, FLAG_2HY_PRETEND);
+        printf(YELLOW BOLD "    -%s, --%s[=n]         "                         RESET "  build up to n packages at the same time\n", FLAG_1HY_JOBS, FLAG_2HY_JOBS);
         printf(YELLOW BOLD "        --%s              "                         RESET "  force the action if it can\n", FLAG_2HY_FORCE);
         printf(YELLOW BOLD "        --%s       "                         RESET " keep the generated fakeroot\n", FLAG_2HY_KEEP_FAKEROOT);
+        printf(YELLOW BOLD "        --%s            "                         RESET "  do not use the binary package cache\n", FLAG_2HY_NO_CACHE);
+        printf(YELLOW BOLD "    -%s, --%s               "                         RESET "  do not ask before installing\n", FLAG_1HY_YES, FLAG_2HY_YES);
+        printf(YELLOW BOLD "        --%s            "                         RESET "  make search match descriptions too\n", FLAG_2HY_DESC);
+        printf(YELLOW BOLD "        --%s=<fmt>      "                         RESET "  print listings as json, tsv or null separated\n", FLAG_2HY_FORMAT);
+        printf(YELLOW BOLD "        --%s            "                         RESET "  make verify read every file\n", FLAG_2HY_FULL);
         printf("\nCommands:\n");
         printf(GREEN BOLD "    %s          " RESET                                "             list available packages\n", CMD_LIST);
         printf(GREEN BOLD "    %s <pkg...> "                         RESET "           search for packages\n", CMD_SEARCH);
@@ -753,6 +1017,9 @@ forge_flags_usage(void)
         printf(GREEN BOLD "    %s <pkg...> " RESET YELLOW BOLD "     R "       RESET  " uninstall packages\n", CMD_UNINSTALL);
         printf(GREEN BOLD "    %s <pkg...> " RESET YELLOW BOLD "        RN"    RESET  " update packages or leave empty to update all\n", CMD_UPDATE);
         printf(GREEN BOLD "    %s <pkg>      " RESET YELLOW BOLD "        R "    RESET  " view package information\n", CMD_INFO);
+        printf(GREEN BOLD "    %s [pkg...]  " RESET                                "            view recorded build times\n", CMD_STATS);
+        printf(GREEN BOLD "    %s [k=v...]  " RESET YELLOW BOLD "          RN" RESET  " benchmark forge against synthetic packages\n", CMD_BENCH);
+        printf(GREEN BOLD "    %s          " RESET YELLOW BOLD "          RN" RESET  " serve read-only commands from memory\n", CMD_DAEMON);
         printf(GREEN BOLD "    %s <name> " RESET YELLOW BOLD "        R "    RESET  " save a dependency package as explictly installed\n", CMD_SAVE_DEP);
         printf(GREEN BOLD "    %s" RESET YELLOW BOLD "                   RN"    RESET  " remove unused dependency packages\n", CMD_CLEAN);
         printf(GREEN BOLD "    %s <git-link> " RESET YELLOW BOLD "    RN"    RESET  " add a github repository to forge\n", CMD_ADD_REPO);
@@ -766,6 +1033,8 @@ forge_flags_usage(void)
         printf(GREEN BOLD "    %s <name...>" RESET                                "             dump a package module\n", CMD_DUMP);
         printf(GREEN BOLD "    %s <name...>   " RESET YELLOW BOLD "       RN"  RESET  " drop a package\n", CMD_DROP);
         printf(GREEN BOLD "    %s <name>" RESET                                   "               list all installed files for package <name>\n", CMD_FILES);
+        printf(GREEN BOLD "    %s <path...>" RESET                                "             find the packages that installed files\n", CMD_OWNS);
+        printf(GREEN BOLD "    %s [pkg...]" RESET                                 "            check installed files for changes\n", CMD_VERIFY);
         printf(GREEN BOLD "    %s [name...]" RESET                                "              show the header files for the Forge API\n", CMD_API);
         printf(GREEN BOLD "    %s <name>" RESET                                   "             restore a recently dropped package\n", CMD_RESTORE);
         printf(GREEN BOLD "    %s" RESET                                          "                    view copying information\n", CMD_COPYING);
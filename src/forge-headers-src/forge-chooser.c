@@ -226,12 +226,15 @@ search(forge_chooser_context *ctx)
 
                                 // Search for the query in the choices
                                 const char *pattern = forge_str_to_cstr(&ctx->search.last);
-                                if (pattern && pattern[0] != '\0') {
+                                forge_regex *re = pattern && pattern[0] != '\0'
+                                        ? forge_utils_regex_compile(pattern) : NULL;
+                                if (re) {
                                         for (size_t i = 0; i < ctx->choices_n; ++i) {
-                                                if (forge_utils_regex(pattern, ctx->choices[i])) {
+                                                if (forge_utils_regex_match(re, ctx->choices[i])) {
                                                         dyn_array_append(ctx->search.matches, i);
                                                 }
                                         }
+                                        forge_utils_regex_free(re);
                                 }
 
                                 // Jump to first match if it exists
@@ -17,8 +17,13 @@
  * with this program; if not, see <https://www.gnu.org/licenses/>.
 */
 
+#define _GNU_SOURCE
+
 #include <ctype.h>
+#include <poll.h>
+#include <spawn.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <pwd.h>
 #include <grp.h>
 #include <unistd.h>
@@ -34,6 +39,8 @@
 #include "forge/conf.h"
 #include "forge/cstr.h"
 
+extern char **environ;
+
 char *
 cwd(void)
 {
@@ -86,137 +93,214 @@ cd_silent(const char *fp)
         return 1;
 }
 
+static int
+spawn_stream(posix_spawn_file_actions_t *fa,
+             forge_cmd_stream            how,
+             int                         target,
+             int                         pipefd[2])
+{
+        switch (how) {
+        case FORGE_CMD_INHERIT:
+                return 1;
+        case FORGE_CMD_NULL:
+                return posix_spawn_file_actions_addopen(fa, target, "/dev/null", O_WRONLY, 0) == 0;
+        case FORGE_CMD_SINK:
+                if (pipe2(pipefd, O_CLOEXEC) == -1) return 0;
+                return posix_spawn_file_actions_adddup2(fa, pipefd[1], target) == 0;
+        case FORGE_CMD_MERGE:
+                return posix_spawn_file_actions_adddup2(fa, STDOUT_FILENO, target) == 0;
+        }
+        return 0;
+}
+
 int
-cmd(const char *cmd)
+forge_cmd_run(const char *const      argv[],
+              const forge_cmd_opts  *opts,
+              forge_cmd_status      *status)
 {
-        printf("\033[93m" "\033[2m");
+        static const forge_cmd_opts defaults = {0};
+        forge_cmd_status ignored;
+
+        if (!opts)   opts = &defaults;
+        if (!status) status = &ignored;
+        memset(status, 0, sizeof(*status));
+
+        const char *sh_argv[] = {"/bin/sh", "-c", argv[0], NULL};
+        if (opts->shell) {
+                argv = sh_argv;
+        }
+
+        int out[2] = {-1, -1}, err[2] = {-1, -1};
+        posix_spawn_file_actions_t fa;
+        posix_spawn_file_actions_init(&fa);
+
+        int ok = 1;
+        if (opts->null_stdin) {
+                ok = posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0) == 0;
+        }
+        // stdout first, FORGE_CMD_MERGE depends on it.
+        ok = ok && spawn_stream(&fa, opts->out, STDOUT_FILENO, out);
+        ok = ok && spawn_stream(&fa, opts->err, STDERR_FILENO, err);
+        if (ok && opts->cwd) {
+                ok = posix_spawn_file_actions_addchdir_np(&fa, opts->cwd) == 0;
+        }
+
+        pid_t pid = -1;
+        if (ok) {
+                // Whatever we printed so far goes before the output of the child.
+                fflush(stdout);
+                fflush(stderr);
+                int rc = posix_spawnp(&pid, argv[0], &fa, NULL, (char *const *)argv, environ);
+                if (rc != 0) {
+                        status->spawn_errno = rc;
+                        ok = 0;
+                }
+        } else {
+                status->spawn_errno = errno ? errno : EINVAL;
+        }
+        posix_spawn_file_actions_destroy(&fa);
 
-        printf(">>> %s\n", cmd);
+        if (out[1] != -1) close(out[1]);
+        if (err[1] != -1) close(err[1]);
+
+        struct pollfd pfds[2] = {
+                { .fd = ok ? out[0] : -1, .events = POLLIN },
+                { .fd = ok ? err[0] : -1, .events = POLLIN },
+        };
 
-        FILE *fp = popen(cmd, "r");
-        if (fp == NULL) {
-                printf("\033[0m");
-                fprintf(stderr, "Failed to execute command '%s': %s\n", cmd, strerror(errno));
+        char buf[64 * 1024];
+        while (pfds[0].fd != -1 || pfds[1].fd != -1) {
+                if (poll(pfds, 2, -1) == -1) {
+                        if (errno == EINTR) continue;
+                        break;
+                }
+                for (int i = 0; i < 2; ++i) {
+                        if (pfds[i].fd == -1 || pfds[i].revents == 0) continue;
+                        ssize_t n = read(pfds[i].fd, buf, sizeof(buf));
+                        if (n > 0) {
+                                opts->sink(i + 1, buf, (size_t)n, opts->ud);
+                        } else if (n == 0 || errno != EINTR) {
+                                pfds[i].fd = -1;
+                        }
+                }
+        }
+
+        if (out[0] != -1) close(out[0]);
+        if (err[0] != -1) close(err[0]);
+
+        if (!ok) {
                 return 0;
         }
 
-        char buffer[1024];
-        while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-                printf("\033[0m");
-                printf("%s", buffer);
+        int ws = 0;
+        while (waitpid(pid, &ws, 0) == -1) {
+                if (errno != EINTR) {
+                        status->spawn_errno = errno;
+                        return 0;
+                }
         }
 
-        // Get exit status
-        int status = pclose(fp);
-        if (status == -1) {
-                printf("\033[0m");
-                fprintf(stderr, "Failed to close pipe for command '%s': %s\n", cmd, strerror(errno));
-                return 0;
+        if (WIFEXITED(ws)) {
+                status->exited = 1;
+                status->code = WEXITSTATUS(ws);
+        } else if (WIFSIGNALED(ws)) {
+                status->signal = WTERMSIG(ws);
         }
 
-        printf("\033[0m");
-        return WEXITSTATUS(status) == 0;
+        return status->exited && status->code == 0;
 }
 
-int cmd_s(const char *cmd)
+static int
+run_shell(const char       *cmd,
+          forge_cmd_stream  out,
+          forge_cmd_sink    sink,
+          void             *ud)
 {
-        FILE *fp = popen(cmd, "r");
-        if (fp == NULL) {
-                fprintf(stderr, "Failed to execute command '%s': %s\n", cmd, strerror(errno));
-                return 0;
-        }
+        const char *argv[] = {cmd, NULL};
+        forge_cmd_opts opts = {
+                .shell = 1,
+                .out = out,
+                .sink = sink,
+                .ud = ud,
+        };
+        forge_cmd_status st;
 
-        // Get exit status
-        int status = pclose(fp);
-        if (status == -1) {
-                printf("\033[0m");
-                fprintf(stderr, "Failed to close pipe for command '%s': %s\n", cmd, strerror(errno));
-                return 0;
+        int ok = forge_cmd_run(argv, &opts, &st);
+        if (st.spawn_errno) {
+                fprintf(stderr, "Failed to execute command '%s': %s\n", cmd, strerror(st.spawn_errno));
         }
 
+        return ok;
+}
+
+int
+cmd(const char *cmd)
+{
+        printf("\033[93m" "\033[2m");
+        printf(">>> %s\n", cmd);
         printf("\033[0m");
-        return WEXITSTATUS(status) == 0;
+
+        return run_shell(cmd, FORGE_CMD_INHERIT, NULL, NULL);
+}
+
+int cmd_s(const char *cmd)
+{
+        return run_shell(cmd, FORGE_CMD_NULL, NULL, NULL);
 }
 
 int
 cmd_as(const char *cmd,
        const char *username) {
         // Construct the command with sudo -u to run as the specified user
-        char *sudo_cmd = malloc(strlen(cmd) + strlen(username) + 20);
-        if (!sudo_cmd) {
-                fprintf(stderr, "Memory allocation failed: %s\n", strerror(errno));
-                return 0;
-        }
-        snprintf(sudo_cmd, strlen(cmd) + strlen(username) + 20, "sudo -u %s %s", username, cmd);
+        char *sudo_cmd = forge_cstr_builder("sudo -u ", username, " ", cmd, NULL);
 
         printf(">>> %s\n", sudo_cmd);
 
-        // Open pipe to execute the command
-        FILE *fp = popen(sudo_cmd, "r");
-        if (fp == NULL) {
-                fprintf(stderr, "Failed to execute command '%s': %s\n", sudo_cmd, strerror(errno));
-                free(sudo_cmd);
-                return 0;
-        }
-
-        // Read and print command output
-        char buffer[1024];
-        while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-                printf("%s", buffer);
-        }
-
-        // Get exit status
-        int status = pclose(fp);
-        if (status == -1) {
-                fprintf(stderr, "Failed to close pipe for command '%s': %s\n", sudo_cmd, strerror(errno));
-                free(sudo_cmd);
-                return 0;
-        }
+        int ok = run_shell(sudo_cmd, FORGE_CMD_INHERIT, NULL, NULL);
 
         free(sudo_cmd);
-        return WEXITSTATUS(status) == 0;
+        return ok;
+}
+
+typedef struct {
+        char   *data;
+        size_t  len;
+        size_t  cap;
+} cmdout_buf;
+
+static void
+cmdout_sink(int         fd,
+            const char *buf,
+            size_t      n,
+            void       *ud)
+{
+        (void)fd;
+        cmdout_buf *out = (cmdout_buf *)ud;
+
+        if (out->len + n + 1 > out->cap) {
+                size_t cap = out->cap ? out->cap : 1024;
+                while (out->len + n + 1 > cap) cap *= 2;
+                out->data = (char *)realloc(out->data, cap);
+                out->cap = cap;
+        }
+        memcpy(out->data + out->len, buf, n);
+        out->len += n;
+        out->data[out->len] = '\0';
 }
 
 char *
 cmdout(const char *cmd)
 {
-        FILE *fp = popen(cmd, "r");
-        if (fp == NULL) {
-                fprintf(stderr, "Failed to execute command '%s': %s\n", cmd, strerror(errno));
-                return NULL;
-        }
-
-        // Dynamic buffer to store output
-        char *buffer = NULL;
-        size_t buffer_size = 0;
-        size_t total_size = 0;
-        size_t chunk_size = 1024;
-
-        // Read output in chunks
-        while (1) {
-                buffer = realloc(buffer, buffer_size + chunk_size);
-                if (buffer == NULL) {
-                        fprintf(stderr, "Memory allocation failed: %s\n", strerror(errno));
-                        pclose(fp);
-                        return NULL;
-                }
-                buffer_size += chunk_size;
+        cmdout_buf out = {0};
 
-                size_t read_size = fread(buffer + total_size, 1, chunk_size - 1, fp);
-                total_size += read_size;
-                buffer[total_size] = '\0';
-
-                if (read_size < chunk_size - 1) {
-                        break; // EOF or error
-                }
-        }
-
-        int status = pclose(fp);
-        if (status == -1 || WEXITSTATUS(status) != 0) {
-                free(buffer);
+        if (!run_shell(cmd, FORGE_CMD_SINK, cmdout_sink, &out)) {
+                free(out.data);
                 return NULL;
         }
 
+        char *buffer = out.data;
+        size_t total_size = out.len;
+
         // Check if output is only whitespace
         int is_whitespace = 1;
         for (size_t i = 0; i < total_size; i++) {
@@ -312,6 +396,15 @@ int
 make(const char *type)
 {
         char buf[256] = {0};
+
+        // When forge runs a jobserver, make takes its job slots
+        // from there. An explicit -j would make it start its own.
+        const char *makeflags = getenv("MAKEFLAGS");
+        if (makeflags && strstr(makeflags, "--jobserver-auth")) {
+                sprintf(buf, "make%s%s", type ? " " : "", type ? type : "");
+                return cmd(buf);
+        }
+
         if (type) {
                 sprintf(buf, "make %s -j%s", type, FORGE_PREFERRED_MAKEFILE_JFLAGS);
         } else {
@@ -408,13 +501,60 @@ is_sudo(void)
         return !geteuid();
 }
 
+// Remove `name` in `dfd` and, if it is a directory, everything
+// below it. Symlinks are removed, never followed.
+static int
+rm_tree_at(int         dfd,
+           const char *name)
+{
+        if (unlinkat(dfd, name, 0) == 0 || errno == ENOENT) {
+                return 1;
+        }
+        if (errno != EISDIR && errno != EPERM) {
+                return 0;
+        }
+
+        int fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd == -1) {
+                return errno == ENOENT;
+        }
+
+        DIR *dir = fdopendir(fd);
+        if (!dir) {
+                close(fd);
+                return 0;
+        }
+
+        int ok = 1;
+        struct dirent *e;
+        while ((e = readdir(dir))) {
+                if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+                ok &= rm_tree_at(fd, e->d_name);
+        }
+        closedir(dir);
+
+        if (unlinkat(dfd, name, AT_REMOVEDIR) != 0 && errno != ENOENT) {
+                ok = 0;
+        }
+
+        return ok;
+}
+
 int
 rmrf(const char *fp)
 {
-        char buf[PATH_MAX+7+1] = {0};
-        strcat(buf, "rm -rf ");
-        strcat(buf, fp);
-        return cmd_s(buf);
+        // Modules may pass globs or variables, which only
+        // the shell can expand.
+        if (strpbrk(fp, "*?[$~`")) {
+                char *command = forge_cstr_builder("rm -rf ", fp, NULL);
+                int ok = cmd_s(command);
+                free(command);
+                return ok;
+        }
+
+        // Done in-process relative to each directory, which
+        // is a lot cheaper than `rm -rf` for large source trees.
+        return rm_tree_at(AT_FDCWD, fp);
 }
 
 int
@@ -457,6 +597,41 @@ __cmd_builder(char *fst, ...)
         return res;
 }
 
+int
+__cmd_argv(const char *fst, ...)
+{
+        va_list ap;
+
+        size_t argc = 0;
+        va_start(ap, fst);
+        for (const char *arg = fst; arg; arg = va_arg(ap, const char *)) {
+                ++argc;
+        }
+        va_end(ap);
+
+        const char **argv = (const char **)malloc((argc + 1) * sizeof(char *));
+
+        printf("\033[93m" "\033[2m" ">>>");
+        va_start(ap, fst);
+        size_t i = 0;
+        for (const char *arg = fst; arg; arg = va_arg(ap, const char *)) {
+                argv[i++] = arg;
+                printf(" %s", arg);
+        }
+        va_end(ap);
+        argv[i] = NULL;
+        printf("\n" "\033[0m");
+
+        forge_cmd_status st;
+        int res = forge_cmd_run(argv, NULL, &st);
+        if (st.spawn_errno) {
+                fprintf(stderr, "Failed to execute command '%s': %s\n", fst, strerror(st.spawn_errno));
+        }
+
+        free(argv);
+        return res;
+}
+
 char *
 download_tarball(const char *link,
                  const char *dst)
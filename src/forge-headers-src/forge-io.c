@@ -26,6 +26,9 @@
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/syscall.h>
 
 #include "forge/io.h"
 #include "forge/cmd.h"
@@ -381,3 +384,127 @@ forge_io_get_home(void)
         errno = ENOENT;
         return NULL;
 }
+
+struct __forge_linux_dirent64 {
+        uint64_t       d_ino;
+        int64_t        d_off;
+        unsigned short d_reclen;
+        unsigned char  d_type;
+        char           d_name[];
+};
+
+#define __FORGE_IO_WALK_BUF_SZ (32 * 1024)
+
+static int
+__forge_io_walk(int                  dirfd,
+                char                *path,
+                size_t               pathlen,
+                int                  depth,
+                int                  flags,
+                forge_io_walk_action (*fn)(const forge_io_walk_entry *e, void *ud),
+                void                *ud)
+{
+        char *buf = (char *)malloc(__FORGE_IO_WALK_BUF_SZ);
+        int ok = 1;
+
+        for (;;) {
+                long n = syscall(SYS_getdents64, dirfd, buf, __FORGE_IO_WALK_BUF_SZ);
+                if (n == -1 && errno == EINTR) continue;
+                if (n <= 0) {
+                        ok = n == 0;
+                        break;
+                }
+
+                for (long off = 0; ok && off < n;) {
+                        struct __forge_linux_dirent64 *d = (struct __forge_linux_dirent64 *)(buf + off);
+                        off += d->d_reclen;
+
+                        const char *name = d->d_name;
+                        if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) {
+                                continue;
+                        }
+
+                        size_t namelen = strlen(name);
+                        if (pathlen + 1 + namelen >= PATH_MAX) {
+                                errno = ENAMETOOLONG;
+                                ok = 0;
+                                break;
+                        }
+                        path[pathlen] = '/';
+                        memcpy(path + pathlen + 1, name, namelen + 1);
+
+                        forge_io_walk_entry e = {
+                                .path = path,
+                                .name = path + pathlen + 1,
+                                .depth = depth,
+                                .is_dir = d->d_type == DT_DIR,
+                                .has_stat = 0,
+                        };
+
+                        int need_stat = d->d_type == DT_UNKNOWN
+                                || ((flags & FORGE_IO_WALK_STAT) && d->d_type != DT_DIR);
+                        if (need_stat) {
+                                if (fstatat(dirfd, name, &e.st, AT_SYMLINK_NOFOLLOW) == -1) {
+                                        ok = 0;
+                                        break;
+                                }
+                                e.has_stat = 1;
+                                e.is_dir = S_ISDIR(e.st.st_mode);
+                        }
+
+                        forge_io_walk_action act = fn(&e, ud);
+                        if (act == FORGE_IO_WALK_STOP) {
+                                ok = 0;
+                                break;
+                        }
+
+                        if (e.is_dir && act != FORGE_IO_WALK_SKIP) {
+                                int sub = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                                if (sub == -1) {
+                                        ok = 0;
+                                        break;
+                                }
+                                ok = __forge_io_walk(sub, path, pathlen + 1 + namelen, depth + 1, flags, fn, ud);
+                                close(sub);
+                        }
+                }
+
+                path[pathlen] = '\0';
+                if (!ok) break;
+        }
+
+        path[pathlen] = '\0';
+        free(buf);
+        return ok;
+}
+
+int
+forge_io_walk(const char *root,
+              int         flags,
+              forge_io_walk_action (*fn)(const forge_io_walk_entry *e, void *ud),
+              void       *ud)
+{
+        char path[PATH_MAX] = {0};
+        size_t len = strlen(root);
+
+        if (len >= sizeof(path)) {
+                errno = ENAMETOOLONG;
+                return 0;
+        }
+        memcpy(path, root, len + 1);
+
+        // Do not end up with `//` in the reported paths.
+        while (len > 0 && path[len - 1] == '/') {
+                path[--len] = '\0';
+        }
+
+        int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+                return 0;
+        }
+
+        int ok = __forge_io_walk(fd, path, len, 0, flags, fn, ud);
+        close(fd);
+
+        return ok;
+}
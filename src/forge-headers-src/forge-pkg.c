@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "forge/pkg.h"
 #include "forge/cmd.h"
@@ -28,41 +29,113 @@
 
 #include "paths.h"
 
-int
-forge_pkg_is_installed(const char *name)
+// Modules may ask about lots of packages, so they all share
+// one read-only connection and statement, made on first use.
+// A forked child cannot use its parent's connection, so it
+// gets its own.
+static sqlite3      *g_db = NULL;
+static sqlite3_stmt *g_installed = NULL;
+static pid_t         g_db_pid = 0;
+
+static void
+close_db(void)
 {
-        sqlite3 *db;
-        int rc = sqlite3_open_v2(DATABASE_FP, &db, SQLITE_OPEN_READONLY, NULL);
-        if (rc != SQLITE_OK) {
-                fprintf(stderr, "SQLite error: %s\n", sqlite3_errmsg(db));
-                sqlite3_close(db);
-                return 0;
+        if (g_db && g_db_pid == getpid()) {
+                sqlite3_finalize(g_installed);
+                sqlite3_close(g_db);
         }
+        g_db = NULL;
+        g_installed = NULL;
+}
 
-        sqlite3_stmt *stmt;
-        const char *sql = "SELECT installed FROM Pkgs WHERE name = ?;";
-        rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+static sqlite3_stmt *
+installed_stmt(void)
+{
+        if (g_db && g_db_pid != getpid()) {
+                // Inherited across fork(), leave it alone.
+                g_db = NULL;
+                g_installed = NULL;
+        }
+
+        if (g_installed) {
+                return g_installed;
+        }
+
+        int rc = sqlite3_open_v2(DATABASE_FP, &g_db, SQLITE_OPEN_READONLY, NULL);
+        if (rc == SQLITE_OK) {
+                const char *sql = "SELECT installed FROM Pkgs WHERE name = ?;";
+                rc = sqlite3_prepare_v3(g_db, sql, -1, SQLITE_PREPARE_PERSISTENT, &g_installed, NULL);
+        }
         if (rc != SQLITE_OK) {
-                fprintf(stderr, "SQLite error: %s\n", sqlite3_errmsg(db));
-                sqlite3_close(db);
-                return 0;
+                fprintf(stderr, "SQLite error: %s\n", sqlite3_errmsg(g_db));
+                sqlite3_close(g_db);
+                g_db = NULL;
+                return NULL;
+        }
+
+        static int registered = 0;
+        if (!registered) {
+                atexit(close_db);
+                registered = 1;
         }
+        g_db_pid = getpid();
 
+        return g_installed;
+}
+
+static int
+query_installed(sqlite3_stmt *stmt,
+                const char   *name)
+{
         sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
 
         int installed = 0;
         if (sqlite3_step(stmt) == SQLITE_ROW) {
                 installed = sqlite3_column_int(stmt, 0);
-        } else {
-                // Package not found in database
-                sqlite3_finalize(stmt);
-                return 0;
         }
+        // Package not found in database otherwise
 
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
         return installed;
 }
 
+int
+forge_pkg_is_installed(const char *name)
+{
+        sqlite3_stmt *stmt = installed_stmt();
+        if (!stmt) {
+                return 0;
+        }
+
+        return query_installed(stmt, name);
+}
+
+size_t
+__forge_pkg_are_installed(const char *const *names,
+                          size_t             n,
+                          int               *installed)
+{
+        sqlite3_stmt *stmt = installed_stmt();
+        if (!stmt) {
+                memset(installed, 0, n * sizeof(*installed));
+                return 0;
+        }
+
+        // One read transaction, so that every answer comes from
+        // the same snapshot even while another forge writes.
+        (void)sqlite3_exec(g_db, "BEGIN;", NULL, NULL, NULL);
+
+        size_t count = 0;
+        for (size_t i = 0; i < n; ++i) {
+                installed[i] = query_installed(stmt, names[i]);
+                count += installed[i] != 0;
+        }
+
+        (void)sqlite3_exec(g_db, "COMMIT;", NULL, NULL, NULL);
+
+        return count;
+}
+
 int
 forge_pkg_git_update(void)
 {
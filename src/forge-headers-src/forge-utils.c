@@ -19,27 +19,62 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <regex.h>
 
 #include "forge/utils.h"
 
+struct forge_regex {
+        regex_t regex;
+};
+
+forge_regex *
+forge_utils_regex_compile(const char *pattern)
+{
+        forge_regex *re = (forge_regex *)malloc(sizeof(forge_regex));
+
+        if (regcomp(&re->regex, pattern, REG_ICASE | REG_NOSUB)) {
+                perror("regex");
+                free(re);
+                return NULL;
+        }
+
+        return re;
+}
+
+int
+forge_utils_regex_match(const forge_regex *re,
+                        const char        *s)
+{
+        return regexec(&re->regex, s, 0, NULL, 0) == 0;
+}
+
+void
+forge_utils_regex_free(forge_regex *re)
+{
+        if (!re) return;
+        regfree(&re->regex);
+        free(re);
+}
+
+int
+forge_utils_regex_is_literal(const char *pattern)
+{
+        // Everything that is special in a POSIX basic regex.
+        return pattern[strcspn(pattern, ".[]*^$\\")] == '\0';
+}
+
 int
 forge_utils_regex(const char *pattern,
                   const char *s)
 {
-        regex_t regex;
-        int reti;
-
-        reti = regcomp(&regex, pattern, REG_ICASE);
-        if (reti) {
-                perror("regex");
+        forge_regex *re = forge_utils_regex_compile(pattern);
+        if (!re) {
                 return 0;
         }
 
-        reti = regexec(&regex, s, 0, NULL, 0);
-
-        regfree(&regex);
+        int match = forge_utils_regex_match(re, s);
+        forge_utils_regex_free(re);
 
-        if (!reti) return 1;
-        else return 0;
+        return match;
 }
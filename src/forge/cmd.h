@@ -1,6 +1,8 @@
 #ifndef FORGE_CMD_H_INCLUDED
 #define FORGE_CMD_H_INCLUDED
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -31,6 +33,46 @@ int cd(const char *fp);
  */
 int cd_silent(const char *fp);
 
+// Where a stream of a process started by forge_cmd_run() goes.
+typedef enum {
+        FORGE_CMD_INHERIT = 0, // the same place as forge's
+        FORGE_CMD_NULL,        // /dev/null
+        FORGE_CMD_SINK,        // to `sink` in forge_cmd_opts
+        FORGE_CMD_MERGE,       // (stderr only) wherever stdout goes
+} forge_cmd_stream;
+
+// Receives the output of a process. `fd` is 1 for stdout and 2 for stderr.
+typedef void (*forge_cmd_sink)(int fd, const char *buf, size_t n, void *ud);
+
+typedef struct {
+        const char       *cwd;        // directory to run in, NULL for the current one
+        int               shell;      // argv[0] is a command line for /bin/sh -c
+        int               null_stdin; // read stdin from /dev/null
+        forge_cmd_stream  out;
+        forge_cmd_stream  err;
+        forge_cmd_sink    sink;
+        void             *ud;         // passed to `sink`
+} forge_cmd_opts;
+
+typedef struct {
+        int exited;      // 1 if the process exited normally
+        int code;        // the exit code if `exited`
+        int signal;      // the signal that killed the process, or 0
+        int spawn_errno; // set if the process could not be started
+} forge_cmd_status;
+
+/**
+ * Parameter: argv    -> the program and its arguments, NULL terminated
+ * Parameter: opts?   -> how to run it, NULL for the defaults
+ * Parameter: status? -> receives how the process ended
+ * Returns: 1 if the process exited with 0, and 0 if otherwise
+ * Description: Run a program without going through a shell
+ *              (unless `opts->shell` is set). The program is
+ *              looked up in $PATH. Output that goes to a sink is
+ *              handed over as it arrives.
+ */
+int forge_cmd_run(const char *const argv[], const forge_cmd_opts *opts, forge_cmd_status *status);
+
 /**
  * Parameter: cmd -> the command to execute
  * Returns: 1 on success, 0 on failure
@@ -38,9 +80,26 @@ int cd_silent(const char *fp);
  */
 int cmd(const char *cmd);
 
+/**
+ * Parameter: fst... -> the pieces of the command, NULL terminated
+ * Returns: 1 on success, 0 on failure
+ * Description: Join the pieces with spaces and issue the result
+ *              as a BASH command with cmd(). Variables such as
+ *              $DESTDIR and $(nproc) are expanded by the shell.
+ */
 int __cmd_builder(char *fst, ...);
 #define cmd_builder(fst, ...) __cmd_builder((fst), ##__VA_ARGS__, NULL)
 
+/**
+ * Parameter: fst... -> the program and its arguments, NULL terminated
+ * Returns: 1 on success, 0 on failure
+ * Description: Run a program with each argument passed to it as-is.
+ *              No shell is involved, so nothing needs quoting, and
+ *              nothing is expanded either (see forge_cmd_run()).
+ */
+int __cmd_argv(const char *fst, ...);
+#define cmd_argv(fst, ...) __cmd_argv((fst), ##__VA_ARGS__, NULL)
+
 /**
  * Parameter: cmd -> the command to execute
  * Returns: 1 on success, 0 on failure
@@ -118,7 +177,8 @@ int change_file_owner(const char *path, const char *user);
  * Returns: 1 on success, or 0 on failure
  * Description: Performs `make <type>` and utilizes
  * macros in conf.h. If `type` is NULL, it will just
- * call `make`.
+ * call `make`. When forge is running a jobserver (see
+ * MAKEFLAGS), no -j is passed and make uses that instead.
  */
 int make(const char *type);
 
@@ -157,6 +217,16 @@ int is_git_dir(const char *path);
  */
 int is_sudo(void);
 
+/**
+ * Parameter: fp -> the path to remove
+ * Returns: 1 on success, and 0 on failure
+ * Description: Recursively remove `fp` like `rm -rf`, but
+ *              without spawning a process. Symlinks are removed,
+ *              not followed, and a missing `fp` counts as success.
+ *              If `fp` has glob characters, `$`, `~` or backquotes,
+ *              it is passed to `rm -rf` through the shell instead,
+ *              so that it is expanded as it always was.
+ */
 int rmrf(const char *fp);
 
 /**
@@ -21,6 +21,9 @@ extern "C" {
 // How many j flags to pass to make.
 // Feel free to put a number here (as a string!)
 // if you don't want to use nproc for whatever reason.
+// When installing, this is also the size of the jobserver
+// that every make() shares, so it is the total for all
+// packages being built at once, not per package.
 #define FORGE_PREFERRED_MAKEFILE_JFLAGS "$(nproc)"
 
 // Where to install to.
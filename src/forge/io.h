@@ -2,6 +2,7 @@
 #define FORGE_IO_H_INCLUDED
 
 #include <stddef.h>
+#include <sys/stat.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -120,6 +121,59 @@ int forge_io_truncate_file(const char *path);
  */
 const char *forge_io_get_home(void);
 
+/**
+ * Description: Flags for forge_io_walk().
+ *   FORGE_IO_WALK_STAT -> fill in `st` for every entry that is
+ *                         not a directory. Without it, entries are
+ *                         only stat()'d when the filesystem does not
+ *                         report their type.
+ */
+#define FORGE_IO_WALK_STAT (1 << 0)
+
+/**
+ * Description: What the callback of forge_io_walk() returns.
+ *   FORGE_IO_WALK_CONTINUE -> keep going
+ *   FORGE_IO_WALK_SKIP     -> do not descend into this directory
+ *   FORGE_IO_WALK_STOP     -> stop the walk, forge_io_walk() returns 0
+ */
+typedef enum {
+        FORGE_IO_WALK_CONTINUE = 0,
+        FORGE_IO_WALK_SKIP,
+        FORGE_IO_WALK_STOP,
+} forge_io_walk_action;
+
+/**
+ * Description: An entry given to the callback of forge_io_walk().
+ *              `path` and `name` are only valid during the callback.
+ */
+typedef struct {
+        const char  *path;     // the full path (root/.../name)
+        const char  *name;     // the last component of `path`
+        int          depth;    // 0 for entries directly inside of the root
+        int          is_dir;
+        int          has_stat; // 1 if `st` is filled in
+        struct stat  st;       // lstat() information of the entry
+} forge_io_walk_entry;
+
+/**
+ * Parameter: root  -> the directory to walk
+ * Parameter: flags -> FORGE_IO_WALK_* flags
+ * Parameter: fn    -> called for every entry, directories before
+ *                     their contents. "." and ".." are not reported
+ * Parameter: ud    -> user data that is passed to `fn`
+ * Returns: 1 on success, 0 on failure or if `fn` stopped the walk
+ * Description: Recursively walk `root` one directory file descriptor
+ *              at a time, reading each directory exactly once and
+ *              using the entry types that the filesystem provides.
+ *              Symlinks are reported, but never followed.
+ */
+int forge_io_walk(
+        const char *root,
+        int flags,
+        forge_io_walk_action (*fn)(const forge_io_walk_entry *e, void *ud),
+        void *ud
+);
+
 #ifdef __cplusplus
 }
 #endif
@@ -37,6 +37,22 @@ typedef struct {
  */
 int forge_pkg_is_installed(const char *name);
 
+/**
+ * Parameter: names     -> the packages to check
+ * Parameter: n         -> the number of packages in `names`
+ * Parameter: installed -> set to 1 or 0 for each of `names`
+ * Returns: the number of packages in `names` that are installed
+ * Description: Check many packages at once, like calling
+ *              forge_pkg_is_installed() on each of them,
+ *              but all against the same state of the database.
+ *              `names` may be a `char **` (such as the deps of
+ *              a module) as well as a `const char **`; C does
+ *              not convert either one to the other on its own.
+ */
+size_t __forge_pkg_are_installed(const char *const *names, size_t n, int *installed);
+#define forge_pkg_are_installed(names, n, installed) \
+        __forge_pkg_are_installed((const char *const *)(names), (n), (installed))
+
 /**
  * Returns: 1 if it should re-download the package,
  *          or 0 if it shouldn't.
@@ -35,6 +35,41 @@ extern "C" {
  */
 int forge_utils_regex(const char *pattern, const char *s);
 
+// A compiled, case-insensitive regex. See forge_utils_regex_compile().
+typedef struct forge_regex forge_regex;
+
+/**
+ * Parameter: pattern -> the regex pattern
+ * Returns: the compiled regex, or NULL if `pattern` is invalid
+ * Description: Compile `pattern` once so that it can be matched
+ *              against many strings with forge_utils_regex_match().
+ *              Free it with forge_utils_regex_free().
+ */
+forge_regex *forge_utils_regex_compile(const char *pattern);
+
+/**
+ * Parameter: re -> the compiled regex
+ * Parameter: s  -> the string to test
+ * Returns: 1 if match, 0 if no match
+ * Description: Check if `s` matches the compiled regex `re`.
+ */
+int forge_utils_regex_match(const forge_regex *re, const char *s);
+
+/**
+ * Parameter: re -> the compiled regex
+ * Description: Free a regex from forge_utils_regex_compile().
+ *              `re` may be NULL.
+ */
+void forge_utils_regex_free(forge_regex *re);
+
+/**
+ * Parameter: pattern -> the pattern to check
+ * Returns: 1 if `pattern` is plain text, 0 if it uses regex syntax
+ * Description: Whether `pattern` can be matched as a plain
+ *              substring instead of needing a regex.
+ */
+int forge_utils_regex_is_literal(const char *pattern);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,55 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BENCH_H_INCLUDED
+#define BENCH_H_INCLUDED
+
+#include <stddef.h>
+
+// `forge bench`: measure forge itself at scale. A synthetic
+// repository of modules with no-op builds is generated in a
+// scratch directory, and this very forge binary is run against
+// it (list, install, update, ...) in a private mount namespace
+// where the database, module and cache directories are the
+// scratch ones. Nothing on the host is touched.
+
+typedef struct {
+        size_t      pkgs;     // number of packages
+        size_t      fanout;   // dependencies per package
+        size_t      depth;    // layers of the dependency graph
+        size_t      files;    // files installed per package
+        size_t      runs;     // how many times to run every command
+        unsigned    seed;     // for picking the dependencies
+        size_t      jobs;     // passed on as --jobs
+        int         no_cache; // pass on --no-cache
+        int         keep;     // keep the scratch directory
+        const char *out;      // where the JSON goes, "-" for stdout
+} bench_opts;
+
+bench_opts bench_opts_default(void);
+
+// Set the parameter `key` to `value` from `forge bench key=value`.
+// Returns 0 if `key` is not a parameter or `value` is invalid.
+int bench_opts_set(bench_opts *opts, const char *key, const char *value);
+
+// Run the benchmark and write the results. Needs root for the
+// mount namespace. Returns 1 if every command succeeded.
+int bench_run(const bench_opts *opts);
+
+#endif // BENCH_H_INCLUDED
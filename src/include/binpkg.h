@@ -0,0 +1,51 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BINPKG_H_INCLUDED
+#define BINPKG_H_INCLUDED
+
+#include "modindex.h"
+
+// Binary package cache. After a successful install() the
+// fakeroot is archived into BINPKG_CACHE_DIR so that the next
+// install of the exact same build can skip download(), build()
+// and install() altogether. An archive is identified by a key
+// made of the module's source, its version, the versions of
+// its dependencies and forge's conf.h.
+
+// Compute the cache key of `m`. Its source is looked up in
+// the ModuleBuilds table of `db`, and if it is not recorded
+// the .so is used instead. Returns a malloc'd hex string, or
+// NULL if neither could be read.
+char *binpkg_key(sqlite3 *db, const modindex *mi, const module *m);
+
+// Whether there is an archive for `key`.
+int binpkg_has(const char *name, const char *key);
+
+// Unpack the archive for `key` into `fakeroot`. On success
+// `*pkgname` is set to the (malloc'd) source directory name
+// that was recorded when the archive was created and 1 is
+// returned. Returns 0 if there is no usable archive.
+int binpkg_fetch(const char *name, const char *key, const char *fakeroot, char **pkgname);
+
+// Archive `fakeroot` (minus its build directory) under `key`.
+// The archive only becomes visible once it is complete.
+int binpkg_store(const char *name, const char *key, const char *fakeroot, const char *pkgname);
+
+#endif // BINPKG_H_INCLUDED
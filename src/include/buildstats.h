@@ -0,0 +1,80 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef BUILDSTATS_H_INCLUDED
+#define BUILDSTATS_H_INCLUDED
+
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "sqlite3.h"
+
+// Timing of the phases a package goes through when it gets
+// installed. Every run is recorded in the BuildStats table so
+// that later installs can estimate how long they will take and
+// schedule the slowest chains of packages first.
+
+typedef enum {
+        PHASE_DOWNLOAD = 0,
+        PHASE_BUILD,
+        PHASE_INSTALL,
+        PHASE_MERGE,
+        PHASE__COUNT,
+} build_phase;
+
+typedef struct {
+        int     ran;
+        int     ok;
+        int64_t started;   // unix time
+        int64_t wall_ms;
+        int64_t user_ms;   // forge and everything it waited on
+        int64_t sys_ms;
+} phase_stat;
+
+typedef struct {
+        struct timespec t0;
+        time_t          started;
+        struct rusage   self0;
+        struct rusage   children0;
+} phase_timer;
+
+const char *build_phase_name(build_phase phase);
+
+void phase_begin(phase_timer *t);
+
+// Stop `t` and fill in `out`.
+void phase_end(const phase_timer *t, int ok, phase_stat *out);
+
+// Record the phases of one run of `name` that actually ran.
+// `jobs` is how many packages were allowed to build at once,
+// since that skews the wall times. Returns 1 on success.
+int buildstats_record(sqlite3          *db,
+                      const char       *name,
+                      const char       *ver,
+                      size_t            jobs,
+                      const phase_stat  phases[PHASE__COUNT]);
+
+// Estimate how long installing `name` takes in milliseconds,
+// from the average of its last few successful runs. The
+// download is only counted if `with_download` is set. Returns
+// -1 if nothing was recorded for `name` yet.
+int64_t buildstats_estimate_ms(sqlite3 *db, const char *name, int with_download);
+
+#endif // BUILDSTATS_H_INCLUDED
@@ -0,0 +1,58 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef COPY_H_INCLUDED
+#define COPY_H_INCLUDED
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "forge/smap.h"
+
+// Copies files from a fakeroot into a destination root
+// without spawning any processes. All destination paths are
+// relative to `root_fd` (a leading '/' is ignored).
+typedef struct {
+        int        root_fd;
+        dev_t      root_dev;
+        int        allow_move; // rename() files if on the same filesystem
+        forge_smap dirs;       // directories that are known to exist
+} copy_ctx;
+
+// Returns 1 on success, 0 on failure (errno is set).
+int copy_ctx_init(copy_ctx *cc, const char *root, int allow_move);
+void copy_ctx_destroy(copy_ctx *cc);
+
+// Create all parent directories of `dst` (like `install -d`).
+int copy_mkparents(copy_ctx *cc, const char *dst);
+
+// Create directory `dst` with `mode`. It is not an error if it exists.
+int copy_mkdir(copy_ctx *cc, const char *dst, mode_t mode);
+
+// Create (or replace) the symlink `dst` pointing to `target`.
+int copy_symlink(copy_ctx *cc, const char *target, const char *dst);
+
+// Copy (or move) the regular file `src` described by `st`
+// to `dst`, preserving its mode, mtime and holes. `dst` is
+// replaced atomically. Unless `hash` is NULL, it receives the
+// SHA-256 (hex) of the contents, computed from the same read
+// that copies them.
+int copy_regular(copy_ctx *cc, const char *src, const struct stat *st, const char *dst, char *hash);
+
+#endif // COPY_H_INCLUDED
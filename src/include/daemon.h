@@ -0,0 +1,56 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef DAEMON_H_INCLUDED
+#define DAEMON_H_INCLUDED
+
+// `forge daemon` keeps modules, the depgraph and the like loaded
+// and answers read-only commands over a Unix socket, so that
+// they do not pay for starting forge every time. A regular
+// forge hands such commands to the daemon when it is running,
+// together with its stdin, stdout and stderr, and just runs them
+// itself when it is not. Every request is run in a fork of the
+// daemon, so one cannot disturb the next, and as the user that
+// sent it, so the daemon grants nobody more than they have.
+
+typedef struct {
+        // Called before every request, in the daemon itself,
+        // to pick up anything that changed since the last one.
+        void (*refresh)(void *ud);
+
+        // Run the command `argv` (without the program name) in a
+        // forked child that already switched to the user of the
+        // client and to its working directory. Returns the exit
+        // status.
+        int (*run)(int argc, char **argv, void *ud);
+
+        void *ud;
+} daemon_handler;
+
+// Have the daemon run `argv` (without the program name) if it
+// is running. Returns the exit status of the command, or -1 if
+// there is no daemon, in which case nothing was run.
+int daemon_forward(int argc, char **argv);
+
+// Serve requests until SIGINT or SIGTERM. Returns 0 if the
+// daemon could not start.
+int daemon_serve(const daemon_handler *h);
+
+#endif // DAEMON_H_INCLUDED
@@ -21,25 +21,28 @@
 #define DEPGRAPH_H_INCLUDED
 
 #include <stddef.h>
+#include <sys/types.h>
 
 #include "forge/array.h"
+#include "forge/smap.h"
 
 #define DEPGRAPH_DEFAULT_CAPACITY 256
 
-typedef struct depgraph_node {
-        char *name;
-        struct depgraph_node *next;
-} depgraph_node;
-
-// Does not take ownership of `name`.
-depgraph_node *depgraph_node_alloc(const char *name);
-void depgraph_node_free(depgraph_node *n);
-
+// Package names are interned into ids (their insertion index)
+// through `ids`. Edges are collected in `edge_from`/`edge_to`
+// and get frozen into a compressed adjacency layout (CSR), where
+// the dependencies of package `i` are
+// `targets[offsets[i]] .. targets[offsets[i+1]-1]`.
 typedef struct {
-        depgraph_node **tbl; // adjacency list of nodes
-        size_t len;          // number of tbl slots used
-        size_t cap;          // total number of tbl slots used
-        size_t sz;           // number of nodes
+        char         **names;   // id -> name
+        size_t         len;     // number of packages
+        size_t         cap;     // capacity of `names`
+        forge_smap     ids;     // name -> id + 1
+        size_t_array   edge_from;
+        str_array      edge_to; // may name packages that do not exist
+        size_t        *offsets; // len + 1 entries, valid when frozen
+        size_t        *targets;
+        int            frozen;
 } depgraph;
 
 depgraph depgraph_create(void);
@@ -48,9 +51,19 @@ void depgraph_destroy(depgraph *dg);
 // Does not take ownership of `name`.
 void depgraph_insert_pkg(depgraph *dg, const char *name);
 
-// Does not take ownership of `from` and `to`.
+// Does not take ownership of `from` and `to`. `to` does
+// not have to be inserted yet, it is resolved when frozen.
 void depgraph_add_dep(depgraph *dg, const char *from, const char *to);
-size_t_array depgraph_gen_order(const depgraph *dg);
-void depgraph_dump(const depgraph *dg);
+
+// Returns the id of `name`, or -1 if it is not in the graph.
+ssize_t depgraph_find(const depgraph *dg, const char *name);
+
+// Build the adjacency arrays from the edges added so far.
+// Called implicitly by depgraph_gen_order() and depgraph_dump().
+void depgraph_freeze(depgraph *dg);
+
+// Returns the ids of all packages, dependencies first.
+size_t_array depgraph_gen_order(depgraph *dg);
+void depgraph_dump(depgraph *dg);
 
 #endif // DEPGRAPH_H_INCLUDED
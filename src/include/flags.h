@@ -25,6 +25,8 @@
 #define FLAG_1HY_SYNC    "s"
 #define FLAG_1HY_ONLY    "o"
 #define FLAG_1HY_PRETEND "p"
+#define FLAG_1HY_JOBS    "j"
+#define FLAG_1HY_YES     "y"
 
 #define FLAG_2HY_HELP          "help"
 #define FLAG_2HY_REBUILD       "rebuild"
@@ -33,12 +35,20 @@
 #define FLAG_2HY_ONLY          "only"
 #define FLAG_2HY_KEEP_FAKEROOT "keep-fakeroot"
 #define FLAG_2HY_PRETEND       "pretend"
+#define FLAG_2HY_JOBS          "jobs"
+#define FLAG_2HY_NO_CACHE      "no-cache"
+#define FLAG_2HY_YES           "yes"
+#define FLAG_2HY_DESC          "desc"
+#define FLAG_2HY_FORMAT        "format"
+#define FLAG_2HY_FULL          "full"
 
 #define CLI_OPTIONS {                           \
                 "-" FLAG_1HY_HELP,              \
                 "-" FLAG_1HY_REBUILD,           \
                 "-" FLAG_1HY_SYNC,              \
                 "-" FLAG_1HY_PRETEND,           \
+                "-" FLAG_1HY_JOBS,              \
+                "-" FLAG_1HY_YES,               \
                 "--" FLAG_2HY_HELP,             \
                 "--" FLAG_2HY_REBUILD,          \
                 "--" FLAG_2HY_SYNC,             \
@@ -46,6 +56,12 @@
                 "--" FLAG_2HY_ONLY,             \
                 "--" FLAG_2HY_KEEP_FAKEROOT,    \
                 "--" FLAG_2HY_PRETEND,          \
+                "--" FLAG_2HY_JOBS,             \
+                "--" FLAG_2HY_NO_CACHE,         \
+                "--" FLAG_2HY_YES,              \
+                "--" FLAG_2HY_DESC,             \
+                "--" FLAG_2HY_FORMAT,           \
+                "--" FLAG_2HY_FULL,             \
         }
 
 #define CMD_LIST                   "list"
@@ -78,6 +94,11 @@
 #define CMD_EDIT_INSTALL           "edit-install"
 #define CMD_INT                    "int"
 #define CMD_INFO                   "info"
+#define CMD_STATS                  "stats"
+#define CMD_BENCH                  "bench"
+#define CMD_OWNS                   "owns"
+#define CMD_DAEMON                 "daemon"
+#define CMD_VERIFY                 "verify"
 
 #define CLI_CMDS {                              \
                 CMD_LIST,                       \
@@ -110,6 +131,11 @@
                 CMD_EDIT_INSTALL,               \
                 CMD_INT,                        \
                 CMD_INFO,                       \
+                CMD_STATS,                      \
+                CMD_BENCH,                      \
+                CMD_OWNS,                       \
+                CMD_DAEMON,                     \
+                CMD_VERIFY,                     \
         }
 
 #define CMD_COMMANDS "COMMANDS"  // not included in CLI_COMMANDS (hidden)
@@ -122,6 +148,10 @@ typedef enum {
         FT_ONLY          = 1 << 3,
         FT_KEEP_FAKEROOT = 1 << 4,
         FT_PRETEND       = (1 << 5) | FT_KEEP_FAKEROOT,
+        FT_NO_CACHE      = 1 << 6,
+        FT_YES           = 1 << 7,
+        FT_DESC          = 1 << 8,
+        FT_FULL          = 1 << 9,
 } flag_type;
 
 void forge_flags_usage(void);
@@ -0,0 +1,54 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef JOBSERVER_H_INCLUDED
+#define JOBSERVER_H_INCLUDED
+
+#include <stddef.h>
+
+// A GNU make jobserver owned by forge. Every make that forge
+// starts (directly or through a package's build() and install())
+// finds it through MAKEFLAGS and takes its job slots from one
+// shared pool, so the total number of compile jobs stays within
+// one budget no matter how many packages are being built.
+
+// Create the pool with `slots` job slots and export it in
+// MAKEFLAGS. Does nothing if forge is already running under a
+// jobserver (i.e., it was started by make) or if one was already
+// created. Returns 1 if a jobserver is in use afterwards.
+int jobserver_init(size_t slots);
+
+// Whether forge created a jobserver.
+int jobserver_active(void);
+
+// Take one slot out of the pool without blocking. Every make
+// implicitly owns a slot, so a package build running next to
+// another one needs to hold a slot for its make. Returns 1 if
+// a slot was taken, 0 if the pool is empty (or not in use).
+int jobserver_try_acquire(void);
+
+// Give back a slot taken with jobserver_try_acquire().
+void jobserver_release(void);
+
+// The total number of job slots, taken from conf.h if
+// FORGE_PREFERRED_MAKEFILE_JFLAGS is a number, or the number
+// of processors otherwise.
+size_t jobserver_budget(void);
+
+#endif // JOBSERVER_H_INCLUDED
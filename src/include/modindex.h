@@ -0,0 +1,72 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MODINDEX_H_INCLUDED
+#define MODINDEX_H_INCLUDED
+
+#include "forge/array.h"
+#include "forge/pkg.h"
+#include "forge/smap.h"
+
+#include "sqlite3.h"
+
+// A compiled C module. All of the metadata is served from the
+// module index, so the .so only gets dlopen()'d once something
+// actually needs to call into it (see modindex_load_pkg()).
+typedef struct {
+        char      *name;
+        char      *ver;
+        char      *desc;
+        char      *web;       // NULL if the module does not have one
+        str_array  deps;
+        str_array  msgs;
+        str_array  suggested;
+        str_array  rebuild;
+        char      *so_path;
+        long long  mtime;     // nanoseconds
+        long long  size;
+        long long  ino;
+        void      *handle;    // NULL until loaded
+        pkg       *pkg;       // NULL until loaded
+} module;
+
+DYN_ARRAY_TYPE(module *, module_array);
+
+typedef struct {
+        module_array mods;    // in the order they were found on disk
+        forge_smap   by_name; // name -> module *
+} modindex;
+
+// Collect all modules in `dir`. Modules whose .so still matches
+// the index are not loaded. Stale or new modules are dlopen()'d
+// once to refresh their entry, and entries of removed modules
+// are dropped. `db` may be read-only, in which case the index
+// is consulted but not updated.
+modindex modindex_load(sqlite3 *db, const char *dir);
+
+// Does not take ownership of `name`.
+module *modindex_find(const modindex *mi, const char *name);
+
+// dlopen() the module if it is not already loaded.
+// Returns NULL on failure.
+pkg *modindex_load_pkg(module *m);
+
+void modindex_destroy(modindex *mi);
+
+#endif // MODINDEX_H_INCLUDED
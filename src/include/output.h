@@ -0,0 +1,65 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef OUTPUT_H_INCLUDED
+#define OUTPUT_H_INCLUDED
+
+#include <stddef.h>
+
+#include "sqlite3.h"
+
+// Machine-readable output (--format). Rows are written as they
+// come off a query, without being collected first and without
+// colors, so that scripts can consume large listings cheaply.
+//
+//   json: an array of objects keyed by the column names
+//   tsv:  one line per row, tab separated, with \\, \t, \n
+//         and \r escaped
+//   null: every field terminated by a NUL byte, as the number
+//         of fields per row is fixed
+typedef enum {
+        OUTPUT_TABLE = 0, // the usual human-readable output
+        OUTPUT_JSON,
+        OUTPUT_TSV,
+        OUTPUT_NULL,
+} output_format;
+
+typedef struct {
+        output_format fmt;
+        size_t        rows;
+        size_t        fields; // in the current row
+} output;
+
+// Parse the name of a format. Returns 0 if `s` is not one.
+int output_format_parse(const char *s, output_format *fmt);
+
+void output_begin(output *o, output_format fmt);
+void output_end(output *o);
+
+// Write the current row of `stmt`, one field per column, named
+// after the column.
+void output_stmt_row(output *o, sqlite3_stmt *stmt);
+
+// Build a row by hand. `s` may be NULL.
+void output_row_begin(output *o);
+void output_text(output *o, const char *key, const char *s);
+void output_row_end(output *o);
+
+#endif // OUTPUT_H_INCLUDED
@@ -10,6 +10,7 @@
 
 #define MODULE_LIB_DIR         PREFIX "/lib/forge/modules"
 #define PKG_SOURCE_DIR         "/var/cache/forge/sources"
+#define BINPKG_CACHE_DIR       "/var/cache/forge/binpkgs"
 #define FORGE_API_HEADER_DIR   PREFIX "/include/forge"
 #define FORGE_CONF_HEADER_FP   FORGE_API_HEADER_DIR "/conf.h"
 
@@ -0,0 +1,49 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef RMFILES_H_INCLUDED
+#define RMFILES_H_INCLUDED
+
+#include <stddef.h>
+
+#include "forge/array.h"
+
+// Removes the files of a package from the host filesystem,
+// the counterpart of copy.h. Paths are grouped by their parent
+// directory, every directory is opened once and its entries are
+// removed relative to it with unlinkat(), so the kernel does not
+// resolve the full path again for every file.
+
+// Called after each directory with the last path removed from it.
+typedef void (*rmfiles_progress)(const char *path, size_t done, size_t total);
+
+// Remove the absolute `paths`. Paths that are already gone are
+// skipped. Large sets of paths are spread over a few threads.
+// Directories that became empty, and the empty ones in `paths`,
+// are removed bottom-up afterwards, except for the ones in `keep`
+// (relative to `/`, NULL terminated), their parents, and top-level
+// directories. Paths that could not be removed are appended to
+// `failed` (malloc'd). Returns the number of files removed.
+size_t rmfiles(char *const       *paths,
+               size_t             n,
+               const char *const *keep,
+               rmfiles_progress   progress,
+               str_array         *failed);
+
+#endif // RMFILES_H_INCLUDED
@@ -0,0 +1,37 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef SCHEMA_H_INCLUDED
+#define SCHEMA_H_INCLUDED
+
+#include "sqlite3.h"
+
+// The database schema is versioned with `PRAGMA user_version`.
+// Every change to it is a new migration at the end of the
+// list in schema.c, which is applied exactly once to every
+// database, old or new. Never edit a migration that has
+// already shipped; add another one instead.
+
+// Apply all migrations that `db` has not seen yet, each one in
+// its own transaction. Returns 1 on success, 0 on failure in
+// which case the schema is left at the last good version.
+int schema_migrate(sqlite3 *db);
+
+#endif // SCHEMA_H_INCLUDED
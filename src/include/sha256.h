@@ -0,0 +1,52 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SHA256_H_INCLUDED
+#define SHA256_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SZ 32
+#define SHA256_HEX_SZ    (SHA256_DIGEST_SZ * 2 + 1)
+
+typedef struct {
+        uint32_t state[8];
+        uint64_t len;      // total bytes hashed
+        uint8_t  buf[64];
+        size_t   buflen;
+} sha256_ctx;
+
+void sha256_init(sha256_ctx *c);
+void sha256_update(sha256_ctx *c, const void *data, size_t n);
+void sha256_final(sha256_ctx *c, uint8_t out[SHA256_DIGEST_SZ]);
+
+// Finish `c` and write the lowercase hex digest into `out`.
+void sha256_final_hex(sha256_ctx *c, char out[SHA256_HEX_SZ]);
+
+// Hash the contents of the file `fp` into `c`. Returns 1 on
+// success, 0 if the file could not be read.
+int sha256_update_file(sha256_ctx *c, const char *fp);
+
+// Hash the contents of the open file `fd`, from the start
+// regardless of its offset. Returns 1 on success, 0 on a read
+// error (errno is set).
+int sha256_update_fd(sha256_ctx *c, int fd);
+
+#endif // SHA256_H_INCLUDED
@@ -0,0 +1,68 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef VERIFY_H_INCLUDED
+#define VERIFY_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Checks installed files against what was recorded in Files
+// when they were merged. Every file is lstat()ed first, which
+// is cheap; only regular files whose size or mtime no longer
+// match (or all of them, with `full`) are read and hashed.
+// Files are spread over a pool of threads so that hashing a
+// whole system is limited by the disks and not by one core.
+
+typedef enum {
+        VERIFY_OK = 0,
+        VERIFY_MISSING,    // no longer exists
+        VERIFY_TYPE,       // e.g. a symlink replaced by a file
+        VERIFY_MODE,       // permissions changed
+        VERIFY_CONTENT,    // contents differ from the recorded hash
+        VERIFY_UNREADABLE, // could not be read, see `err`
+} verify_status;
+
+typedef struct {
+        // Filled in by the caller, as stored in Files.
+        const char    *path;
+        const char    *type; // "file", "symlink" or "dir"
+        int64_t        size;
+        int            mode;
+        int64_t        mtime;
+        const char    *hash; // NULL if none was recorded
+
+        // Filled in by verify_files().
+        verify_status  status;
+        int            hashed; // whether the contents were read
+        int            err;
+} verify_entry;
+
+// Called every now and then with the number of files done.
+typedef void (*verify_progress)(size_t done, size_t total);
+
+// Check `entries`, setting the status of each. Files without a
+// recorded hash can only be checked by their size. Returns the
+// number of entries that are not VERIFY_OK.
+size_t verify_files(verify_entry *entries, size_t n, int full, verify_progress progress);
+
+const char *verify_status_str(verify_status status);
+
+#endif // VERIFY_H_INCLUDED
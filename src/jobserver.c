@@ -0,0 +1,135 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "forge/conf.h"
+
+#include "jobserver.h"
+
+static struct {
+        int active;
+        int rfd; // blocking read end, inherited by make
+        int wfd; // write end, inherited by make
+        int try_fd; // non-blocking read end, forge only
+} g_js = {
+        .active = 0,
+        .rfd = -1,
+        .wfd = -1,
+        .try_fd = -1,
+};
+
+size_t
+jobserver_budget(void)
+{
+        char *end = NULL;
+        long n = strtol(FORGE_PREFERRED_MAKEFILE_JFLAGS, &end, 10);
+        if (end && *end == '\0' && n > 0) {
+                return (size_t)n;
+        }
+
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+        return n > 0 ? (size_t)n : 1;
+}
+
+int
+jobserver_init(size_t slots)
+{
+        if (g_js.active) {
+                return 1;
+        }
+
+        const char *makeflags = getenv("MAKEFLAGS");
+        if (makeflags && (strstr(makeflags, "--jobserver-auth") || strstr(makeflags, "--jobserver-fds"))) {
+                // Somebody above us already owns the budget.
+                return 0;
+        }
+
+        // A FIFO instead of a pipe so that forge can get its own
+        // non-blocking view of it, while make sees blocking fds.
+        char path[64] = {0};
+        snprintf(path, sizeof(path), "/tmp/forge-jobserver.%ld", (long)getpid());
+        unlink(path);
+        if (mkfifo(path, 0600) == -1) {
+                return 0;
+        }
+
+        g_js.rfd = open(path, O_RDWR);
+        g_js.wfd = g_js.rfd == -1 ? -1 : open(path, O_WRONLY);
+        g_js.try_fd = g_js.rfd == -1 ? -1 : open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        unlink(path);
+
+        if (g_js.rfd == -1 || g_js.wfd == -1 || g_js.try_fd == -1) {
+                if (g_js.rfd != -1) close(g_js.rfd);
+                if (g_js.wfd != -1) close(g_js.wfd);
+                if (g_js.try_fd != -1) close(g_js.try_fd);
+                g_js.rfd = g_js.wfd = g_js.try_fd = -1;
+                return 0;
+        }
+
+        // The first slot is the implicit one of whoever runs first.
+        for (size_t i = 1; i < slots; ++i) {
+                if (write(g_js.wfd, "+", 1) != 1) break;
+        }
+
+        char flags[256] = {0};
+        snprintf(flags, sizeof(flags), "%s%s-j%zu --jobserver-auth=%d,%d",
+                 makeflags ? makeflags : "", makeflags && *makeflags ? " " : "",
+                 slots, g_js.rfd, g_js.wfd);
+        setenv("MAKEFLAGS", flags, 1);
+
+        g_js.active = 1;
+        return 1;
+}
+
+int
+jobserver_active(void)
+{
+        return g_js.active;
+}
+
+int
+jobserver_try_acquire(void)
+{
+        if (!g_js.active) {
+                return 0;
+        }
+
+        char c;
+        ssize_t n;
+        while ((n = read(g_js.try_fd, &c, 1)) == -1 && errno == EINTR);
+
+        return n == 1;
+}
+
+void
+jobserver_release(void)
+{
+        if (!g_js.active) {
+                return;
+        }
+
+        while (write(g_js.wfd, "+", 1) == -1 && errno == EINTR);
+}
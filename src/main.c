@@ -43,6 +43,18 @@
 #include "utils.h"
 #include "paths.h"
 #include "msgs.h"
+#include "modindex.h"
+#include "copy.h"
+#include "binpkg.h"
+#include "sha256.h"
+#include "jobserver.h"
+#include "buildstats.h"
+#include "bench.h"
+#include "rmfiles.h"
+#include "schema.h"
+#include "daemon.h"
+#include "output.h"
+#include "verify.h"
 
 #include "sqlite3.h"
 
@@ -62,6 +74,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <fcntl.h>
+#include <sys/file.h>
 /*#define _GNU_SOURCE*/
 #define __USE_GNU
 #include <sched.h>
@@ -124,32 +137,31 @@
                 }                                               \
         } while (0)
 
-DYN_ARRAY_TYPE(void *, handle_array);
-DYN_ARRAY_TYPE(pkg *, pkg_ptr_array);
+// The parts of a forge_context, which are only set up once
+// a command needs them (see ctx_need()).
+typedef enum {
+        CTX_DB      = 1 << 0, // db, stmts
+        CTX_MODULES = 1 << 1, // mi, dg (and the db)
+} ctx_part;
 
 typedef struct {
-        sqlite3 *db;
-        struct {
-                handle_array handles; // assert(handles.len == paths.len)
-                str_array paths;      // assert(paths.len == handles.len)
-        } dll;
-        depgraph dg;
-        pkg_ptr_array pkgs;
+        sqlite3    *db;
+        modindex    mi;
+        depgraph    dg;
+        forge_smap  stmts; // SQL -> sqlite3_stmt *, see ctx_stmt()
+        int         loaded; // ctx_part
 } forge_context;
 
-typedef struct {
-        char *name;
-        char *version;
-        char *description;
-        int installed;
-} pkg_info;
-
-DYN_ARRAY_TYPE(pkg_info, pkg_info_array);
-
 struct {
         uint32_t flags;
+        size_t jobs; // number of packages to build at once (--jobs), 0 if not given
+        int refresh_cache; // build even if the binary cache has the package
+        output_format format; // of list, search, files, deps and list-deps (--format)
 } g_config = {
         .flags = 0x0000,
+        .jobs = 0,
+        .refresh_cache = 0,
+        .format = OUTPUT_TABLE,
 };
 
 // unistd.h
@@ -159,12 +171,156 @@ char *g_fakeroot = NULL;
 static char **g_saved_argv = NULL;
 static int   g_saved_argc = 0;
 
+// Only one forge that changes the system may run at a time.
+// Whoever holds this lock for writing records its pid in it.
+#define FORGE_LOCK_FP DATABASE_DIR "/forge.lock"
+
+static int g_lock_fd = -1;
+
+// Take the lock and keep it until we exit. Waits for any
+// other forge holding it to finish.
+static void
+lock_forge(void)
+{
+        if (g_lock_fd != -1) {
+                return;
+        }
+
+        int fd = open(FORGE_LOCK_FP, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd == -1) {
+                fprintf(stderr, "could not open %s: %s\n", FORGE_LOCK_FP, strerror(errno));
+                return;
+        }
+
+        if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+                char pid[32] = {0};
+                ssize_t n = pread(fd, pid, sizeof(pid) - 1, 0);
+                pid[n > 0 ? strcspn(pid, "\n") : 0] = '\0';
+                info_builder(0, "Waiting for another forge", *pid ? " (pid " : "",
+                             YELLOW, pid, RESET, *pid ? ")" : "", " to finish\n", NULL);
+
+                while (flock(fd, LOCK_EX) != 0) {
+                        if (errno != EINTR) {
+                                perror("flock");
+                                close(fd);
+                                return;
+                        }
+                }
+        }
+
+        char pid[32] = {0};
+        int n = snprintf(pid, sizeof(pid), "%ld\n", (long)getpid());
+        if (ftruncate(fd, 0) != 0 || pwrite(fd, pid, n, 0) != n) {
+                perror("could not write " FORGE_LOCK_FP);
+        }
+
+        g_lock_fd = fd;
+}
+
+// Every action that needs root changes the system, so this
+// also makes sure it is the only forge doing so.
 void
 assert_sudo(void)
 {
         if (geteuid() != 0) {
                 forge_err(BOLD YELLOW "* " RESET "This action requires " BOLD YELLOW "superuser privileges" RESET);
         }
+        lock_forge();
+}
+
+// Settings for every connection. The database is in WAL mode
+// (see init_db()), so readers never wait on a writer and the
+// other way around. Writers wait on each other for a while
+// instead of failing straight away.
+static void
+db_tune(sqlite3 *db)
+{
+        (void)sqlite3_busy_timeout(db, 60 * 1000);
+        (void)sqlite3_exec(db,
+                           "PRAGMA synchronous = NORMAL;"
+                           "PRAGMA cache_size = -16384;"      // KiB
+                           "PRAGMA mmap_size = 268435456;"
+                           "PRAGMA temp_store = MEMORY;",
+                           NULL, NULL, NULL);
+}
+
+// Open the database for commands that only look at it.
+// These can run while another forge is installing.
+static int
+open_db_readonly(sqlite3 **db)
+{
+        int rc = sqlite3_open_v2(DATABASE_FP, db, SQLITE_OPEN_READONLY, NULL);
+        if (rc == SQLITE_OK) {
+                db_tune(*db);
+        }
+        return rc;
+}
+
+// Savepoints nest, so these can be used whether or not
+// the caller already has a transaction open.
+static void
+db_savepoint(sqlite3    *db,
+             const char *name)
+{
+        char *sql = forge_cstr_builder("SAVEPOINT ", name, ";", NULL);
+        int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        free(sql);
+        CHECK_SQLITE(rc, db);
+}
+
+static void
+db_release(sqlite3    *db,
+           const char *name)
+{
+        char *sql = forge_cstr_builder("RELEASE ", name, ";", NULL);
+        int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        free(sql);
+        CHECK_SQLITE(rc, db);
+}
+
+static void
+db_rollback_to(sqlite3    *db,
+               const char *name)
+{
+        char *sql = forge_cstr_builder("ROLLBACK TO ", name, "; RELEASE ", name, ";", NULL);
+        int rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+        free(sql);
+        CHECK_SQLITE(rc, db);
+}
+
+// Get the prepared statement for `sql`, which is only
+// prepared the first time it is asked for. The statement
+// comes back reset with no bindings. Callers sqlite3_reset()
+// it once done instead of finalizing it, so that it does
+// not keep a read transaction open.
+static sqlite3_stmt *
+ctx_stmt(forge_context *ctx,
+         const char    *sql)
+{
+        sqlite3_stmt *stmt = (sqlite3_stmt *)forge_smap_get(&ctx->stmts, sql);
+
+        if (stmt) {
+                sqlite3_reset(stmt);
+                sqlite3_clear_bindings(stmt);
+                return stmt;
+        }
+
+        int rc = sqlite3_prepare_v3(ctx->db, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+        CHECK_SQLITE(rc, ctx->db);
+        forge_smap_insert(&ctx->stmts, sql, stmt);
+
+        return stmt;
+}
+
+static void
+ctx_stmts_destroy(forge_context *ctx)
+{
+        char **sqls = forge_smap_iter(&ctx->stmts);
+        for (size_t i = 0; sqls[i]; ++i) {
+                sqlite3_finalize((sqlite3_stmt *)forge_smap_get(&ctx->stmts, sqls[i]));
+        }
+        free(sqls);
+        forge_smap_destroy(&ctx->stmts);
 }
 
 void
@@ -172,18 +328,16 @@ clear_package_files_from_db(forge_context *ctx,
                             const char    *name,
                             int            pkg_id)
 {
-        sqlite3_stmt *stmt;
         const char *sql = "DELETE FROM Files WHERE pkg_id = ?;";
-        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, ctx->db);
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
         sqlite3_bind_int(stmt, 1, pkg_id);
-        rc = sqlite3_step(stmt);
+        int rc = sqlite3_step(stmt);
         if (rc != SQLITE_DONE) {
                 fprintf(stderr, "Failed to delete file entries for package %s: %s\n",
                         name, sqlite3_errmsg(ctx->db));
         }
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
 }
 
 sqlite3 *
@@ -196,42 +350,27 @@ init_db(const char *dbname)
         rc = sqlite3_exec(db, "PRAGMA foreign_keys = ON;", NULL, NULL, NULL);
         CHECK_SQLITE(rc, db);
 
-        const char *create_pkgs =
-                "CREATE TABLE IF NOT EXISTS Pkgs ("
-                "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-                "name TEXT NOT NULL UNIQUE,"
-                "version TEXT NOT NULL,"
-                "description TEXT,"
-                "installed INTEGER NOT NULL DEFAULT 0,"
-                "is_explicit INTEGER NOT NULL DEFAULT 0,"
-                "pkg_src_loc TEXT);";
-        rc = sqlite3_exec(db, create_pkgs, NULL, NULL, NULL);
-        CHECK_SQLITE(rc, db);
+        db_tune(db);
 
-        const char *create_deps =
-                "CREATE TABLE IF NOT EXISTS Deps ("
-                "pkg_id INTEGER NOT NULL,"
-                "dep_id INTEGER NOT NULL,"
-                "FOREIGN KEY (pkg_id) REFERENCES Pkgs(id),"
-                "FOREIGN KEY (dep_id) REFERENCES Pkgs(id),"
-                "PRIMARY KEY (pkg_id, dep_id));";
-        rc = sqlite3_exec(db, create_deps, NULL, NULL, NULL);
-        CHECK_SQLITE(rc, db);
+        // Users without write access get a read-only database,
+        // which can be neither switched to WAL nor migrated.
+        if (sqlite3_db_readonly(db, "main") == 1) {
+                return db;
+        }
 
-        const char *create_files =
-                "CREATE TABLE IF NOT EXISTS Files ("
-                "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-                "pkg_id INTEGER NOT NULL,"
-                "path TEXT NOT NULL,"
-                "size INTEGER,"
-                "mode INTEGER," // permissions only: 0755, etc.
-                "mtime INTEGER,"
-                "type TEXT NOT NULL DEFAULT 'file',"
-                "FOREIGN KEY (pkg_id) REFERENCES Pkgs(id) ON DELETE CASCADE,"
-                "UNIQUE(pkg_id, path));";
-
-        rc = sqlite3_exec(db, create_files, NULL, NULL, NULL);
-        CHECK_SQLITE(rc, db);
+        // WAL sticks to the database file, so every later
+        // connection uses it as well. Keep the -wal and -shm
+        // files around when we close so that read-only
+        // connections of regular users can still open it.
+        (void)sqlite3_exec(db, "PRAGMA journal_mode = WAL;", NULL, NULL, NULL);
+        int persist = 1;
+        (void)sqlite3_file_control(db, "main", SQLITE_FCNTL_PERSIST_WAL, &persist);
+
+        if (!schema_migrate(db)) {
+                fprintf(stderr, "could not update the database schema: %s\n", sqlite3_errmsg(db));
+                sqlite3_close(db);
+                exit(1);
+        }
 
         return db;
 }
@@ -239,75 +378,69 @@ init_db(const char *dbname)
 void
 construct_depgraph(forge_context *ctx)
 {
-        for (size_t i = 0; i < ctx->pkgs.len; ++i) {
-                // TODO: assert name
-                depgraph_insert_pkg(&ctx->dg, ctx->pkgs.data[i]->name());
+        for (size_t i = 0; i < ctx->mi.mods.len; ++i) {
+                depgraph_insert_pkg(&ctx->dg, ctx->mi.mods.data[i]->name);
         }
 
-        for (size_t i = 0; i < ctx->pkgs.len; ++i) {
-                if (!ctx->pkgs.data[i]->deps) continue;
-
-                char *name = ctx->pkgs.data[i]->name();
-                char **deps = ctx->pkgs.data[i]->deps();
-                for (size_t j = 0; deps[j]; ++j) {
-                        depgraph_add_dep(&ctx->dg, name, deps[j]);
+        for (size_t i = 0; i < ctx->mi.mods.len; ++i) {
+                const module *m = ctx->mi.mods.data[i];
+                for (size_t j = 0; j < m->deps.len; ++j) {
+                        depgraph_add_dep(&ctx->dg, m->name, m->deps.data[j]);
                 }
         }
 }
 
-void
-obtain_handles_and_pkgs_from_dll(forge_context *ctx)
+// Set up the `parts` of `ctx` that are not yet. Commands ask
+// for what they use, so that e.g. shell completion does not
+// have to open the database or load every module first.
+static void
+ctx_need(forge_context *ctx,
+         int            parts)
 {
-        DIR *dir = opendir(MODULE_LIB_DIR);
-        if (!dir) {
-                perror("Failed to open package directory");
-                return;
+        if (parts & CTX_MODULES) {
+                parts |= CTX_DB;
         }
 
-        struct dirent *entry;
-        while ((entry = readdir(dir))) {
-                if (strstr(entry->d_name, ".so")) {
-                        char *path = (char *)malloc(512);
-                        snprintf(path, 512, "%s/%s", MODULE_LIB_DIR, entry->d_name);
-
-                        void *handle = dlopen(path, RTLD_LAZY);
-                        if (!handle) {
-                                fprintf(stderr, "Error loading dll path: `%s`, %s\n", path, dlerror());
-                                return;
-                        }
-
-                        dlerror();
-                        pkg *pkg = dlsym(handle, "package");
-                        char *error = dlerror();
-                        if (error != NULL) {
-                                fprintf(stderr, "Error finding 'package' symbol in %s: %s\n", path, error);
-                                dlclose(handle);
-                                return;
-                        }
+        if ((parts & CTX_DB) && !(ctx->loaded & CTX_DB)) {
+                ctx->db = init_db(DATABASE_FP);
+                ctx->stmts = forge_smap_create();
+                ctx->loaded |= CTX_DB;
+        }
 
-                        dyn_array_append(ctx->dll.handles, handle);
-                        dyn_array_append(ctx->dll.paths, path);
-                        dyn_array_append(ctx->pkgs, pkg);
-                }
+        if ((parts & CTX_MODULES) && !(ctx->loaded & CTX_MODULES)) {
+                // Load package metadata, only dlopen()-ing modules that changed
+                ctx->mi = modindex_load(ctx->db, MODULE_LIB_DIR);
+                ctx->dg = depgraph_create();
+                construct_depgraph(ctx);
+                ctx->loaded |= CTX_MODULES;
         }
+}
 
-        closedir(dir);
+// Close the database of `ctx`, keeping whatever was
+// loaded from it.
+static void
+ctx_close_db(forge_context *ctx)
+{
+        if (ctx->loaded & CTX_DB) {
+                ctx_stmts_destroy(ctx);
+                sqlite3_close(ctx->db);
+                ctx->db = NULL;
+                ctx->loaded &= ~CTX_DB;
+        }
 }
 
 void
 cleanup_forge_context(forge_context *ctx)
 {
-        sqlite3_close(ctx->db);
-        for (size_t i = 0; i < ctx->dll.handles.len; ++i) {
-                if (ctx->dll.handles.data[i]) {
-                        dlclose(ctx->dll.handles.data[i]);
-                        free(ctx->dll.paths.data[i]);
-                }
+        if (ctx->loaded & CTX_MODULES) {
+                modindex_destroy(&ctx->mi);
+                depgraph_destroy(&ctx->dg);
         }
-        dyn_array_free(ctx->dll.handles);
-        dyn_array_free(ctx->dll.paths);
-        dyn_array_free(ctx->pkgs);
-        depgraph_destroy(&ctx->dg);
+        if (ctx->loaded & CTX_DB) {
+                ctx_stmts_destroy(ctx);
+                sqlite3_close(ctx->db);
+        }
+        ctx->loaded = 0;
 }
 
 static int
@@ -340,6 +473,11 @@ init_env(void)
                 fprintf(stderr, "could not create path: %s, %s\n", PKG_SOURCE_DIR, strerror(errno));
         }
 
+        // Binary package cache
+        if (mkdir_p_wmode(BINPKG_CACHE_DIR, 0755) != 0) {
+                fprintf(stderr, "could not create path: %s, %s\n", BINPKG_CACHE_DIR, strerror(errno));
+        }
+
         return 1;
 }
 
@@ -363,6 +501,16 @@ show_options_for_bash_completion(void)
         }
 }
 
+// The directories every fakeroot starts out with. Uninstalling
+// never removes these, even when they are left empty.
+static const char *const skeleton_dirs[] = {
+        "bin", "etc", "lib", "opt", "home",
+        "usr", "usr/bin", "usr/lib", "usr/include", "usr/lib64", "usr/share", "usr/libexec",
+        "usr/local", "usr/local/share", "usr/local/src", "usr/local/include", "usr/local/bin",
+        "usr/local/lib", "usr/local/lib64", "usr/local/sbin", "usr/local/opt",
+        "var", "dev", "proc", "sys", "run", "tmp", "sbin", "lib64", "buildsrc", NULL,
+};
+
 void
 create_skeleton(const char *root)
 {
@@ -370,13 +518,7 @@ create_skeleton(const char *root)
 
         info(0, "Creating fakeroot skeleton\n");
 
-        const char *paths[] = {
-                "bin", "etc", "lib", "opt", "home",
-                "usr", "usr/bin", "usr/lib", "usr/include", "usr/lib64", "usr/share", "usr/libexec",
-                "usr/local", "usr/local/share", "usr/local/src", "usr/local/include", "usr/local/bin",
-                "usr/local/lib", "usr/local/lib64", "usr/local/sbin", "usr/local/opt",
-                "var", "dev", "proc", "sys", "run", "tmp", "sbin", "lib64", "buildsrc", NULL,
-        };
+        const char *const *paths = skeleton_dirs;
 
         for (size_t i = 0; paths[i]; ++i) {
                 char path[PATH_MAX] = {0};
@@ -419,112 +561,426 @@ sync(void)
         free(files);
 }
 
+// How C modules are compiled. The compiler command is part of
+// a module's build hash, so changing it recompiles everything.
+static const char *module_cc[] = {
+        "gcc", "-Wextra", "-Wall", "-Werror", "-shared", "-fPIC",
+};
+static const char *module_ld[] = {
+        "-lforge", "-L/usr/local/lib",
+};
+
+// A C module that rebuild_pkgs() is looking at.
+typedef struct {
+        size_t  dir;                 // index into the module directories
+        char   *name;                // file name without ".c"
+        char   *src;                 // absolute path to the .c file
+        char    hash[SHA256_HEX_SZ]; // source + API headers + compiler
+        pid_t   pid;
+        char   *log;                 // compiler output
+        char   *out;                 // what the compiler writes, renamed to the .so
+        int     ok;
+} module_job;
+
+DYN_ARRAY_TYPE(module_job, module_job_array);
+
+static int
+cstr_cmp(const void *a, const void *b)
+{
+        return strcmp(*(const char **)a, *(const char **)b);
+}
+
+// Hash every regular file in `dir` in name order.
+static void
+hash_dir_files(sha256_ctx *c,
+               const char *dir)
+{
+        DIR *d = opendir(dir);
+        if (!d) return;
+
+        str_array names = dyn_array_empty(str_array);
+        struct dirent *entry;
+        while ((entry = readdir(d))) {
+                if (entry->d_name[0] != '.') {
+                        dyn_array_append(names, strdup(entry->d_name));
+                }
+        }
+        closedir(d);
+
+        qsort(names.data, names.len, sizeof(*names.data), cstr_cmp);
+
+        for (size_t i = 0; i < names.len; ++i) {
+                char *fp = forge_cstr_builder(dir, "/", names.data[i], NULL);
+                struct stat st;
+                if (stat(fp, &st) == 0 && S_ISREG(st.st_mode)) {
+                        sha256_update(c, names.data[i], strlen(names.data[i]) + 1);
+                        (void)sha256_update_file(c, fp);
+                }
+                free(fp);
+                free(names.data[i]);
+        }
+        dyn_array_free(names);
+}
+
+// Compile `j` in a child process. The compiler's output goes to `j->log`.
+// The module is written to `j->out`, a file of its own, since modules
+// of the same name from different repositories may be compiled at the
+// same time. finish_module_build() moves it to its .so.
+static int
+spawn_module_build(module_job *j,
+                   const char *dir)
+{
+        char tmpl[] = "/tmp/forge-cc-XXXXXX.log";
+        int logfd = mkstemps(tmpl, 4);
+        if (logfd == -1) {
+                perror("mkstemps");
+                return 0;
+        }
+        j->log = strdup(tmpl);
+
+        // Not named *.so, so that it is never taken for a module.
+        char *out = forge_cstr_builder(MODULE_LIB_DIR "/", j->name, ".so.XXXXXX", NULL);
+        int outfd = mkstemp(out);
+        if (outfd == -1) {
+                perror("mkstemp");
+                close(logfd);
+                free(out);
+                return 0;
+        }
+        // mkstemp() makes it private, modules are loaded by every user.
+        (void)fchmod(outfd, 0644);
+        close(outfd);
+        j->out = out;
+
+        char *src = forge_cstr_builder(j->name, ".c", NULL);
+
+        const char *argv[32] = {0};
+        size_t n = 0;
+        for (size_t i = 0; i < sizeof(module_cc)/sizeof(*module_cc); ++i) argv[n++] = module_cc[i];
+        argv[n++] = src;
+        for (size_t i = 0; i < sizeof(module_ld)/sizeof(*module_ld); ++i) argv[n++] = module_ld[i];
+        argv[n++] = "-o";
+        argv[n++] = out;
+        argv[n++] = "-I../include";
+        argv[n] = NULL;
+
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == 0) {
+                dup2(logfd, STDOUT_FILENO);
+                dup2(logfd, STDERR_FILENO);
+                close(logfd);
+                if (chdir(dir) == -1) {
+                        perror("chdir");
+                        _exit(127);
+                }
+                execvp(argv[0], (char *const *)argv);
+                perror("execvp");
+                _exit(127);
+        }
+
+        close(logfd);
+        free(src);
+
+        if (pid == -1) {
+                perror("fork");
+                return 0;
+        }
+
+        j->pid = pid;
+        return 1;
+}
+
+// Move the module that `j` compiled to its .so, or throw it
+// away if the build failed. This happens in the order the
+// builds finish, which is the order they are recorded in.
+static void
+finish_module_build(module_job *j)
+{
+        if (!j->out) {
+                return;
+        }
+
+        if (j->ok) {
+                char *so = forge_cstr_builder(MODULE_LIB_DIR "/", j->name, ".so", NULL);
+                if (rename(j->out, so) != 0) {
+                        fprintf(stderr, "could not move %s to %s: %s\n", j->out, so, strerror(errno));
+                        j->ok = 0;
+                }
+                free(so);
+        }
+        if (!j->ok) {
+                unlink(j->out);
+        }
+
+        free(j->out);
+        j->out = NULL;
+}
+
+static void
+report_module_failure(const module_job *j)
+{
+        char *log = forge_io_read_file_to_cstr(j->log);
+        fflush(stdout);
+        if (log) {
+                fprintf(stderr, "%s", log);
+                free(log);
+        }
+        fprintf(stderr, INVERT BOLD RED "In module %s:\n" RESET, j->name);
+        fprintf(stderr, INVERT BOLD RED "  located in: %s\n" RESET, j->src);
+        fprintf(stderr, INVERT BOLD RED "  use:\n" RESET);
+        fprintf(stderr, INVERT BOLD RED "    forge -r edit %s\n" RESET, j->name);
+        fprintf(stderr, INVERT BOLD RED "  to fix your errors!\n" RESET);
+        fprintf(stderr, BOLD YELLOW "  skipping %s module compilation...\n" RESET, j->name);
+}
+
+// Compile all C modules in the subdirectories of C_MODULE_DIR_PARENT.
+// A module is only compiled if its build hash (source, forge API
+// headers, compiler command) differs from the last successful build
+// recorded in `db`, or if its .so is gone. Up to --jobs modules (or
+// the number of processors if --jobs is not given) are compiled
+// at the same time.
 void
-rebuild_pkgs(void)
+rebuild_pkgs(sqlite3 *db)
 {
         assert_sudo();
 
         info(1, "Rebuilding package modules\n");
 
-        char **dirs = ls(C_MODULE_DIR_PARENT);
-        for (size_t d = 0; dirs[d]; ++d) {
-                if (!strcmp(dirs[d], ".") || !strcmp(dirs[d], "..")) {
-                        free(dirs[d]);
+        // Everything except the module source itself.
+        sha256_ctx base;
+        sha256_init(&base);
+        for (size_t i = 0; i < sizeof(module_cc)/sizeof(*module_cc); ++i) {
+                sha256_update(&base, module_cc[i], strlen(module_cc[i]) + 1);
+        }
+        for (size_t i = 0; i < sizeof(module_ld)/sizeof(*module_ld); ++i) {
+                sha256_update(&base, module_ld[i], strlen(module_ld[i]) + 1);
+        }
+        hash_dir_files(&base, FORGE_API_HEADER_DIR);
+        hash_dir_files(&base, C_MODULE_DIR_PARENT "/include");
+
+        sqlite3_stmt *sel;
+        const char *sql_select = "SELECT hash FROM ModuleBuilds WHERE src = ?;";
+        int rc = sqlite3_prepare_v2(db, sql_select, -1, &sel, NULL);
+        CHECK_SQLITE(rc, db);
+
+        str_array dirs = dyn_array_empty(str_array);
+        module_job_array jobs = dyn_array_empty(module_job_array);
+        size_t_array unchanged = dyn_array_empty(size_t_array); // per directory
+
+        char **entries = ls(C_MODULE_DIR_PARENT);
+        for (size_t d = 0; entries[d]; ++d) {
+                if (!strcmp(entries[d], ".") || !strcmp(entries[d], "..")) {
+                        free(entries[d]);
                         continue;
                 }
-                char *abspath = forge_cstr_builder(C_MODULE_DIR_PARENT, "/", dirs[d], NULL);
+                char *abspath = forge_cstr_builder(C_MODULE_DIR_PARENT, "/", entries[d], NULL);
+                free(entries[d]);
+
                 DIR *dir = opendir(abspath);
                 if (!dir) {
-                        perror("opendir");
-                        return;
+                        free(abspath);
+                        continue;
                 }
 
-                str_array files = dyn_array_empty(str_array);
+                dyn_array_append(dirs, abspath);
+                dyn_array_append(unchanged, 0);
+
                 struct dirent *entry;
                 while ((entry = readdir(dir))) {
-                        // Check if the file name ends with ".c"
-                        if (entry->d_type == DT_REG && strstr(entry->d_name, ".c") != NULL) {
-                                size_t len = strlen(entry->d_name);
-                                if (len >= 2 && strcmp(entry->d_name + len - 2, ".c") == 0) {
-                                        char *filename = strdup(entry->d_name);
-                                        filename[len - 2] = '\0'; // Remove ".c"
-                                        dyn_array_append(files, filename);
-                                }
+                        size_t len = strlen(entry->d_name);
+                        if (entry->d_type != DT_REG || len < 2 || strcmp(entry->d_name + len - 2, ".c")) {
+                                continue;
                         }
-                }
 
-                if (!cd_silent(abspath)) {
-                        fprintf(stderr, "aborting...\n");
-                        goto cleanup;
-                }
+                        module_job j = (module_job) {
+                                .dir = dirs.len - 1,
+                                .name = strndup(entry->d_name, len - 2),
+                                .src = forge_cstr_builder(abspath, "/", entry->d_name, NULL),
+                                .pid = -1,
+                                .log = NULL,
+                                .out = NULL,
+                                .ok = 0,
+                        };
+
+                        sha256_ctx c = base;
+                        if (!sha256_update_file(&c, j.src)) {
+                                free(j.name);
+                                free(j.src);
+                                continue;
+                        }
+                        sha256_final_hex(&c, j.hash);
+
+                        char *so = forge_cstr_builder(MODULE_LIB_DIR "/", j.name, ".so", NULL);
+                        int up_to_date = 0;
+                        sqlite3_bind_text(sel, 1, j.src, -1, SQLITE_STATIC);
+                        if (sqlite3_step(sel) == SQLITE_ROW) {
+                                const char *hash = (const char *)sqlite3_column_text(sel, 0);
+                                up_to_date = hash && !strcmp(hash, j.hash) && access(so, F_OK) == 0;
+                        }
+                        sqlite3_reset(sel);
+                        free(so);
 
-                str_array passed = dyn_array_empty(str_array),
-                        failed = dyn_array_empty(str_array);
-                for (size_t i = 0; i < files.len; ++i) {
-                        size_t loading = (size_t)(((float)i/(float)files.len)*10.f);
-                        putchar('[');
-                        for (size_t i = 0; i < 10; ++i) {
-                                if (i > loading) {
-                                        putchar(' ');
-                                } else {
-                                        putchar('*');
-                                }
+                        if (up_to_date) {
+                                ++unchanged.data[j.dir];
+                                free(j.name);
+                                free(j.src);
+                                continue;
                         }
-                        printf("] ");
 
-                        char buf[256] = {0};
-                        sprintf(buf, "gcc -Wextra -Wall -Werror -shared -fPIC %s.c -lforge -L/usr/local/lib -o" MODULE_LIB_DIR "/%s.so -I../include",
-                                files.data[i], files.data[i]);
-                        printf("%s.c\n", files.data[i]);
-                        fflush(stdout);
-                        int status = system(buf);
-                        if (status == -1) {
-                                perror("system");
-                                dyn_array_append(failed, files.data[i]);
+                        dyn_array_append(jobs, j);
+                }
+                closedir(dir);
+        }
+        free(entries);
+        sqlite3_finalize(sel);
+
+        size_t njobs = g_config.jobs;
+        if (njobs == 0) {
+                long n = sysconf(_SC_NPROCESSORS_ONLN);
+                njobs = n > 0 ? (size_t)n : 1;
+        }
+        size_t next = 0, running = 0, done = 0;
+        size_t_array finished = dyn_array_empty(size_t_array); // job indices, in order
+
+        while (next < jobs.len || running > 0) {
+                while (running < njobs && next < jobs.len) {
+                        module_job *j = &jobs.data[next++];
+                        if (spawn_module_build(j, dirs.data[j->dir])) {
+                                ++running;
                         } else {
-                                if (WIFEXITED(status)) {
-                                        printf("\033[1A");
-                                        printf("\033[2K");
-                                        int exit_status = WEXITSTATUS(status);
-                                        if (exit_status != 0) {
-                                                fflush(stdout);
-                                                fprintf(stderr, INVERT BOLD RED "In module %s:\n" RESET, files.data[i]);
-                                                fprintf(stderr, INVERT BOLD RED "  located in: " MODULE_LIB_DIR "%s.c\n" RESET, files.data[i]);
-                                                fprintf(stderr, INVERT BOLD RED "  use:\n" RESET);
-                                                fprintf(stderr, INVERT BOLD RED "    forge -r edit %s\n" RESET, files.data[i]);
-                                                fprintf(stderr, INVERT BOLD RED "  to fix your errors!\n" RESET);
-                                                fprintf(stderr, BOLD YELLOW "  skipping %s module compilation...\n" RESET, files.data[i]);
-                                                dyn_array_append(failed, files.data[i]);
-                                        } else {
-                                                dyn_array_append(passed, files.data[i]);
-                                        }
-                                } else {
-                                        fprintf(stdout, INVERT BOLD RED "program did not exit normally\n" RESET);
-                                        dyn_array_append(failed, files.data[i]);
-                                }
+                                ++done;
+                                finish_module_build(j);
+                                dyn_array_append(finished, (size_t)(j - jobs.data));
+                                report_module_failure(j);
                         }
                 }
+                if (running == 0) break;
 
-                const char *basename = forge_io_basename(abspath);
-                if (failed.len > 0) {
-                        printf(YELLOW "%s:" RESET " [ " BOLD GREEN "%zu Compiled" RESET ", " BOLD RED "%zu Failed" RESET " ]\n",
-                               basename, passed.len, failed.len);
-                } else {
-                        printf(YELLOW "%s:" RESET " [ " BOLD GREEN "%zu Compiled" RESET " ]\n",
-                               basename, passed.len);
+                int status = 0;
+                pid_t pid = waitpid(-1, &status, 0);
+                if (pid == -1) {
+                        if (errno == EINTR) continue;
+                        perror("waitpid");
+                        break;
                 }
 
-        cleanup:
-                dyn_array_free(passed);
-                dyn_array_free(failed);
-                for (size_t i = 0; i < files.len; ++i) {
-                        free(files.data[i]);
+                module_job *j = NULL;
+                for (size_t i = 0; i < jobs.len; ++i) {
+                        if (jobs.data[i].pid == pid) {
+                                j = &jobs.data[i];
+                                break;
+                        }
                 }
-                dyn_array_free(files);
-                closedir(dir);
-                free(dirs[d]);
-                free(abspath);
+                if (!j) continue;
+
+                --running;
+                ++done;
+                j->pid = -1;
+                j->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                finish_module_build(j);
+                dyn_array_append(finished, (size_t)(j - jobs.data));
+
+                if (!j->ok) {
+                        printf("\r\033[2K");
+                        report_module_failure(j);
+                }
+
+                size_t loading = (size_t)(((float)done/(float)jobs.len)*10.f);
+                printf("\r\033[2K[");
+                for (size_t i = 0; i < 10; ++i) {
+                        putchar(i < loading ? '*' : ' ');
+                }
+                printf("] %s.c", j->name);
+                fflush(stdout);
+        }
+        if (jobs.len > 0) {
+                printf("\r\033[2K");
+        }
+
+        // Remember what was built, and forget what failed so it is retried.
+        // Builds are recorded in the order their .so was moved into place,
+        // so that when two repositories have a module of the same name the
+        // newest row is the one whose .so is on disk (see binpkg_key()).
+        db_savepoint(db, "rebuild_pkgs");
+
+        sqlite3_stmt *ins, *del;
+        rc = sqlite3_prepare_v2(db, "INSERT OR REPLACE INTO ModuleBuilds (src, hash, so) VALUES (?, ?, ?);", -1, &ins, NULL);
+        CHECK_SQLITE(rc, db);
+        rc = sqlite3_prepare_v2(db, "DELETE FROM ModuleBuilds WHERE src = ?;", -1, &del, NULL);
+        CHECK_SQLITE(rc, db);
+
+        for (size_t i = 0; i < jobs.len; ++i) {
+                const module_job *j = &jobs.data[i];
+                if (j->ok) continue;
+                sqlite3_bind_text(del, 1, j->src, -1, SQLITE_STATIC);
+                if (sqlite3_step(del) != SQLITE_DONE) {
+                        fprintf(stderr, "could not record build of %s: %s\n", j->name, sqlite3_errmsg(db));
+                }
+                sqlite3_reset(del);
+        }
+
+        for (size_t i = 0; i < finished.len; ++i) {
+                const module_job *j = &jobs.data[finished.data[i]];
+                if (!j->ok) continue;
+                char *so = forge_cstr_builder(MODULE_LIB_DIR "/", j->name, ".so", NULL);
+                sqlite3_bind_text(ins, 1, j->src, -1, SQLITE_STATIC);
+                sqlite3_bind_text(ins, 2, j->hash, -1, SQLITE_STATIC);
+                sqlite3_bind_text(ins, 3, so, -1, SQLITE_TRANSIENT);
+                if (sqlite3_step(ins) != SQLITE_DONE) {
+                        fprintf(stderr, "could not record build of %s: %s\n", j->name, sqlite3_errmsg(db));
+                }
+                sqlite3_reset(ins);
+                free(so);
+        }
+
+        sqlite3_finalize(ins);
+        sqlite3_finalize(del);
+        db_release(db, "rebuild_pkgs");
+        dyn_array_free(finished);
+
+        for (size_t d = 0; d < dirs.len; ++d) {
+                size_t passed = 0, failed = 0;
+                for (size_t i = 0; i < jobs.len; ++i) {
+                        if (jobs.data[i].dir != d) continue;
+                        if (jobs.data[i].ok) ++passed;
+                        else                 ++failed;
+                }
+                if (passed + failed + unchanged.data[d] == 0) {
+                        continue;
+                }
+
+                const char *basename = forge_io_basename(dirs.data[d]);
+                printf(YELLOW "%s:" RESET " [ " BOLD GREEN "%zu Compiled" RESET, basename, passed);
+                if (unchanged.data[d] > 0) {
+                        printf(", %zu Unchanged", unchanged.data[d]);
+                }
+                if (failed > 0) {
+                        printf(", " BOLD RED "%zu Failed" RESET, failed);
+                }
+                printf(" ]\n");
+        }
+
+        for (size_t i = 0; i < jobs.len; ++i) {
+                if (jobs.data[i].log) {
+                        unlink(jobs.data[i].log);
+                        free(jobs.data[i].log);
+                }
+                if (jobs.data[i].out) { // never finished
+                        unlink(jobs.data[i].out);
+                        free(jobs.data[i].out);
+                }
+                free(jobs.data[i].name);
+                free(jobs.data[i].src);
         }
+        dyn_array_free(jobs);
+        for (size_t d = 0; d < dirs.len; ++d) {
+                free(dirs.data[d]);
+        }
+        dyn_array_free(dirs);
+        dyn_array_free(unchanged);
 }
 
 void
@@ -532,29 +988,25 @@ add_dep_to_db(forge_context *ctx,
               int            pkg_id,
               int            dep_id)
 {
-        sqlite3_stmt *stmt;
         const char *sql = "INSERT OR IGNORE INTO Deps (pkg_id, dep_id) VALUES (?, ?);";
-        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, ctx->db);
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
         sqlite3_bind_int(stmt, 1, pkg_id);
         sqlite3_bind_int(stmt, 2, dep_id);
 
-        rc = sqlite3_step(stmt);
+        int rc = sqlite3_step(stmt);
         if (rc != SQLITE_DONE) {
                 fprintf(stderr, "Dependency insert error: %s\n", sqlite3_errmsg(ctx->db));
         }
 
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
 }
 
 int
 get_pkg_id(forge_context *ctx, const char *name)
 {
-        sqlite3_stmt *stmt;
         const char *sql = "SELECT id FROM Pkgs WHERE name = ?;";
-        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, ctx->db);
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
         sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
 
@@ -563,44 +1015,25 @@ get_pkg_id(forge_context *ctx, const char *name)
                 id = sqlite3_column_int(stmt, 0);
         }
 
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
         return id;
 }
 
 void
-register_pkg(forge_context *ctx, pkg *pkg, int is_explicit)
+register_pkg(forge_context *ctx, const module *m, int is_explicit)
 {
-        if (!pkg->name) {
-                forge_err("register_pkg(): pkg (unknown) does not have a name");
-        }
-        if (!pkg->ver) {
-                forge_err_wargs("register_pkg(): pkg %s does not have a version", pkg->name());
-        }
-        if (!pkg->desc) {
-                forge_err_wargs("register_pkg(): pkg %s does not have a description", pkg->name());
-        }
-
-        const char *name = pkg->name();
-        const char *ver = pkg->ver();
-        const char *desc = pkg->desc();
+        const char *name = m->name;
+        const char *ver = m->ver;
+        const char *desc = m->desc;
 
+        int id = get_pkg_id(ctx, name);
         sqlite3_stmt *stmt;
-        const char *sql_select = "SELECT id FROM Pkgs WHERE name = ?;";
-        int rc = sqlite3_prepare_v2(ctx->db, sql_select, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, ctx->db);
-
-        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-        int id = -1;
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-                id = sqlite3_column_int(stmt, 0);
-        }
-        sqlite3_finalize(stmt);
+        int rc;
 
         if (id != -1) {
                 // Update existing package
                 const char *sql_update = "UPDATE Pkgs SET version = ?, description = ?, is_explicit = ? WHERE name = ?;";
-                rc = sqlite3_prepare_v2(ctx->db, sql_update, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, ctx->db);
+                stmt = ctx_stmt(ctx, sql_update);
 
                 sqlite3_bind_text(stmt, 1, ver, -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, desc, -1, SQLITE_STATIC);
@@ -611,15 +1044,14 @@ register_pkg(forge_context *ctx, pkg *pkg, int is_explicit)
                 if (rc != SQLITE_DONE) {
                         fprintf(stderr, "Update error: %s\n", sqlite3_errmsg(ctx->db));
                 }
-                sqlite3_finalize(stmt);
+                sqlite3_reset(stmt);
         } else {
                 // New package
                 //info_builder(1, "Registered package: ", YELLOW, name, RESET, "\n", NULL);
                 printf(YELLOW "*" RESET " Registered package: " YELLOW "%s" RESET "\n", name);
 
                 const char *sql_insert = "INSERT INTO Pkgs (name, version, description, installed, is_explicit) VALUES (?, ?, ?, 0, ?);";
-                rc = sqlite3_prepare_v2(ctx->db, sql_insert, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, ctx->db);
+                stmt = ctx_stmt(ctx, sql_insert);
 
                 sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
                 sqlite3_bind_text(stmt, 2, ver, -1, SQLITE_STATIC);
@@ -630,13 +1062,10 @@ register_pkg(forge_context *ctx, pkg *pkg, int is_explicit)
                 if (rc != SQLITE_DONE) {
                         fprintf(stderr, "Insert error: %s\n", sqlite3_errmsg(ctx->db));
                 }
-                sqlite3_finalize(stmt);
+                sqlite3_reset(stmt);
 
-                if (pkg->deps) {
-                        char **deps = pkg->deps();
-                        for (size_t i = 0; deps[i]; ++i) {
-                                add_dep_to_db(ctx, get_pkg_id(ctx, name), get_pkg_id(ctx, deps[i]));
-                        }
+                for (size_t i = 0; i < m->deps.len; ++i) {
+                        add_dep_to_db(ctx, get_pkg_id(ctx, name), get_pkg_id(ctx, m->deps.data[i]));
                 }
         }
 }
@@ -778,6 +1207,8 @@ restore_pkg(str_array names)
 static void
 drop_pkg(forge_context *ctx, str_array names)
 {
+        assert_sudo();
+
         for (size_t i = 0; i < names.len; ++i) {
                 const char *name = names.data[i];
 
@@ -857,10 +1288,8 @@ drop_pkg(forge_context *ctx, str_array names)
 static int
 pkg_is_installed(forge_context *ctx, const char *name)
 {
-        sqlite3_stmt *stmt;
         const char *sql = "SELECT installed FROM Pkgs WHERE name = ?;";
-        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, ctx->db);
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
         sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
 
@@ -869,11 +1298,11 @@ pkg_is_installed(forge_context *ctx, const char *name)
                 installed = sqlite3_column_int(stmt, 0);
         } else {
                 // Package not found in database
-                sqlite3_finalize(stmt);
+                sqlite3_reset(stmt);
                 return -1;
         }
 
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
         return installed;
 }
 
@@ -901,59 +1330,71 @@ destroy_fakeroot(void)
         g_fakeroot = NULL;
 }
 
-static void
-build_manifest(str_array *ar, const char *path)
-{
-        assert(g_fakeroot);
-
-        char **basefiles = ls(path);
-
-        for (size_t i = 0; basefiles[i]; ++i) {
-                char abspath[PATH_MAX] = {0};
-                const char *file = basefiles[i];
+// A file in the fakeroot along with its lstat() information.
+typedef struct {
+        char        *path;
+        struct stat  st;
+} manifest_entry;
 
-                if (!strcmp("buildsrc", file)) continue;
-                if (!strcmp("..", file))       continue;
-                if (!strcmp(".", file))        continue;
+DYN_ARRAY_TYPE(manifest_entry, manifest_array);
 
-                strcpy(abspath, path);
-                strcat(abspath, "/");
-                strcat(abspath, file);
+static forge_io_walk_action
+__build_manifest(const forge_io_walk_entry *e,
+                 void                      *ud)
+{
+        manifest_array *ar = (manifest_array *)ud;
 
-                if (forge_io_is_dir(abspath)) {
-                        build_manifest(ar, abspath);
-                } else {
-                        dyn_array_append(*ar, strdup(abspath));
-                }
+        if (e->depth == 0 && !strcmp(e->name, "buildsrc")) {
+                return FORGE_IO_WALK_SKIP;
         }
 
-        for (size_t i = 0; basefiles[i]; ++i) {
-                free(basefiles[i]);
+        if (!e->is_dir) {
+                manifest_entry me = (manifest_entry) {
+                        .path = strdup(e->path),
+                        .st = e->st,
+                };
+                dyn_array_append(*ar, me);
         }
+
+        return FORGE_IO_WALK_CONTINUE;
 }
 
 static int
-copy_file_to_root(const char *src_abs,
-                const char *dst_abs,
-                sqlite3 *db,
-                int pkg_id)
+build_manifest(manifest_array *ar, const char *path)
 {
-        struct stat st;
-        if (lstat(src_abs, &st) != 0) {
-                perror("lstat");
+        if (!forge_io_walk(path, FORGE_IO_WALK_STAT, __build_manifest, ar)) {
+                fprintf(stderr, "could not walk %s: %s\n", path, strerror(errno));
                 return 0;
         }
+        return 1;
+}
+
+// Install `src_abs` as `dst_abs` and record it with `ins`.
+// Unless `tmp_abs` is NULL, the file is written there instead
+// and the caller renames it to `dst_abs` later on. `known_hash`
+// is the hash of `src_abs` if it was already computed, so that
+// the file does not have to be read again.
+static int
+copy_file_to_root(copy_ctx          *cc,
+                  const char        *src_abs,
+                  const struct stat *stp,
+                  const char        *dst_abs,
+                  const char        *tmp_abs,
+                  sqlite3_stmt      *ins,
+                  int                pkg_id,
+                  const char        *known_hash)
+{
+        const struct stat st = *stp;
+        const char *out = tmp_abs ? tmp_abs : dst_abs;
 
         // Make sure parent directory exists
-        char *dst_abs_cpy = strdup(dst_abs);
-        char *dir = dirname(dst_abs_cpy);
-        char *mkdir_cmd = forge_cstr_builder("install -d \"", dir, "\"", NULL);
-        cmd_s(mkdir_cmd);
-        free(mkdir_cmd);
-        free(dst_abs_cpy);
+        if (!copy_mkparents(cc, dst_abs)) {
+                fprintf(stderr, "could not create parent directories of %s: %s\n", dst_abs, strerror(errno));
+                return 0;
+        }
 
         const char *type_str;
-        int copied = 1;
+        char hash[SHA256_HEX_SZ] = {0};
 
         if (S_ISLNK(st.st_mode)) {
                 char target[PATH_MAX + 1];
@@ -964,27 +1405,27 @@ copy_file_to_root(const char *src_abs,
                 }
                 target[len] = '\0';
 
-                if (symlink(target, dst_abs) == -1) {
-                        if (errno == EEXIST) unlink(dst_abs);
-                        if (symlink(target, dst_abs) == -1) {
-                                perror("symlink");
-                                return 0;
-                        }
+                if (!copy_symlink(cc, target, out)) {
+                        perror("symlink");
+                        return 0;
                 }
                 type_str = "symlink";
 
         } else if (S_ISDIR(st.st_mode)) {
-                if (mkdir(dst_abs, st.st_mode & 07777) == -1 && errno != EEXIST) {
+                if (!copy_mkdir(cc, out, st.st_mode)) {
                         perror("mkdir");
                         return 0;
                 }
                 type_str = "dir";
 
         } else if (S_ISREG(st.st_mode)) {
-                char *cmd = forge_cstr_builder("install -D \"", src_abs, "\" \"", dst_abs, "\"", NULL);
-                copied = cmd_s(cmd);
-                free(cmd);
-                if (!copied) return 0;
+                if (known_hash) {
+                        snprintf(hash, sizeof(hash), "%s", known_hash);
+                }
+                if (!copy_regular(cc, src_abs, &st, out, known_hash ? NULL : hash)) {
+                        fprintf(stderr, "could not copy %s to %s: %s\n", src_abs, out, strerror(errno));
+                        return 0;
+                }
                 type_str = "file";
 
         } else {
@@ -992,30 +1433,22 @@ copy_file_to_root(const char *src_abs,
                 return 0;  // block device, fifo, socket, etc.
         }
 
-        const char *sql =
-                "INSERT OR REPLACE INTO Files "
-                "(pkg_id, path, size, mode, mtime, type) "
-                "VALUES (?, ?, ?, ?, ?, ?);";
-
-        sqlite3_stmt *stmt;
-        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-        if (rc != SQLITE_OK) {
-                fprintf(stderr, "SQL prepare failed: %s\n", sqlite3_errmsg(db));
-                return 0;
+        sqlite3_bind_int(ins, 1, pkg_id);
+        sqlite3_bind_text(ins, 2, dst_abs, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(ins, 3, S_ISLNK(st.st_mode) ? 0 : st.st_size);
+        sqlite3_bind_int(ins, 4, st.st_mode & 07777); // permissions only
+        sqlite3_bind_int64(ins, 5, st.st_mtim.tv_sec);
+        sqlite3_bind_text(ins, 6, type_str, -1, SQLITE_STATIC);
+        if (hash[0]) {
+                sqlite3_bind_text(ins, 7, hash, -1, SQLITE_STATIC);
         }
 
-        sqlite3_bind_int(stmt, 1, pkg_id);
-        sqlite3_bind_text(stmt, 2, dst_abs, -1, SQLITE_STATIC);
-        sqlite3_bind_int64(stmt, 3, S_ISLNK(st.st_mode) ? 0 : st.st_size);
-        sqlite3_bind_int(stmt, 4, st.st_mode & 07777); // permissions only
-        sqlite3_bind_int64(stmt, 5, st.st_mtim.tv_sec);
-        sqlite3_bind_text(stmt, 6, type_str, -1, SQLITE_STATIC);
-
-        rc = sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        int rc = sqlite3_step(ins);
+        sqlite3_reset(ins);
+        sqlite3_clear_bindings(ins);
 
         if (rc != SQLITE_DONE) {
-                fprintf(stderr, "Insert failed: %s\n", sqlite3_errmsg(db));
+                fprintf(stderr, "Insert failed: %s\n", sqlite3_errmsg(sqlite3_db_handle(ins)));
                 return 0;
         }
 
@@ -1051,6 +1484,35 @@ print_file_progress(const char *realpath, size_t i, size_t total, int add) {
 #undef BAR_WIDTH
 }
 
+static void
+uninstall_progress(const char *path,
+                   size_t      done,
+                   size_t      total)
+{
+        print_file_progress(path, done - 1, total, /*add=*/0);
+}
+
+static char *
+get_pkg_src_loc(forge_context *ctx,
+                const char    *name)
+{
+        char *pkg_src_loc = NULL;
+
+        const char *sql_select = "SELECT pkg_src_loc FROM Pkgs WHERE name = ?;";
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql_select);
+
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char *src_loc = (const char *)sqlite3_column_text(stmt, 0);
+                if (src_loc) {
+                        pkg_src_loc = strdup(src_loc);
+                }
+        }
+        sqlite3_reset(stmt);
+
+        return pkg_src_loc;
+}
+
 static int
 uninstall_pkg(forge_context *ctx, str_array names, int remove_src)
 {
@@ -1070,23 +1532,12 @@ uninstall_pkg(forge_context *ctx, str_array names, int remove_src)
                         continue; // Skip, not an error
                 }
 
-                char *pkg_src_loc = NULL;
-                sqlite3_stmt *stmt;
-                const char *sql = "SELECT pkg_src_loc FROM Pkgs WHERE id = ?;";
-                int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, ctx->db);
-                sqlite3_bind_int(stmt, 1, pkg_id);
-                if (sqlite3_step(stmt) == SQLITE_ROW) {
-                        const char *loc = (const char *)sqlite3_column_text(stmt, 0);
-                        if (loc) pkg_src_loc = strdup(loc);
-                }
-                sqlite3_finalize(stmt);
+                char *pkg_src_loc = get_pkg_src_loc(ctx, name);
 
                 // Get all files for this package
-                stmt = NULL;
-                sql = "SELECT path FROM Files WHERE pkg_id = ?;";
-                rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, ctx->db);
+                int rc;
+                const char *sql = "SELECT path FROM Files WHERE pkg_id = ?;";
+                sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
                 sqlite3_bind_int(stmt, 1, pkg_id);
 
@@ -1097,10 +1548,10 @@ uninstall_pkg(forge_context *ctx, str_array names, int remove_src)
                 }
                 if (rc != SQLITE_DONE) {
                         fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(ctx->db));
-                        sqlite3_finalize(stmt);
+                        sqlite3_reset(stmt);
                         goto fail_files;
                 }
-                sqlite3_finalize(stmt);
+                sqlite3_reset(stmt);
 
                 char *file_count_str = forge_cstr_of_int(files.len);
                 if (g_config.flags & FT_PRETEND) {
@@ -1110,75 +1561,52 @@ uninstall_pkg(forge_context *ctx, str_array names, int remove_src)
                 }
                 free(file_count_str);
 
-                // Remove installed files
+                // Remove installed files a directory at a time, along
+                // with any directories that only held this package.
                 str_array failed = dyn_array_empty(str_array);
 
-                for (size_t j = 0; j < files.len; ++j) {
-                        const char *path = files.data[j];
-
-                        print_file_progress(path, j, files.len, /*add=*/0);
-
-                        struct stat st;
-                        if (lstat(path, &st) != 0) {
-                                if (errno == ENOENT) continue;
-                                perror("lstat");
-                                dyn_array_append(failed, strdup(path));
-                                continue;
-                        }
-
-                        if (S_ISDIR(st.st_mode)) {
-                                continue; // Skip dirs
-                        }
-
-                        if (((g_config.flags & FT_PRETEND) == 0) && unlink(path) != 0 && errno != ENOENT) {
-                                perror("unlink");
-                                dyn_array_append(failed, strdup(path));
+                if (g_config.flags & FT_PRETEND) {
+                        for (size_t j = 0; j < files.len; ++j) {
+                                print_file_progress(files.data[j], j, files.len, /*add=*/0);
                         }
+                } else {
+                        (void)rmfiles(files.data, files.len, skeleton_dirs, uninstall_progress, &failed);
                 }
 
-                // Delete file entries from DB
+                // Delete file entries from DB and mark as uninstalled
+                // and clear source location, all at once.
                 if ((g_config.flags & FT_PRETEND) == 0) {
-                        const char *del_files = "DELETE FROM Files WHERE pkg_id = ?;";
-                        rc = sqlite3_prepare_v2(ctx->db, del_files, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx->db);
-                        sqlite3_bind_int(stmt, 1, pkg_id);
-                        rc = sqlite3_step(stmt);
-                        if (rc != SQLITE_DONE) {
-                                fprintf(stderr, "Failed to delete file entries: %s\n", sqlite3_errmsg(ctx->db));
-                        }
-                        sqlite3_finalize(stmt);
-                }
+                        db_savepoint(ctx->db, "uninstall_pkg");
+
+                        clear_package_files_from_db(ctx, name, pkg_id);
 
-                // Mark as uninstalled and clear source location
-                if ((g_config.flags & FT_PRETEND) == 0) {
                         const char *update_pkg = NULL;
                         if (remove_src) {
                                 update_pkg = "UPDATE Pkgs SET installed = 0, pkg_src_loc = NULL WHERE id = ?;";
                         } else {
                                 update_pkg = "UPDATE Pkgs SET installed = 0 WHERE id = ?;";
                         }
-                        rc = sqlite3_prepare_v2(ctx->db, update_pkg, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx->db);
+                        stmt = ctx_stmt(ctx, update_pkg);
                         sqlite3_bind_int(stmt, 1, pkg_id);
                         rc = sqlite3_step(stmt);
                         if (rc != SQLITE_DONE) {
                                 fprintf(stderr, "Failed to update package status: %s\n", sqlite3_errmsg(ctx->db));
                         }
-                        sqlite3_finalize(stmt);
+                        sqlite3_reset(stmt);
+
+                        db_release(ctx->db, "uninstall_pkg");
                 }
 
                 // Remove source directory
                 if (((g_config.flags & FT_PRETEND) == 0) && pkg_src_loc && remove_src) {
                         char *src_path = forge_cstr_builder(PKG_SOURCE_DIR, "/", forge_io_basename(pkg_src_loc), NULL);
                         info(1, "Removing source directory\n");
-                        char *rm_cmd = forge_cstr_builder("rm -rf ", src_path, NULL);
-                        if (system(rm_cmd) != 0) {
+                        if (!rmrf(src_path)) {
                                 char msg[PATH_MAX] = {0};
                                 sprintf(msg, "Failed to remove source directory: %s\n", src_path);
                                 bad(1, msg);
                                 // Not fatal - continue
                         }
-                        free(rm_cmd);
                         free(src_path);
                         free(pkg_src_loc);
                         pkg_src_loc = NULL;
@@ -1223,6 +1651,38 @@ uninstall_pkg(forge_context *ctx, str_array names, int remove_src)
         return 1;
 }
 
+// Estimate how long installing `name` takes from its recorded
+// history. The download only counts if the source is not there.
+static int64_t
+estimate_pkg_ms(forge_context *ctx,
+                const char    *name)
+{
+        char *pkg_src_loc = get_pkg_src_loc(ctx, name);
+        int with_download = !pkg_src_loc || access(pkg_src_loc, F_OK) != 0;
+        free(pkg_src_loc);
+
+        return buildstats_estimate_ms(ctx->db, name, with_download);
+}
+
+static char *
+fmt_duration_ms(int64_t ms)
+{
+        char buf[64] = {0};
+        int64_t secs = (ms + 500) / 1000;
+
+        if (secs >= 3600) {
+                snprintf(buf, sizeof(buf), "%ldh %ldm", (long)(secs / 3600), (long)(secs % 3600 / 60));
+        } else if (secs >= 60) {
+                snprintf(buf, sizeof(buf), "%ldm %lds", (long)(secs / 60), (long)(secs % 60));
+        } else if (ms >= 1000) {
+                snprintf(buf, sizeof(buf), "%lds", (long)secs);
+        } else {
+                snprintf(buf, sizeof(buf), "%ldms", (long)ms);
+        }
+
+        return strdup(buf);
+}
+
 static void
 __list_to_be_installed(forge_context   *ctx,
                        str_array        names,
@@ -1232,31 +1692,18 @@ __list_to_be_installed(forge_context   *ctx,
         for (size_t i = 0; i < names.len; ++i) {
                 const char *name = names.data[i];
 
-                pkg  *pkg         = NULL;
-                int   pkg_id      = get_pkg_id(ctx, name);
+                const module *m      = modindex_find(&ctx->mi, name);
+                int           pkg_id = get_pkg_id(ctx, name);
 
                 if (pkg_id == -1) {
                         forge_err_wargs("unregistered package `%s`", name);
                 }
 
-                for (size_t j = 0; j < ctx->pkgs.len; ++j) {
-                        if (!strcmp(ctx->pkgs.data[j]->name(), name)) {
-                                pkg = ctx->pkgs.data[j];
-                                break;
-                        }
-                }
-
-                assert(pkg);
+                assert(m);
 
-                if (pkg->deps && (g_config.flags & FT_ONLY) == 0) {
+                if (m->deps.len > 0 && (g_config.flags & FT_ONLY) == 0) {
                         if (!pkg_is_installed(ctx, name)) {
-                                str_array ar = dyn_array_empty(str_array);
-                                char **deps = pkg->deps();
-                                for (size_t i = 0; deps[i]; ++i) {
-                                        dyn_array_append(ar, deps[i]);
-                                }
-                                __list_to_be_installed(ctx, ar, displayed, orig_names);
-                                dyn_array_free(ar);
+                                __list_to_be_installed(ctx, m->deps, displayed, orig_names);
                         }
                 }
 
@@ -1288,9 +1735,42 @@ list_to_be_installed(forge_context *ctx,
 {
         str_array displayed = dyn_array_empty(str_array);
         __list_to_be_installed(ctx, names, &displayed, &names);
+
+        // Everything in `displayed` is new, the rest of `names` is reinstalled.
+        int64_t total_ms = 0;
+        size_t unknown = 0;
+        for (size_t i = 0; i < displayed.len + names.len; ++i) {
+                const char *name = i < displayed.len ? displayed.data[i] : names.data[i - displayed.len];
+                if (i >= displayed.len) {
+                        int dup = 0;
+                        for (size_t j = 0; !dup && j < displayed.len; ++j) {
+                                dup = !strcmp(displayed.data[j], name);
+                        }
+                        if (dup) continue;
+                }
+
+                int64_t ms = estimate_pkg_ms(ctx, name);
+                if (ms < 0) ++unknown;
+                else        total_ms += ms;
+        }
+
+        if (total_ms > 0) {
+                char *dur = fmt_duration_ms(total_ms);
+                printf("\nEstimated time: " YELLOW BOLD "%s" RESET, dur);
+                if (unknown > 0) {
+                        printf(" (+%zu package%s without build history)", unknown, unknown == 1 ? "" : "s");
+                }
+                printf("\n");
+                free(dur);
+        }
+
         FOREACH(s, displayed.data, displayed.len, { free(s); });
         dyn_array_free(displayed);
 
+        if (g_config.flags & FT_YES) {
+                return;
+        }
+
         int choice = forge_chooser_yesno("\n" PINK BOLD "Continue?" RESET, NULL, 1);
         if (!choice) {
                 info(0, "Canceling...\n");
@@ -1304,24 +1784,17 @@ display_pkg_suggested(forge_context *ctx,
 {
         for (size_t i = 0; i < names.len; ++i) {
                 const char *name = names.data[i];
-                pkg *pkg = NULL;
+                const module *m = modindex_find(&ctx->mi, name);
                 int pkg_id = get_pkg_id(ctx, name);
                 if (pkg_id == -1) {
                         forge_err_wargs("unregistered package `%s`", name);
                 }
-                for (size_t j = 0; j < ctx->pkgs.len; ++j) {
-                        if (!strcmp(ctx->pkgs.data[j]->name(), name)) {
-                                pkg = ctx->pkgs.data[j];
-                                break;
-                        }
-                }
-                assert(pkg);
+                assert(m);
 
-                if (pkg->suggested) {
+                if (m->suggested.len > 0) {
                         printf(YELLOW "*" RESET " Suggested packages for package " YELLOW BOLD "%s" RESET "\n", name);
-                        char **sugg = pkg->suggested();
-                        for (size_t k = 0; sugg[k]; ++k) {
-                                printf(YELLOW "*" RESET "    %s\n", sugg[k]);
+                        for (size_t k = 0; k < m->suggested.len; ++k) {
+                                printf(YELLOW "*" RESET "    %s\n", m->suggested.data[k]);
                         }
                 }
         }
@@ -1333,24 +1806,17 @@ display_pkg_msgs(forge_context *ctx,
 {
         for (size_t i = 0; i < names.len; ++i) {
                 const char *name = names.data[i];
-                pkg *pkg = NULL;
+                const module *m = modindex_find(&ctx->mi, name);
                 int pkg_id = get_pkg_id(ctx, name);
                 if (pkg_id == -1) {
                         forge_err_wargs("unregistered package `%s`", name);
                 }
-                for (size_t j = 0; j < ctx->pkgs.len; ++j) {
-                        if (!strcmp(ctx->pkgs.data[j]->name(), name)) {
-                                pkg = ctx->pkgs.data[j];
-                                break;
-                        }
-                }
-                assert(pkg);
+                assert(m);
 
-                if (pkg->msgs) {
+                if (m->msgs.len > 0) {
                         printf(YELLOW "*" RESET " Messages for package " YELLOW BOLD "%s" RESET "\n", name);
-                        char **msgs = pkg->msgs();
-                        for (size_t k = 0; msgs[k]; ++k) {
-                                printf(YELLOW "*" RESET "    %s\n", msgs[k]);
+                        for (size_t k = 0; k < m->msgs.len; ++k) {
+                                printf(YELLOW "*" RESET "    %s\n", m->msgs.data[k]);
                         }
                 }
         }
@@ -1359,375 +1825,1515 @@ display_pkg_msgs(forge_context *ctx,
 static void
 remove_pkg_source(const char *pkgname)
 {
-        if (cd(PKG_SOURCE_DIR)) {
-                char *rmcmd = forge_cstr_builder("rm -r ", pkgname, NULL);
-                cmd(rmcmd);
-                free(rmcmd);
+        char *src_path = forge_cstr_builder(PKG_SOURCE_DIR, "/", pkgname, NULL);
+        if (!rmrf(src_path)) {
+                fprintf(stderr, "could not remove %s: %s\n", src_path, strerror(errno));
         }
+        free(src_path);
 }
 
-static int
-install_pkg(forge_context *ctx,
-            str_array      names,
-            int            is_dep,
-            int            skip_ask)
-{
-        assert_sudo();
+// A package that is on its way from its C module into the
+// host filesystem. The build phase (download, build, install
+// into the fakeroot) does not touch the database so that it
+// can run in a child process. The merge phase copies the fakeroot
+// into `/` and records everything, and always runs in forge itself.
+typedef struct {
+        const char *name;
+        module     *m;
+        char       *fakeroot;
+        char       *pkgname;    // directory name of the source in PKG_SOURCE_DIR
+        int         downloaded; // the source was fetched for this install
+        char       *cache_key;  // binary cache key, NULL if the cache is not used
+        phase_stat  phases[PHASE__COUNT];
+} pkg_stage;
 
-        if (!skip_ask) {
-                info(0, "To be installed:\n");
-                list_to_be_installed(ctx, names);
+static char *
+get_cache_key(forge_context *ctx,
+              const module  *m)
+{
+        if (g_config.flags & FT_NO_CACHE) {
+                return NULL;
         }
+        return binpkg_key(ctx->db, &ctx->mi, m);
+}
 
-        const char *failed_pkgname = NULL;
-
-        for (size_t i = 0; i < names.len; ++i) {
-                const char *name = names.data[i];
-
-                // Printing
-                char *current = forge_cstr_of_int(i+1);
-                char *outof = forge_cstr_of_int(names.len);
-                info_builder(0, "Installing ", BOLD BRIGHT_PINK, !is_dep ? "package " : "dependency ", RESET, YELLOW, BOLD,
-                             name, RESET, " [", YELLOW, current, RESET, "/",
-                             YELLOW, outof, RESET, "]\n", NULL);
-                free(current);
-                free(outof);
+static int
+record_pkg_deps(forge_context   *ctx,
+                const char      *name,
+                const str_array *depnames)
+{
+        int pkg_id = get_pkg_id(ctx, name);
+        if (pkg_id == -1) {
+                forge_err_wargs("package `%s` not registered after install", name);
+                return 0;
+        }
 
-                pkg *pkg = NULL;
-                char *pkg_src_loc = NULL;
-                int pkg_id = get_pkg_id(ctx, name);
-                if (pkg_id == -1) {
-                        forge_err_wargs("unregistered package `%s`", name);
-                }
-                for (size_t j = 0; j < ctx->pkgs.len; ++j) {
-                        if (!strcmp(ctx->pkgs.data[j]->name(), name)) {
-                                pkg = ctx->pkgs.data[j];
-                                break;
-                        }
-                }
-                assert(pkg);
+        const char *sql_insert_dep = ""
+                "INSERT OR IGNORE INTO Deps (pkg_id, dep_id) "
+                "SELECT ?1, id FROM Pkgs WHERE name = ?2;";
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql_insert_dep);
 
-                if (pkg_is_installed(ctx, name) && is_dep) {
-                        info_builder(0, "Dependency ", YELLOW BOLD, name, RESET, " is already installed\n", NULL);
-                        continue; // Skip to next package
+        for (size_t j = 0; j < depnames->len; ++j) {
+                const char *dep_name = depnames->data[j];
+                int dep_id = get_pkg_id(ctx, dep_name);
+                if (dep_id == -1) {
+                        info_builder(1, "Warning: dependency `", dep_name, "` not found in DB (should be registered)\n", NULL);
+                        continue;
                 }
 
-                // Check current is_explicit status
-                int is_explicit = !is_dep; // Default: 0 for deps, 1 for explicit
-                if (pkg_id != -1) {
-                        sqlite3_stmt *stmt;
-                        const char *sql = "SELECT is_explicit FROM Pkgs WHERE name = ?;";
-                        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx->db);
+                sqlite3_bind_int(stmt, 1, pkg_id);
+                sqlite3_bind_text(stmt, 2, dep_name, -1, SQLITE_STATIC);
 
-                        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-                        /* if (sqlite3_step(stmt) == SQLITE_ROW) { */
-                        /*         int existing_is_explicit = sqlite3_column_int(stmt, 0); */
-                        /*         if (!is_dep) { // For explicit installations, preserve is_explicit = 1 */
-                        /*                 is_explicit = existing_is_explicit || 1; // Keep 1 if already 1, else set to 1 */
-                        /*         } else { // For dependencies, keep existing is_explicit */
-                        /*                 is_explicit = existing_is_explicit; */
-                        /*         } */
-                        /* } */
-                        sqlite3_finalize(stmt);
+                if (sqlite3_step(stmt) != SQLITE_DONE) {
+                        fprintf(stderr, "Failed to record dependency %s -> %s: %s\n",
+                                name, dep_name, sqlite3_errmsg(ctx->db));
                 }
+                sqlite3_reset(stmt);
+        }
 
-                // Register package with the determined is_explicit value
-                register_pkg(ctx, pkg, is_explicit);
+        return 1;
+}
 
-                char *orig_fakeroot = g_fakeroot;
+// Make sure the source of `st` is in PKG_SOURCE_DIR and set
+// `st->pkgname`. `pkg_src_loc` is the recorded source location,
+// or NULL. Does nothing if the source was already fetched.
+static int
+fetch_pkg(pkg_stage  *st,
+          const char *pkg_src_loc)
+{
+        if (st->pkgname) {
+                return 1;
+        }
 
-                // Install deps
-                if (pkg->deps && (g_config.flags & FT_ONLY) == 0) {
-                        info(0, "Installing Dependencies\n");
-                        info_builder(0, "deps(", YELLOW BOLD, name, RESET, ")\n", NULL);
-                        char **deps = pkg->deps();
-                        str_array depnames = dyn_array_empty(str_array);
-                        for (size_t j = 0; deps[j]; ++j) {
-                                dyn_array_append(depnames, strdup(deps[j]));
-                        }
+        if (!cd(PKG_SOURCE_DIR)) {
+                fprintf(stderr, "aborting...\n");
+                return 0;
+        }
 
-                        // Install dependencies
-                        if (!install_pkg(ctx, depnames, /*is_dep=*/1, /*skip_ask=*/1)) {
-                                forge_err_wargs("could not install package %s, stopping...\n", names.data[i]);
-                                for (size_t j = 0; j < depnames.len; ++j) free(depnames.data[j]);
-                                dyn_array_free(depnames);
-                                goto bad;
-                        }
+        if (pkg_src_loc && access(pkg_src_loc, F_OK) == 0) {
+                st->pkgname = strdup(forge_io_basename(pkg_src_loc));
+                return 1;
+        }
 
-                        // Record dependency relationships in Deps table
-                        int pkg_id = get_pkg_id(ctx, name);
-                        if (pkg_id == -1) {
-                                forge_err_wargs("package `%s` not registered after install", name);
-                                for (size_t j = 0; j < depnames.len; ++j) free(depnames.data[j]);
-                                dyn_array_free(depnames);
-                                goto bad;
-                        }
+        info_builder(1, "download(", YELLOW BOLD, st->name, RESET, ")\n\n", NULL);
+        phase_timer t;
+        phase_begin(&t);
+        const char *pkgname = st->m->pkg->download();
+        phase_end(&t, pkgname != NULL, &st->phases[PHASE_DOWNLOAD]);
+        if (!pkgname) {
+                fprintf(stderr, "could not download package, aborting...\n");
+                return 0;
+        }
+        st->pkgname = strdup(pkgname);
+        st->downloaded = 1;
 
-                        sqlite3_stmt *stmt;
-                        const char *sql_insert_dep = ""
-                                "INSERT OR IGNORE INTO Deps (pkg_id, dep_id) "
-                                "SELECT ?1, id FROM Pkgs WHERE name = ?2;";
+        return 1;
+}
 
-                        int rc = sqlite3_prepare_v2(ctx->db, sql_insert_dep, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx->db);
+// Fetch (if needed), build and install `st` into its fakeroot.
+// `pkg_src_loc` is the recorded source location, or NULL.
+static int
+build_pkg(pkg_stage  *st,
+          const char *pkg_src_loc)
+{
+        const char *name = st->name;
+        pkg *pkg = st->m->pkg;
+        int ok = 0;
 
-                        for (size_t j = 0; j < depnames.len; ++j) {
-                                const char *dep_name = depnames.data[j];
-                                int dep_id = get_pkg_id(ctx, dep_name);
-                                if (dep_id == -1) {
-                                        info_builder(1, "Warning: dependency `", dep_name, "` not found in DB (should be registered)\n", NULL);
-                                        continue;
-                                }
+        if (!cd(PKG_SOURCE_DIR)) {
+                fprintf(stderr, "aborting...\n");
+                return 0;
+        }
 
-                                sqlite3_bind_int(stmt, 1, pkg_id);
-                                sqlite3_bind_text(stmt, 2, dep_name, -1, SQLITE_STATIC);
+        // Same module, version, deps and conf.h as an earlier build?
+        // Then that build's fakeroot is exactly what we would produce.
+        if (st->cache_key && !g_config.refresh_cache
+            && binpkg_fetch(name, st->cache_key, st->fakeroot, &st->pkgname)) {
+                info_builder(1, "Using cached build of ", YELLOW BOLD, name, RESET, "\n", NULL);
+                return 1;
+        }
 
-                                rc = sqlite3_step(stmt);
-                                if (rc != SQLITE_DONE) {
-                                        fprintf(stderr, "Failed to record dependency %s -> %s: %s\n",
-                                                name, dep_name, sqlite3_errmsg(ctx->db));
-                                }
-                                sqlite3_reset(stmt);
-                        }
+        if (!fetch_pkg(st, pkg_src_loc)) {
+                return 0;
+        }
 
-                        sqlite3_finalize(stmt);
+        char *buildsrc = forge_cstr_builder(st->fakeroot, "/buildsrc", NULL);
 
-                        // Cleanup
-                        for (size_t j = 0; j < depnames.len; ++j) free(depnames.data[j]);
-                        dyn_array_free(depnames);
-                }
+        if (!cd_silent(PKG_SOURCE_DIR) || !cd(st->pkgname)) {
+                fprintf(stderr, "aborting...\n");
+                goto done;
+        }
 
-                g_fakeroot = orig_fakeroot;
+        {
+                info(1, "Copying build source\n");
 
-                sqlite3_stmt *stmt;
-                const char *sql_select = "SELECT pkg_src_loc FROM Pkgs WHERE name = ?;";
-                int rc = sqlite3_prepare_v2(ctx->db, sql_select, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, ctx->db);
+                char *dst = forge_cstr_builder(buildsrc, "/", NULL);
+                const char *rsync[] = {"rsync", "-av", "--exclude=.git", "--exclude=.gitignore", "./", dst, NULL};
+                int copied = forge_cmd_run(rsync, NULL, NULL);
+                free(dst);
 
-                sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-                if (sqlite3_step(stmt) == SQLITE_ROW) {
-                        const char *src_loc = (const char *)sqlite3_column_text(stmt, 0);
-                        if (src_loc) {
-                                pkg_src_loc = strdup(src_loc);
-                        }
+                if (!copied) {
+                        fprintf(stderr, "could not copy build source, aborting...\n");
+                        goto done;
                 }
-                sqlite3_finalize(stmt);
+        }
 
-                if (!cd(PKG_SOURCE_DIR)) {
+        CD(buildsrc, {
                         fprintf(stderr, "aborting...\n");
-                        free(pkg_src_loc);
-                        goto bad;
-                }
+                        goto done;
+                });
 
-                sandbox(name);
-                char *buildsrc = forge_cstr_builder(g_fakeroot, "/buildsrc", NULL);
+        phase_timer t;
 
-                const char *pkgname = NULL;
-
-                if (pkg_src_loc) {
-                        pkgname = forge_io_basename(pkg_src_loc);
-                } else {
-                        info_builder(1, "download(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
-                        pkgname = pkg->download();
-                        failed_pkgname = pkgname;
-                        if (!pkgname) {
-                                fprintf(stderr, "could not download package, aborting...\n");
-                                free(pkg_src_loc);
-                                goto bad;
-                        }
+        if (pkg->build) {
+                info_builder(1, "build(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
+                phase_begin(&t);
+                int buildres = pkg->build();
+                phase_end(&t, buildres, &st->phases[PHASE_BUILD]);
+                if (!buildres) {
+                        fprintf(stderr, "could not build package, aborting...\n");
+                        goto done;
                 }
+        } else {
+                info_builder(1, "Skipping build phase for ", YELLOW, name, RESET, "\n", NULL);
+        }
 
-                if (!cd_silent(pkgname)) {
-                        info_builder(1, "download(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
-                        if (!pkg->download()) {
-                                fprintf(stderr, "could not download package, aborting...\n");
-                                free(pkg_src_loc);
-                                goto bad;
-                        }
-                        if (!cd(pkgname)) {
-                                fprintf(stderr, "aborting...\n");
-                                free(pkg_src_loc);
-                                goto bad;
-                        }
-                }
+        // Back to top-level of the package to reset our CWD.
+        if (!cd(buildsrc)) {
+                fprintf(stderr, "aborting...\n");
+                goto done;
+        }
 
-                {
-                        info(1, "Copying build source\n");
+        info_builder(1, "install(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
 
-                        char *rsync_cmd = forge_cstr_builder("rsync -av --exclude='.git' --exclude='.gitignore' ",
-                                                             "\"./\" \"", buildsrc, "/\"", NULL);
+        setenv("DESTDIR", st->fakeroot, 1);
+        phase_begin(&t);
+        int installres = pkg->install();
+        phase_end(&t, installres, &st->phases[PHASE_INSTALL]);
+        if (!installres) {
+                fprintf(stderr, "failed to install package, aborting...\n");
+                goto done;
+        }
 
-                        printf("%s\n", cmdout(rsync_cmd));
-                        free(rsync_cmd);
+        if (st->cache_key) {
+                info(1, "Storing build in the binary cache\n");
+                if (!binpkg_store(name, st->cache_key, st->fakeroot, st->pkgname)) {
+                        fprintf(stderr, "could not store %s in " BINPKG_CACHE_DIR ", continuing...\n", name);
                 }
+        }
 
-                char src_loc[256] = {0};
-                sprintf(src_loc, PKG_SOURCE_DIR "/%s", pkgname);
+        ok = 1;
+ done:
+        free(buildsrc);
+        return ok;
+}
 
-                CD(buildsrc, {
-                                fprintf(stderr, "aborting...\n");
-                                free(pkg_src_loc);
-                                goto bad;
-                        });
+// Find the files in `manifest` that are already owned by
+// another installed package. The path of each conflict is
+// appended to `conflicts` and its owner to `owners`.
+// Directories are shared freely.
+static void
+find_file_conflicts(forge_context        *ctx,
+                    int                   pkg_id,
+                    const manifest_array *manifest,
+                    size_t                fakeroot_len,
+                    str_array            *conflicts,
+                    str_array            *owners)
+{
+        const char *sql =
+                "SELECT Pkgs.name FROM Files "
+                "JOIN Pkgs ON Pkgs.id = Files.pkg_id "
+                "WHERE Files.path = ? AND Files.pkg_id != ? "
+                "AND Files.type != 'dir' AND Pkgs.installed = 1 LIMIT 1;";
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
-                if (pkg->build) {
-                        info_builder(1, "build(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
-                        int buildres = pkg->build();
-                        if (!buildres) {
-                                fprintf(stderr, "could not build package, aborting...\n");
-                                goto bad;
-                        }
-                } else {
-                        info_builder(1, "Skipping build phase for ", YELLOW, name, RESET, "\n", NULL);
-                }
+        for (size_t i = 0; i < manifest->len; ++i) {
+                if (S_ISDIR(manifest->data[i].st.st_mode)) continue;
 
-                // Back to top-level of the package to reset our CWD.
-                if (!cd(buildsrc)) {
-                        fprintf(stderr, "aborting...\n");
-                        free(pkg_src_loc);
-                        goto bad;
-                }
+                const char *realpath = manifest->data[i].path + fakeroot_len;
+                sqlite3_bind_text(stmt, 1, realpath, -1, SQLITE_STATIC);
+                sqlite3_bind_int(stmt, 2, pkg_id);
 
-                free(buildsrc);
+                if (sqlite3_step(stmt) == SQLITE_ROW) {
+                        const char *owner = (const char *)sqlite3_column_text(stmt, 0);
+                        dyn_array_append(*conflicts, strdup(realpath));
+                        dyn_array_append(*owners, strdup(owner));
+                }
+                sqlite3_reset(stmt);
+        }
+}
 
-                info_builder(1, "install(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
+// Give the paths in `conflicts` (from find_file_conflicts())
+// to `pkg_id`, so that uninstalling their previous owners
+// does not remove them.
+static void
+take_file_ownership(forge_context   *ctx,
+                    int              pkg_id,
+                    const str_array *conflicts)
+{
+        const char *sql = "DELETE FROM Files WHERE path = ? AND pkg_id != ? AND type != 'dir';";
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
 
-                setenv("DESTDIR", g_fakeroot, 1);
-                if (!pkg->install()) {
-                        fprintf(stderr, "failed to install package, aborting...\n");
-                        free(pkg_src_loc);
-                        goto bad;
+        for (size_t i = 0; i < conflicts->len; ++i) {
+                sqlite3_bind_text(stmt, 1, conflicts->data[i], -1, SQLITE_STATIC);
+                sqlite3_bind_int(stmt, 2, pkg_id);
+                if (sqlite3_step(stmt) != SQLITE_DONE) {
+                        fprintf(stderr, "Delete error: %s\n", sqlite3_errmsg(ctx->db));
                 }
+                sqlite3_reset(stmt);
+        }
+}
 
-                // Ensure pkg_id is available
-                pkg_id = get_pkg_id(ctx, name);
-                if (pkg_id == -1) {
-                        fprintf(stderr, "Failed to find package ID for %s\n", name);
-                        free(pkg_src_loc);
-                        goto bad;
-                }
+// A file that the package installed last time.
+typedef struct {
+        int64_t  size;
+        int      mode;
+        int      is_link;
+        int      is_dir;
+        char    *hash; // NULL if none was recorded
+        int      seen; // also in the new manifest
+} installed_file;
+
+// Map the paths that `pkg_id` has installed to their
+// installed_file (malloc'd), to update it in place.
+static forge_smap
+load_installed_files(forge_context *ctx,
+                     int            pkg_id)
+{
+        forge_smap files = forge_smap_create();
+
+        const char *sql = "SELECT path, size, mode, type, hash FROM Files WHERE pkg_id = ?;";
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
+        sqlite3_bind_int(stmt, 1, pkg_id);
 
-                // Walk through fakeroot and move over files.
-                info(1, "Creating manifest\n");
-                str_array manifest = dyn_array_empty(str_array);
-                build_manifest(&manifest, g_fakeroot);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char *hash = (const char *)sqlite3_column_text(stmt, 4);
+                const char *type = (const char *)sqlite3_column_text(stmt, 3);
+                installed_file *f = (installed_file *)malloc(sizeof(installed_file));
+                *f = (installed_file) {
+                        .size = sqlite3_column_int64(stmt, 1),
+                        .mode = sqlite3_column_int(stmt, 2),
+                        .is_link = !strcmp(type, "symlink"),
+                        .is_dir = !strcmp(type, "dir"),
+                        .hash = hash ? strdup(hash) : NULL,
+                        .seen = 0,
+                };
+                forge_smap_insert(&files, (const char *)sqlite3_column_text(stmt, 0), f);
+        }
+        sqlite3_reset(stmt);
+
+        return files;
+}
 
-                if (g_config.flags & FT_PRETEND) {
-                        // We are only pretending to install. We do not want to
-                        // move the installed files in the fakeroot into the host filesystem.
-                        printf(YELLOW BOLD "*" RESET " Pretend installed files to fakeroot [ " YELLOW "%s" RESET " ]:\n", g_fakeroot);
-                        for (size_t i = 0; i < manifest.len; ++i) {
-                                printf(YELLOW BOLD "*" RESET "   %s\n", manifest.data[i]);
-                        }
+static void
+free_installed_files(forge_smap *files)
+{
+        char **paths = forge_smap_iter(files);
+        for (size_t i = 0; paths[i]; ++i) {
+                installed_file *f = (installed_file *)forge_smap_get(files, paths[i]);
+                free(f->hash);
+                free(f);
+        }
+        free(paths);
+        forge_smap_destroy(files);
+}
+
+// Whether `fakepath` (described by `st`) is the same as what
+// is installed at `realpath` as `old`, in which case it does
+// not have to be written again. Regular files are compared by
+// their recorded size, mode and hash; the new file's hash is
+// left in `hash` so that it is not read twice if it differs.
+static int
+file_unchanged(const installed_file *old,
+               const char           *fakepath,
+               const struct stat    *st,
+               const char           *realpath,
+               char                  hash[SHA256_HEX_SZ])
+{
+        struct stat cur;
+        if (lstat(realpath, &cur) != 0) {
+                return 0;
+        }
+
+        if (S_ISDIR(st->st_mode)) {
+                return old->is_dir && S_ISDIR(cur.st_mode);
+        }
+
+        if (S_ISLNK(st->st_mode)) {
+                if (!old->is_link || !S_ISLNK(cur.st_mode)) {
+                        return 0;
+                }
+                char a[PATH_MAX + 1], b[PATH_MAX + 1];
+                ssize_t na = readlink(fakepath, a, sizeof(a) - 1);
+                ssize_t nb = readlink(realpath, b, sizeof(b) - 1);
+                return na >= 0 && na == nb && !memcmp(a, b, (size_t)na);
+        }
+
+        // The size on disk is checked as well, in case the
+        // installed file was changed since.
+        if (!S_ISREG(st->st_mode) || old->is_link || !old->hash || !S_ISREG(cur.st_mode)
+            || st->st_size != old->size || cur.st_size != old->size
+            || (int)(st->st_mode & 07777) != old->mode) {
+                return 0;
+        }
+
+        sha256_ctx c;
+        sha256_init(&c);
+        if (!sha256_update_file(&c, fakepath)) {
+                return 0;
+        }
+        sha256_final_hex(&c, hash);
+
+        return !strcmp(hash, old->hash);
+}
+
+// Where a new version of `realpath` is written until the
+// rest of its package is installed (malloc'd).
+static char *
+staged_path(const char *realpath)
+{
+        return forge_cstr_builder(realpath, ".forge-new", NULL);
+}
+
+// Whether packages other than `pkg_id` have files
+// somewhere below the directory `path`.
+static int
+dir_has_other_files(forge_context *ctx,
+                    int            pkg_id,
+                    const char    *path)
+{
+        // Everything below `path` sorts between `path/` and
+        // `path0`, '0' being the character after '/'.
+        const char *sql = "SELECT 1 FROM Files WHERE path > ? AND path < ? AND pkg_id != ? LIMIT 1;";
+        sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
+
+        char *lo = forge_cstr_builder(path, "/", NULL);
+        char *hi = forge_cstr_builder(path, "0", NULL);
+        sqlite3_bind_text(stmt, 1, lo, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, hi, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 3, pkg_id);
+
+        int found = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_reset(stmt);
+        free(lo);
+        free(hi);
+
+        return found;
+}
+
+// Where the old version of `realpath` is kept until the
+// rest of its package is installed (malloc'd).
+static char *
+aside_path(const char *realpath)
+{
+        return forge_cstr_builder(realpath, ".forge-old", NULL);
+}
+
+// Keep the old version of `realpath` at aside_path(), so that
+// restore_aside() can put it back if the merge fails. A file
+// is hard linked there and stays in place until it is renamed
+// over. A directory (`move`), or a file that cannot be linked,
+// is moved there.
+static int
+set_aside(const char *realpath,
+          int         move)
+{
+        char *aside = aside_path(realpath);
+        (void)unlink(aside); // left over from an interrupted merge
+        int ok = (!move && link(realpath, aside) == 0) || rename(realpath, aside) == 0;
+        if (!ok) {
+                fprintf(stderr, "could not keep %s as %s: %s\n", realpath, aside, strerror(errno));
+        }
+        free(aside);
+        return ok;
+}
+
+// Put the old version of `realpath` back over whatever the
+// failed merge left there.
+static void
+restore_aside(const char *realpath)
+{
+        char *aside = aside_path(realpath);
+
+        // rename() cannot replace a directory with a file or the
+        // other way around (EISDIR, ENOTDIR), the new one has to
+        // go first.
+        struct stat old, cur;
+        if (lstat(aside, &old) == 0 && lstat(realpath, &cur) == 0
+            && S_ISDIR(old.st_mode) != S_ISDIR(cur.st_mode)) {
+                (void)remove(realpath);
+        }
+
+        if (rename(aside, realpath) != 0) {
+                fprintf(stderr, "could not restore %s from %s: %s\n", realpath, aside, strerror(errno));
+        }
+        free(aside);
+}
+
+// Remove what set_aside() kept of `realpath` once the merge
+// went through. When a directory was replaced by a file, only
+// the files that the package had in it (the ones in `old`) are
+// removed with it; anything else is left there.
+static void
+drop_aside(const char *realpath,
+           forge_smap *old)
+{
+        char *aside = aside_path(realpath);
+        struct stat st;
+
+        if (lstat(aside, &st) != 0) {
+                free(aside);
+                return;
+        }
+
+        if (!S_ISDIR(st.st_mode)) {
+                (void)unlink(aside);
+                free(aside);
+                return;
+        }
+
+        size_t n = strlen(realpath);
+        str_array gone = dyn_array_empty(str_array);
+        char **paths = forge_smap_iter(old);
+        for (size_t i = 0; paths[i]; ++i) {
+                if (!strncmp(paths[i], realpath, n) && paths[i][n] == '/') {
+                        dyn_array_append(gone, forge_cstr_builder(aside, paths[i] + n, NULL));
+                }
+        }
+        free(paths);
+
+        str_array failed = dyn_array_empty(str_array);
+        (void)rmfiles(gone.data, gone.len, skeleton_dirs, NULL, &failed);
+        for (size_t i = 0; i < failed.len; ++i) {
+                free(failed.data[i]);
+        }
+        dyn_array_free(failed);
+        for (size_t i = 0; i < gone.len; ++i) {
+                free(gone.data[i]);
+        }
+        dyn_array_free(gone);
+
+        if (rmdir(aside) != 0 && errno != ENOENT) {
+                fprintf(stderr, "%s is now a file, the rest of the directory was kept as %s\n", realpath, aside);
+        }
+        free(aside);
+}
+
+// Undo a failed merge_pkg(): remove the files that were new,
+// the staged versions that were not renamed yet (`replaced`
+// from `renamed` on) and put back what set_aside() kept.
+static void
+undo_merge(const str_array *installed,
+           const str_array *replaced,
+           size_t           renamed,
+           const str_array *aside)
+{
+        // Deepest first, so that new directories are empty
+        // by the time they are removed.
+        for (size_t i = installed->len; i-- > 0;) {
+                print_file_progress(installed->data[i], installed->len - 1 - i, installed->len, /*add=*/0);
+                (void)remove(installed->data[i]);
+        }
+        for (size_t i = renamed; i < replaced->len; ++i) {
+                char *tmp = staged_path(replaced->data[i]);
+                unlink(tmp);
+                free(tmp);
+        }
+        for (size_t i = aside->len; i-- > 0;) {
+                restore_aside(aside->data[i]);
+        }
+}
+
+// Remove the files of `pkg_id` that are not in the new
+// manifest, from the filesystem and from Files. Directories
+// are only removed if nothing else lives in them.
+static void
+remove_vanished_files(forge_context *ctx,
+                      int            pkg_id,
+                      forge_smap    *old)
+{
+        str_array gone = dyn_array_empty(str_array);
+        char **paths = forge_smap_iter(old);
+        for (size_t i = 0; paths[i]; ++i) {
+                if (!((installed_file *)forge_smap_get(old, paths[i]))->seen) {
+                        dyn_array_append(gone, paths[i]);
+                }
+        }
+
+        if (gone.len > 0) {
+                str_array failed = dyn_array_empty(str_array);
+                (void)rmfiles(gone.data, gone.len, skeleton_dirs, NULL, &failed);
+                for (size_t i = 0; i < failed.len; ++i) {
+                        fprintf(stderr, "could not remove %s\n", failed.data[i]);
+                        free(failed.data[i]);
+                }
+                dyn_array_free(failed);
+
+                const char *sql = "DELETE FROM Files WHERE pkg_id = ? AND path = ?;";
+                sqlite3_stmt *stmt = ctx_stmt(ctx, sql);
+                for (size_t i = 0; i < gone.len; ++i) {
+                        sqlite3_bind_int(stmt, 1, pkg_id);
+                        sqlite3_bind_text(stmt, 2, gone.data[i], -1, SQLITE_STATIC);
+                        if (sqlite3_step(stmt) != SQLITE_DONE) {
+                                fprintf(stderr, "Delete error: %s\n", sqlite3_errmsg(ctx->db));
+                        }
+                        sqlite3_reset(stmt);
+                }
+
+                char *count = forge_cstr_of_int(gone.len);
+                info_builder(0, "Removed ", YELLOW, count, RESET, " file(s) that are no longer part of the package\n", NULL);
+                free(count);
+        }
+
+        dyn_array_free(gone); // the strings belong to `paths`
+        free(paths);
+}
+
+// Move the contents of the fakeroot of `st` into the
+// host filesystem and record the package as installed.
+static int
+merge_pkg(forge_context   *ctx,
+          const pkg_stage *st)
+{
+        const char *name = st->name;
+
+        // Ensure pkg_id is available
+        int pkg_id = get_pkg_id(ctx, name);
+        if (pkg_id == -1) {
+                fprintf(stderr, "Failed to find package ID for %s\n", name);
+                return 0;
+        }
+
+        // Walk through fakeroot and move over files.
+        info(1, "Creating manifest\n");
+        manifest_array manifest = dyn_array_empty(manifest_array);
+        str_array conflicts = dyn_array_empty(str_array);
+        str_array owners = dyn_array_empty(str_array);
+        int ok = build_manifest(&manifest, st->fakeroot);
+
+        if (!ok) {
+                goto done;
+        }
+
+        // Check that we are not about to overwrite any
+        // other package's files before touching anything.
+        find_file_conflicts(ctx, pkg_id, &manifest, strlen(st->fakeroot), &conflicts, &owners);
+
+        if (conflicts.len > 0) {
+                int force = (g_config.flags & FT_FORCE) != 0;
+                char *count = forge_cstr_of_int(conflicts.len);
+                info_builder(0, YELLOW BOLD, name, RESET, " has ", YELLOW, count, RESET,
+                             " file(s) owned by other packages\n", NULL);
+                free(count);
+                for (size_t i = 0; i < conflicts.len; ++i) {
+                        printf("* %s (%s)\n", conflicts.data[i], owners.data[i]);
+                }
+
+                if (!force && (g_config.flags & FT_PRETEND) == 0) {
+                        bad(0, "refusing to overwrite them, use --" FLAG_2HY_FORCE " to take them over\n");
+                        ok = 0;
+                        goto done;
+                }
+        }
+
+        if (g_config.flags & FT_PRETEND) {
+                // We are only pretending to install. We do not want to
+                // move the installed files in the fakeroot into the host filesystem.
+                printf(YELLOW BOLD "*" RESET " Pretend installed files to fakeroot [ " YELLOW "%s" RESET " ]:\n", st->fakeroot);
+                for (size_t i = 0; i < manifest.len; ++i) {
+                        printf(YELLOW BOLD "*" RESET "   %s\n", manifest.data[i].path);
+                }
+
+                // Allow the fakeroot to be readable by anyone.
+                if (chmod(st->fakeroot, 0775) == -1)
+                        perror("chmod");
+        } else {
+                // We are not pretending, go ahead and install to host filesystem.
+                // Files are moved instead of copied when the fakeroot is on the
+                // same filesystem and nobody asked to keep it around.
+                copy_ctx cc;
+                if (!copy_ctx_init(&cc, "/", (g_config.flags & FT_KEEP_FAKEROOT) == 0)) {
+                        perror("open(/)");
+                        ok = 0;
+                        goto done;
+                }
+
+                // All of the package's rows are written in one transaction
+                // with a single prepared statement. A failure rolls the rows
+                // back together with the files.
+                db_savepoint(ctx->db, "merge_pkg");
+
+                take_file_ownership(ctx, pkg_id, &conflicts);
+
+                const char *sql_insert =
+                        "INSERT OR REPLACE INTO Files "
+                        "(pkg_id, path, size, mode, mtime, type, hash) "
+                        "VALUES (?, ?, ?, ?, ?, ?, ?);";
+                sqlite3_stmt *ins = ctx_stmt(ctx, sql_insert);
+                int rc;
+
+                // When the package is already installed (an update or a
+                // reinstall), only new and changed files are written
+                // and the files that are gone are removed afterwards,
+                // so the package is never missing in between.
+                forge_smap old = load_installed_files(ctx, pkg_id);
+                size_t unchanged = 0;
+
+                // Keep a list of files we successfully installed for possible rollback.
+                // Files that replace an older version are written next to it and
+                // only renamed over it once the whole package is in. The old
+                // versions are kept aside until then, so that a failure at any
+                // point puts back the old files to match their rows.
+                str_array installed = dyn_array_empty(str_array);
+                str_array replaced = dyn_array_empty(str_array);
+                str_array aside = dyn_array_empty(str_array);
+                size_t renamed = 0;
+
+                // A file of the old version that became a directory
+                // has to make room for it before anything is written
+                // into it. The manifest only has files, so this looks
+                // at the directories they are in.
+                forge_smap dirs = forge_smap_create();
+                for (size_t i = 0; ok && forge_smap_size(&old) > 0 && i < manifest.len; ++i) {
+                        char dir[PATH_MAX];
+                        snprintf(dir, sizeof(dir), "%s", manifest.data[i].path + strlen(st->fakeroot));
+
+                        char *slash;
+                        while (ok && (slash = strrchr(dir, '/')) && slash != dir) {
+                                *slash = '\0';
+                                if (forge_smap_contains(&dirs, dir)) break;
+                                forge_smap_insert(&dirs, dir, (void *)1);
+
+                                installed_file *f = (installed_file *)forge_smap_get(&old, dir);
+                                struct stat cur;
+                                if (f && !f->is_dir && lstat(dir, &cur) == 0 && !S_ISDIR(cur.st_mode)) {
+                                        ok = set_aside(dir, /*move=*/1);
+                                        if (ok) {
+                                                dyn_array_append(aside, strdup(dir));
+                                        }
+                                }
+                        }
+                }
+                forge_smap_destroy(&dirs);
+
+                for (size_t i = 0; ok && i < manifest.len; ++i) {
+                        if (i == 0) putchar('\n');
+
+                        char *fakepath = manifest.data[i].path; // /tmp/pkg-.../usr/bin/foo
+                        char *realpath = fakepath + strlen(st->fakeroot);   // /usr/bin/foo
+
+                        print_file_progress(realpath, i, manifest.len, /*add=*/1);
+
+                        installed_file *prev = (installed_file *)forge_smap_get(&old, realpath);
+                        char hash[SHA256_HEX_SZ] = {0};
+                        if (prev) {
+                                prev->seen = 1;
+                                if (file_unchanged(prev, fakepath, &manifest.data[i].st, realpath, hash)) {
+                                        ++unchanged;
+                                        continue;
+                                }
+                        }
+
+                        // A directory that became a file is staged and moved
+                        // aside with everything in it later on, which must
+                        // not take other packages' files with it.
+                        int is_dir = S_ISDIR(manifest.data[i].st.st_mode);
+                        struct stat cur;
+                        int was_dir = !is_dir && lstat(realpath, &cur) == 0 && S_ISDIR(cur.st_mode);
+                        if (was_dir && dir_has_other_files(ctx, pkg_id, realpath)) {
+                                char *msg = forge_cstr_builder("cannot replace directory ", realpath,
+                                                               " with a file, other packages have files in it\n", NULL);
+                                bad(0, msg); free(msg);
+                                ok = 0;
+                                break;
+                        }
+
+                        char *staged = (prev || was_dir) && !is_dir ? staged_path(realpath) : NULL;
+
+                        if (!copy_file_to_root(&cc, fakepath, &manifest.data[i].st, realpath, staged, ins, pkg_id,
+                                               hash[0] ? hash : NULL)) {
+                                if (staged) {
+                                        unlink(staged);
+                                        free(staged);
+                                }
+                                char *msg = forge_cstr_builder("copy_file_to_root(", fakepath, ", ", realpath, ", db, pkg_id) FAILURE\n", NULL);
+                                bad(1, msg); free(msg);
+                                msg = forge_cstr_builder("failed to install ", realpath, "\n", NULL);
+                                bad(0, msg); free(msg);
+                                ok = 0;
+                                break;
+                        }
+                        if (staged) {
+                                dyn_array_append(replaced, strdup(realpath));
+                                free(staged);
+                        } else if (!prev) {
+                                dyn_array_append(installed, strdup(realpath));
+                        }
+                }
+
+                // Move the staged files over the old ones. A directory
+                // that became a file is moved aside as a whole, since
+                // rename() cannot replace it (EISDIR).
+                for (; ok && renamed < replaced.len; ++renamed) {
+                        const char *realpath = replaced.data[renamed];
+                        struct stat cur;
+                        if (lstat(realpath, &cur) == 0) {
+                                if (!set_aside(realpath, S_ISDIR(cur.st_mode))) {
+                                        ok = 0;
+                                        break;
+                                }
+                                dyn_array_append(aside, strdup(realpath));
+                        } else {
+                                // Removed since it was installed, so there
+                                // is nothing to put back.
+                                dyn_array_append(installed, strdup(realpath));
+                        }
+
+                        char *tmp = staged_path(realpath);
+                        if (rename(tmp, realpath) != 0) {
+                                fprintf(stderr, "could not replace %s: %s\n", realpath, strerror(errno));
+                                ok = 0;
+                        }
+                        free(tmp);
+                        if (!ok) {
+                                break;
+                        }
+                }
+
+                if (!ok) {
+                        undo_merge(&installed, &replaced, renamed, &aside);
+                        bad(0, "removed installed files\n");
+                } else {
+                        for (size_t i = 0; i < aside.len; ++i) {
+                                drop_aside(aside.data[i], &old);
+                        }
+                        if (forge_smap_size(&old) > 0) {
+                                char *count = forge_cstr_of_int(unchanged);
+                                info_builder(0, "Kept ", YELLOW, count, RESET, " unchanged file(s)\n", NULL);
+                                free(count);
+                                remove_vanished_files(ctx, pkg_id, &old);
+                        }
+                }
+
+                free_installed_files(&old);
+                for (size_t i = 0; i < installed.len; ++i) {
+                        free(installed.data[i]);
+                }
+                dyn_array_free(installed);
+                for (size_t i = 0; i < replaced.len; ++i) {
+                        free(replaced.data[i]);
+                }
+                dyn_array_free(replaced);
+                for (size_t i = 0; i < aside.len; ++i) {
+                        free(aside.data[i]);
+                }
+                dyn_array_free(aside);
+                sqlite3_reset(ins);
+                copy_ctx_destroy(&cc);
+
+                if (ok) {
+                        char src_loc[256] = {0};
+                        snprintf(src_loc, sizeof(src_loc), PKG_SOURCE_DIR "/%s", st->pkgname);
+
+                        // A build from the binary cache comes without its
+                        // source, update_pkgs() fetches it when it needs it.
+                        int have_src = access(src_loc, F_OK) == 0;
+
+                        // Update pkg_src_loc in datasrc_loc
+                        const char *sql_update = "UPDATE Pkgs SET pkg_src_loc = ?, installed = 1 WHERE name = ?;";
+                        sqlite3_stmt *stmt = ctx_stmt(ctx, sql_update);
+
+                        if (have_src) {
+                                sqlite3_bind_text(stmt, 1, src_loc, -1, SQLITE_STATIC);
+                        } else {
+                                sqlite3_bind_null(stmt, 1);
+                        }
+                        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+
+                        rc = sqlite3_step(stmt);
+                        if (rc != SQLITE_DONE) {
+                                fprintf(stderr, "Update pkg_src_loc error: %s\n", sqlite3_errmsg(ctx->db));
+                        }
+                        sqlite3_reset(stmt);
+
+                        db_release(ctx->db, "merge_pkg");
+                } else {
+                        db_rollback_to(ctx->db, "merge_pkg");
+                }
+        }
+
+ done:
+        for (size_t i = 0; i < conflicts.len; ++i) {
+                free(conflicts.data[i]);
+                free(owners.data[i]);
+        }
+        dyn_array_free(conflicts);
+        dyn_array_free(owners);
+
+        // Destroy manifest
+        for (size_t i = 0; i < manifest.len; ++i) {
+                free(manifest.data[i].path);
+        } dyn_array_free(manifest);
+
+        return ok;
+}
+
+// Where an entry of an install plan is at.
+typedef enum {
+        PLAN_QUEUED = 0, // waiting for its turn to be fetched
+        PLAN_FETCHING,
+        PLAN_FETCHED,    // waiting on its dependencies to be merged
+        PLAN_BUILDING,
+        PLAN_DONE,       // merged, or failed
+} plan_state;
+
+// One entry of an install plan.
+typedef struct {
+        pkg_stage    st;
+        int          is_explicit;
+        plan_state   state;
+        size_t       pending;    // dependencies in the plan that are not merged yet
+        size_t_array dependents; // plan indices waiting on this entry
+        pid_t        pid;        // fetch or build child
+        int          fd;         // read end of the status pipe
+        char        *log;
+        int          has_slot;   // holds a jobserver slot for its build
+        int64_t      critical;   // estimated ms from its build until everything after it is built
+} plan_entry;
+
+DYN_ARRAY_TYPE(plan_entry, plan_entry_array);
+
+// Collect `id` and everything it transitively needs into `plan`,
+// dependencies first. `at` maps depgraph ids to plan indices.
+static void
+__plan_pkgs(forge_context    *ctx,
+            plan_entry_array *plan,
+            ssize_t          *at,
+            size_t            id,
+            int               is_explicit)
+{
+        // at[id]: -1 = not seen, -2 = installed dependency,
+        // -3 = being planned (a dependency cycle), else plan index.
+        if (at[id] >= 0) {
+                if (is_explicit) {
+                        plan->data[at[id]].is_explicit = 1;
+                }
+                return;
+        }
+        if (at[id] == -3 || (at[id] == -2 && !is_explicit)) {
+                return;
+        }
+
+        const char *name = ctx->dg.names[id];
+
+        if (!is_explicit && pkg_is_installed(ctx, name)) {
+                info_builder(0, "Dependency ", YELLOW BOLD, name, RESET, " is already installed\n", NULL);
+                at[id] = -2;
+                return;
+        }
+
+        at[id] = -3;
+
+        if ((g_config.flags & FT_ONLY) == 0) {
+                for (size_t i = ctx->dg.offsets[id]; i < ctx->dg.offsets[id + 1]; ++i) {
+                        __plan_pkgs(ctx, plan, at, ctx->dg.targets[i], /*is_explicit=*/0);
+                }
+        }
+
+        plan_entry e = (plan_entry) {
+                .st = (pkg_stage) {
+                        .name = name,
+                        .m = modindex_find(&ctx->mi, name),
+                },
+                .is_explicit = is_explicit,
+                .state = PLAN_QUEUED,
+                .pending = 0,
+                .dependents = dyn_array_empty(size_t_array),
+                .pid = -1,
+                .fd = -1,
+                .log = NULL,
+                .has_slot = 0,
+                .critical = 0,
+        };
+        assert(e.st.m);
+
+        at[id] = (ssize_t)plan->len;
+        dyn_array_append(*plan, e);
+}
+
+// What the child of spawn_stage() sends back to forge.
+typedef struct {
+        int        downloaded;
+        phase_stat phases[PHASE__COUNT];
+        char       pkgname[256];
+} stage_report;
+
+// Run `stage` (fetch_pkg() or build_pkg()) for `e` in a child
+// process with its output going to `e->log`. Without a log the
+// child keeps forge's terminal, so the build can be watched and
+// the module can prompt. The child reports
+// the source directory it used and how long each phase took
+// back through a pipe.
+static int
+spawn_stage(plan_entry *e,
+            int       (*stage)(pkg_stage *, const char *),
+            const char *pkg_src_loc)
+{
+        int fds[2];
+        if (pipe(fds) == -1) {
+                perror("pipe");
+                return 0;
+        }
+
+        fflush(stdout);
+        fflush(stderr);
+
+        pid_t pid = fork();
+        if (pid == -1) {
+                perror("fork");
+                close(fds[0]);
+                close(fds[1]);
+                return 0;
+        }
+
+        if (pid == 0) {
+                close(fds[0]);
+
+                if (e->log) {
+                        int logfd = open(e->log, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                        if (logfd != -1) {
+                                dup2(logfd, STDOUT_FILENO);
+                                dup2(logfd, STDERR_FILENO);
+                                close(logfd);
+                        }
+                        int devnull = open("/dev/null", O_RDONLY);
+                        if (devnull != -1) {
+                                dup2(devnull, STDIN_FILENO);
+                                close(devnull);
+                        }
+                }
+
+                g_fakeroot = e->st.fakeroot;
+                int ok = stage(&e->st, pkg_src_loc);
+
+                stage_report report = {0};
+                report.downloaded = e->st.downloaded;
+                memcpy(report.phases, e->st.phases, sizeof(report.phases));
+                if (e->st.pkgname) {
+                        snprintf(report.pkgname, sizeof(report.pkgname), "%s", e->st.pkgname);
+                }
+                if (write(fds[1], &report, sizeof(report)) != (ssize_t)sizeof(report)) {
+                        ok = 0;
+                }
+
+                fflush(NULL);
+                _exit(ok ? 0 : 1);
+        }
+
+        close(fds[1]);
+
+        e->pid = pid;
+        e->fd = fds[0];
+
+        return 1;
+}
+
+// Read back what the child of `e` reported.
+static void
+reap_stage(plan_entry *e)
+{
+        stage_report report;
+        size_t n = 0;
+        ssize_t r;
+
+        while (n < sizeof(report) && (r = read(e->fd, (char *)&report + n, sizeof(report) - n)) > 0) {
+                n += (size_t)r;
+        }
+        close(e->fd);
+        e->fd = -1;
+        e->pid = -1;
+
+        if (n != sizeof(report)) return;
+
+        e->st.downloaded |= report.downloaded;
+        report.pkgname[sizeof(report.pkgname) - 1] = '\0';
+        if (report.pkgname[0] && !e->st.pkgname) {
+                e->st.pkgname = strdup(report.pkgname);
+        }
+        for (int i = 0; i < PHASE__COUNT; ++i) {
+                if (report.phases[i].ran) {
+                        e->st.phases[i] = report.phases[i];
+                }
+        }
+}
+
+// Start fetching the source of `e` in the background, unless
+// there is nothing to fetch. With a single job everything runs
+// in the foreground, one package after the other, so the build
+// fetches its own source. Returns 1 if a child was started.
+static int
+start_fetch(forge_context *ctx,
+            plan_entry    *e,
+            size_t         jobs)
+{
+        e->state = PLAN_FETCHED;
+
+        if (jobs <= 1) {
+                return 0;
+        }
+
+        // A cached build does not need its source.
+        if (e->st.cache_key && !g_config.refresh_cache
+            && binpkg_has(e->st.name, e->st.cache_key)) {
+                return 0;
+        }
+
+        char *pkg_src_loc = get_pkg_src_loc(ctx, e->st.name);
+        if (pkg_src_loc && access(pkg_src_loc, F_OK) == 0) {
+                free(pkg_src_loc);
+                return 0;
+        }
+
+        char tmpl[256] = {0};
+        snprintf(tmpl, sizeof(tmpl), "/tmp/fetch-%s-XXXXXX.log", e->st.name);
+        int fd = mkstemps(tmpl, 4);
+        if (fd == -1) {
+                // The build fetches the source itself.
+                free(pkg_src_loc);
+                return 0;
+        }
+        close(fd);
+        e->log = strdup(tmpl);
+
+        int ok = spawn_stage(e, fetch_pkg, pkg_src_loc);
+        free(pkg_src_loc);
+
+        if (!ok) {
+                unlink(e->log);
+                free(e->log);
+                e->log = NULL;
+                return 0;
+        }
+
+        e->state = PLAN_FETCHING;
+        info_builder(0, "Fetching ", YELLOW BOLD, e->st.name, RESET, " [log: ", e->log, "]\n", NULL);
+
+        return 1;
+}
+
+// Build one plan entry in a child process. Concurrent builds
+// write to a log, a build of its own keeps the terminal.
+static int
+spawn_build(forge_context *ctx,
+            plan_entry    *e,
+            size_t         jobs)
+{
+        char *pkg_src_loc = get_pkg_src_loc(ctx, e->st.name);
+
+        sandbox(e->st.name);
+        e->st.fakeroot = g_fakeroot;
+        g_fakeroot = NULL;
+        if (jobs > 1) {
+                e->log = forge_cstr_builder(e->st.fakeroot, ".log", NULL);
+        }
+
+        int ok = spawn_stage(e, build_pkg, pkg_src_loc);
+        free(pkg_src_loc);
+
+        if (!ok) {
+                return 0;
+        }
+
+        e->state = PLAN_BUILDING;
+        if (e->log) {
+                info_builder(0, "Building ", YELLOW BOLD, e->st.name, RESET, " [log: ", e->log, "]\n", NULL);
+        }
+
+        return 1;
+}
+
+// Start building every entry that is fetched and whose
+// dependencies are merged, as long as there are free slots.
+// Entries on the longest remaining chain of builds go first.
+// The first build runs on the implicit jobserver slot, every
+// other one has to take a slot out of the shared pool, so that
+// N builds each running `make -jM` cannot oversubscribe the CPU.
+static int
+start_builds(forge_context    *ctx,
+             plan_entry_array *plan,
+             size_t            jobs,
+             size_t           *building)
+{
+        while (*building < jobs) {
+                plan_entry *e = NULL;
+                for (size_t i = 0; i < plan->len; ++i) {
+                        plan_entry *c = &plan->data[i];
+                        if (c->state != PLAN_FETCHED || c->pending != 0) {
+                                continue;
+                        }
+                        if (!e || c->critical > e->critical) {
+                                e = c;
+                        }
+                }
+                if (!e) {
+                        break;
+                }
+
+                // Cached builds are only unpacked and do not need a slot.
+                int cached = e->st.cache_key && !g_config.refresh_cache
+                        && binpkg_has(e->st.name, e->st.cache_key);
+
+                if (*building > 0 && !cached && jobserver_active()) {
+                        if (!jobserver_try_acquire()) {
+                                break; // the pool is busy, wait for something to finish
+                        }
+                        e->has_slot = 1;
+                }
+
+                if (!spawn_build(ctx, e, jobs)) {
+                        if (e->has_slot) {
+                                jobserver_release();
+                                e->has_slot = 0;
+                        }
+                        return 0;
+                }
+                ++*building;
+        }
+        return 1;
+}
+
+// Estimate, for every entry of `plan`, how long it takes from
+// starting its build until everything that depends on it is
+// built, using the recorded build times. Packages without any
+// history count as an average one.
+static void
+compute_critical_paths(forge_context    *ctx,
+                       plan_entry_array *plan)
+{
+        int64_t known = 0;
+        size_t nknown = 0;
+
+        for (size_t i = 0; i < plan->len; ++i) {
+                plan_entry *e = &plan->data[i];
+
+                // A cached build is only unpacked.
+                if (e->st.cache_key && !g_config.refresh_cache
+                    && binpkg_has(e->st.name, e->st.cache_key)) {
+                        e->critical = 0;
+                        continue;
+                }
+
+                e->critical = estimate_pkg_ms(ctx, e->st.name);
+                if (e->critical >= 0) {
+                        known += e->critical;
+                        ++nknown;
+                }
+        }
+
+        int64_t fallback = nknown > 0 ? known / (int64_t)nknown : 1000;
+
+        // Dependents always come after their dependencies in the plan.
+        for (size_t i = plan->len; i-- > 0;) {
+                plan_entry *e = &plan->data[i];
+                int64_t longest = 0;
+
+                for (size_t j = 0; j < e->dependents.len; ++j) {
+                        int64_t c = plan->data[e->dependents.data[j]].critical;
+                        if (c > longest) longest = c;
+                }
+                e->critical = (e->critical < 0 ? fallback : e->critical) + longest;
+        }
+}
+
+static void
+record_build_stats(forge_context    *ctx,
+                   const plan_entry *e,
+                   size_t            jobs)
+{
+        if (!buildstats_record(ctx->db, e->st.name, e->st.m->ver, jobs, e->st.phases)) {
+                fprintf(stderr, "could not record build times of %s: %s\n",
+                        e->st.name, sqlite3_errmsg(ctx->db));
+        }
+}
+
+// Install `names` and all of their dependencies as a pipeline.
+// Sources are fetched ahead of time (in build order), up to `jobs`
+// packages that do not depend on each other are built at the same
+// time, and each finished build is merged into `/` while the next
+// ones keep building. Only the merge and the database writes are
+// serialized.
+static int
+install_pkgs_pipelined(forge_context *ctx,
+                       str_array      names,
+                       size_t         jobs)
+{
+        plan_entry_array plan = dyn_array_empty(plan_entry_array);
+
+        depgraph_freeze(&ctx->dg);
+
+        ssize_t *at = (ssize_t *)malloc((ctx->dg.len + 1) * sizeof(ssize_t));
+        for (size_t i = 0; i < ctx->dg.len; ++i) {
+                at[i] = -1;
+        }
+
+        for (size_t i = 0; i < names.len; ++i) {
+                ssize_t id = depgraph_find(&ctx->dg, names.data[i]);
+                if (id == -1 || get_pkg_id(ctx, names.data[i]) == -1) {
+                        forge_err_wargs("unregistered package `%s`", names.data[i]);
+                }
+                __plan_pkgs(ctx, &plan, at, (size_t)id, /*is_explicit=*/1);
+        }
+
+        // Register everything up front and wire up the dependents.
+        for (size_t i = 0; i < plan.len; ++i) {
+                plan_entry *e = &plan.data[i];
+
+                if (!modindex_load_pkg(e->st.m)) {
+                        forge_err_wargs("could not load module for package `%s`", e->st.name);
+                }
+
+                register_pkg(ctx, e->st.m, e->is_explicit);
+                e->st.cache_key = get_cache_key(ctx, e->st.m);
+
+                if (g_config.flags & FT_ONLY) continue;
+
+                ssize_t id = depgraph_find(&ctx->dg, e->st.name);
+                for (size_t j = ctx->dg.offsets[id]; j < ctx->dg.offsets[id + 1]; ++j) {
+                        ssize_t dep = at[ctx->dg.targets[j]];
+                        if (dep >= 0 && (size_t)dep != i) {
+                                dyn_array_append(plan.data[dep].dependents, i);
+                                ++e->pending;
+                        }
+                }
+        }
+
+        for (size_t i = 0; i < plan.len; ++i) {
+                const plan_entry *e = &plan.data[i];
+                if ((g_config.flags & FT_ONLY) == 0 && e->st.m->deps.len > 0) {
+                        if (!record_pkg_deps(ctx, e->st.name, &e->st.m->deps)) {
+                                free(at);
+                                return 0;
+                        }
+                }
+        }
+
+        free(at);
+
+        compute_critical_paths(ctx, &plan);
+
+        // Every make started from here on shares one pool of job slots.
+        (void)jobserver_init(jobserver_budget());
+
+        size_t next_fetch = 0, fetching = 0, building = 0, merged = 0;
+        int failed = 0;
+
+        while (merged < plan.len) {
+                while (!failed && fetching < jobs && next_fetch < plan.len) {
+                        if (start_fetch(ctx, &plan.data[next_fetch++], jobs)) {
+                                ++fetching;
+                        }
+                }
+                if (!failed && !start_builds(ctx, &plan, jobs, &building)) {
+                        failed = 1;
+                }
+
+                if (fetching + building == 0) {
+                        break;
+                }
+
+                int status = 0;
+                pid_t pid = waitpid(-1, &status, 0);
+                if (pid == -1) {
+                        if (errno == EINTR) continue;
+                        perror("waitpid");
+                        failed = 1;
+                        break;
+                }
+
+                plan_entry *e = NULL;
+                for (size_t i = 0; i < plan.len; ++i) {
+                        if (plan.data[i].pid == pid) {
+                                e = &plan.data[i];
+                                break;
+                        }
+                }
+                if (!e) continue;
+
+                reap_stage(e);
+                int child_ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
 
-                        // Allow the fakeroot to be readable by anyone.
-                        if (chmod(g_fakeroot, 0775) == -1)
-                                perror("chmod");
-                } else {
-                        // We are not pretending, go ahead and install to host filesystem.
-                        // Keep a list of files we successfully installed for possible rollback.
-                        str_array installed = dyn_array_empty(str_array);
-                        for (size_t i = 0; i < manifest.len; ++i) {
-                                if (i == 0) putchar('\n');
-
-                                char *fakepath = manifest.data[i]; // /tmp/pkg-.../usr/bin/foo
-                                char *realpath = fakepath + strlen(g_fakeroot);   // /usr/bin/foo
-
-                                print_file_progress(realpath, i, manifest.len, /*add=*/1);
-
-                                if (!copy_file_to_root(fakepath, realpath, ctx->db, pkg_id)) {
-                                        /* remove everything we already copied */
-                                        for (size_t j = 0; j < installed.len; ++j) {
-                                                print_file_progress(installed.data[j], j, installed.len, /*add=*/0);
-                                                unlink(installed.data[j]);
-                                                free(installed.data[j]);
-                                        }
-                                        dyn_array_free(installed);
-                                        char *msg = forge_cstr_builder("copy_file_to_root(", fakepath, ", ", realpath, ", db, pkg_id) FAILURE\n", NULL);
-                                        bad(1, msg); free(msg);
-                                        bad(0, "removed installed files\n");
-                                        msg = forge_cstr_builder("failed to install ", realpath, "\n", NULL);
-                                        bad(0, msg); free(msg);
-                                        goto bad;
-                                }
-                                dyn_array_append(installed, strdup(realpath));
+                if (e->state == PLAN_FETCHING) {
+                        --fetching;
+                        e->state = PLAN_FETCHED;
+                        if (child_ok) {
+                                unlink(e->log);
+                        } else {
+                                // Some downloads need a dependency to be installed
+                                // first. The build will try again once they are.
+                                info_builder(0, "Could not fetch ", YELLOW BOLD, e->st.name, RESET,
+                                             " ahead of time, retrying before building it [log: ", e->log, "]\n", NULL);
                         }
-                        dyn_array_free(installed);
+                        free(e->log);
+                        e->log = NULL;
+                        continue;
                 }
 
-                // Destroy manifest
-                for (size_t i = 0; i < manifest.len; ++i) {
-                        free(manifest.data[i]);
-                } dyn_array_free(manifest);
+                --building;
+                e->state = PLAN_DONE;
+                if (e->has_slot) {
+                        jobserver_release();
+                        e->has_slot = 0;
+                }
 
-                if ((g_config.flags & FT_PRETEND) == 0) {
-                        // Update pkg_src_loc in datasrc_loc
-                        const char *sql_update = "UPDATE Pkgs SET pkg_src_loc = ?, installed = 1 WHERE name = ?;";
-                        rc = sqlite3_prepare_v2(ctx->db, sql_update, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx->db);
+                // Fill the slot this build just freed up before merging,
+                // so the merge overlaps with the next build.
+                if (child_ok && !failed && !start_builds(ctx, &plan, jobs, &building)) {
+                        failed = 1;
+                }
 
-                        sqlite3_bind_text(stmt, 1, src_loc, -1, SQLITE_STATIC);
-                        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+                // The merge (and fakeroot cleanup) happens here in forge,
+                // one package at a time, while the other builds keep going.
+                g_fakeroot = e->st.fakeroot;
+                e->st.fakeroot = NULL;
 
-                        rc = sqlite3_step(stmt);
-                        if (rc != SQLITE_DONE) {
-                                fprintf(stderr, "Update pkg_src_loc error: %s\n", sqlite3_errmsg(ctx->db));
+                if (!child_ok) {
+                        char *msg = e->log
+                                ? forge_cstr_builder("failed to build ", e->st.name, ", see ", e->log, "\n", NULL)
+                                : forge_cstr_builder("failed to build ", e->st.name, "\n", NULL);
+                        bad(1, msg);
+                        free(msg);
+                        if (e->st.downloaded && e->st.pkgname) {
+                                bad(1, "Removing source due to installation failure\n");
+                                remove_pkg_source(e->st.pkgname);
                         }
-                        sqlite3_finalize(stmt);
+                        record_build_stats(ctx, e, jobs);
+                        destroy_fakeroot();
+                        failed = 1;
+                        continue;
                 }
 
-                free(pkg_src_loc);
+                char *current = forge_cstr_of_int(merged + 1);
+                char *outof = forge_cstr_of_int(plan.len);
+                info_builder(0, "Installing ", BOLD BRIGHT_PINK, e->is_explicit ? "package " : "dependency ", RESET,
+                             YELLOW BOLD, e->st.name, RESET, " [", YELLOW, current, RESET, "/",
+                             YELLOW, outof, RESET, "]\n", NULL);
+                free(current);
+                free(outof);
+
+                e->st.fakeroot = g_fakeroot;
+                phase_timer t;
+                phase_begin(&t);
+                int merge_ok = merge_pkg(ctx, &e->st);
+                if ((g_config.flags & FT_PRETEND) == 0) {
+                        phase_end(&t, merge_ok, &e->st.phases[PHASE_MERGE]);
+                }
+                record_build_stats(ctx, e, jobs);
+                if (!merge_ok) {
+                        e->st.fakeroot = NULL;
+                        destroy_fakeroot();
+                        failed = 1;
+                        continue;
+                }
+                e->st.fakeroot = NULL;
 
-                char *succ_msg = forge_cstr_builder("Successfully installed ", YELLOW BOLD, name, RESET, "\n", NULL);
+                char *succ_msg = forge_cstr_builder("Successfully installed ", YELLOW BOLD, e->st.name, RESET, "\n", NULL);
                 good(1, succ_msg);
                 free(succ_msg);
 
                 destroy_fakeroot();
+                if (e->log) {
+                        unlink(e->log);
+                }
 
                 if (g_config.flags & FT_PRETEND) {
-                        remove_pkg_source(pkgname);
+                        remove_pkg_source(e->st.pkgname);
+                }
+
+                ++merged;
+
+                for (size_t i = 0; i < e->dependents.len; ++i) {
+                        --plan.data[e->dependents.data[i]].pending;
                 }
         }
 
-        display_pkg_msgs(ctx, names);
-        display_pkg_suggested(ctx, names);
+        int ok = !failed && merged == plan.len;
+
+        for (size_t i = 0; i < plan.len; ++i) {
+                free(plan.data[i].st.pkgname);
+                free(plan.data[i].st.cache_key);
+                free(plan.data[i].log);
+                dyn_array_free(plan.data[i].dependents);
+        }
+        dyn_array_free(plan);
+
+        return ok;
+}
+
+static int
+install_pkg(forge_context *ctx,
+            str_array      names,
+            int            skip_ask)
+{
+        assert_sudo();
+
+        if (!skip_ask) {
+                info(0, "To be installed:\n");
+                list_to_be_installed(ctx, names);
+        }
+
+        int ok = install_pkgs_pipelined(ctx, names, g_config.jobs ? g_config.jobs : 1);
 
-        return 1;
- bad:
         // TODO: display pkg msgs and suggested *only up until* the failed one.
         display_pkg_msgs(ctx, names);
         display_pkg_suggested(ctx, names);
 
-        if (failed_pkgname) {
-                bad(1, "Removing source due to installation failure\n");
-                remove_pkg_source(failed_pkgname);
-                destroy_fakeroot();
-        }
-        return 0;
+        return ok;
 }
 
-static int
-is_required_dependency(forge_context *ctx,
-                       const char    *name)
+// Collect every installed package that no explicitly installed
+// package needs, directly or through other dependencies. The
+// result is ordered so that a package always comes before the
+// packages it depends on, which is the order to remove them in.
+static void
+get_orphan_pkgs(forge_context *ctx,
+                str_array     *out)
 {
         sqlite3_stmt *stmt;
-        const char *sql = "SELECT COUNT(*) FROM Deps d "
-                "JOIN Pkgs p ON d.pkg_id = p.id "
-                "WHERE d.dep_id = (SELECT id FROM Pkgs WHERE name = ?) "
-                "AND p.installed = 1;";
+        const char *sql =
+                "WITH RECURSIVE "
+                "needed(id) AS ("
+                "    SELECT id FROM Pkgs WHERE installed = 1 AND is_explicit = 1 "
+                "    UNION "
+                "    SELECT d.dep_id FROM Deps d JOIN needed n ON d.pkg_id = n.id"
+                "), "
+                "orphans(id) AS ("
+                "    SELECT id FROM Pkgs "
+                "    WHERE installed = 1 AND id NOT IN (SELECT id FROM needed)"
+                "), "
+                // Longest path from any orphan. A dependency is always
+                // deeper than its dependents; the bound stops cycles.
+                "depth(id, level) AS ("
+                "    SELECT id, 0 FROM orphans "
+                "    UNION "
+                "    SELECT d.dep_id, depth.level + 1 FROM depth "
+                "    JOIN Deps d ON d.pkg_id = depth.id "
+                "    WHERE d.dep_id IN (SELECT id FROM orphans) "
+                "    AND depth.level < (SELECT COUNT(*) FROM orphans)"
+                ") "
+                "SELECT p.name FROM depth JOIN Pkgs p ON p.id = depth.id "
+                "GROUP BY depth.id ORDER BY MAX(depth.level), p.name;";
         int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
         CHECK_SQLITE(rc, ctx->db);
 
-        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-
-        int count = 0;
-        if (sqlite3_step(stmt) == SQLITE_ROW) {
-                count = sqlite3_column_int(stmt, 0);
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                const char *name = (const char *)sqlite3_column_text(stmt, 0);
+                dyn_array_append(*out, strdup(name));
+        }
+        if (rc != SQLITE_DONE) {
+                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(ctx->db));
         }
 
         sqlite3_finalize(stmt);
-        return count > 0;
 }
 
 static void
@@ -1735,20 +3341,10 @@ clean_pkgs(forge_context *ctx)
 {
         info(0, "Cleaning unneeded dependency packages\n");
 
-        // Get all installed dependency packages
+        // Get all dependency packages that are no longer needed,
+        // including the ones only needed by other unneeded packages.
         str_array pkgs_to_remove = dyn_array_empty(str_array);
-        sqlite3_stmt *stmt;
-        const char *sql = "SELECT name FROM Pkgs WHERE installed = 1 AND is_explicit = 0;";
-        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, ctx->db);
-
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *name = (const char *)sqlite3_column_text(stmt, 0);
-                if (!is_required_dependency(ctx, name)) {
-                        dyn_array_append(pkgs_to_remove, strdup(name));
-                }
-        }
-        sqlite3_finalize(stmt);
+        get_orphan_pkgs(ctx, &pkgs_to_remove);
 
         if (pkgs_to_remove.len == 0) {
                 info(0, "No unneeded dependency packages found.\n");
@@ -1766,216 +3362,200 @@ clean_pkgs(forge_context *ctx)
         dyn_array_free(pkgs_to_remove);
 }
 
-static void
-show_pkg_deps(str_array names)
+// The columns that list, search and deps show for a package.
+#define PKG_COLS                                                \
+        "Pkgs.name AS name, Pkgs.version AS version, "          \
+        "Pkgs.description AS description, Pkgs.installed AS installed"
+
+// The number of rows and the widths of PKG_COLS over them, in
+// bytes as printf() counts them.
+#define PKG_WIDTHS                                                      \
+        "COUNT(*), MAX(length(CAST(Pkgs.name AS BLOB))), "              \
+        "MAX(length(CAST(Pkgs.version AS BLOB))), "                     \
+        "MAX(length(CAST(IFNULL(Pkgs.description, '(none)') AS BLOB)))"
+
+// Prepare "SELECT `cols` `from`" with `param` (if any) bound
+// to ?1.
+static sqlite3_stmt *
+prepare_select(sqlite3    *db,
+               const char *cols,
+               const char *from,
+               const char *param)
 {
-        for (size_t i = 0; i < names.len; ++i) {
-                const char *pkg_name = names.data[i];
-
-                sqlite3 *db;
-                int rc = sqlite3_open_v2(DATABASE_FP, &db, SQLITE_OPEN_READONLY, NULL);
-                CHECK_SQLITE(rc, db);
+        char *sql = forge_cstr_builder("SELECT ", cols, " ", from, ";", NULL);
+        sqlite3_stmt *stmt;
+        int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+        free(sql);
+        CHECK_SQLITE(rc, db);
 
-                sqlite3_stmt *stmt;
-                const char *sql =
-                        "SELECT Pkgs.name, Pkgs.version, Pkgs.description, Pkgs.installed "
-                        "FROM Deps "
-                        "JOIN Pkgs ON Deps.dep_id = Pkgs.id "
-                        "WHERE Deps.pkg_id = (SELECT id FROM Pkgs WHERE name = ?);";
-                rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, db);
+        if (param) {
+                sqlite3_bind_text(stmt, 1, param, -1, SQLITE_STATIC);
+        }
 
-                sqlite3_bind_text(stmt, 1, pkg_name, -1, SQLITE_STATIC);
+        return stmt;
+}
 
-                // Collect data and calculate max widths
-                pkg_info_array rows = dyn_array_empty(pkg_info_array);
-                size_t max_name_len = strlen("Name");
-                size_t max_version_len = strlen("Version");
-                size_t max_installed_len = strlen("Installed");
-                size_t max_desc_len = strlen("Description");
+// Write every row of `stmt` to `o` as it is read. Returns
+// the number of rows.
+static size_t
+stream_rows(output       *o,
+            sqlite3_stmt *stmt)
+{
+        size_t n = 0;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                output_stmt_row(o, stmt);
+                ++n;
+        }
+        if (rc != SQLITE_DONE) {
+                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(sqlite3_db_handle(stmt)));
+        }
+        return n;
+}
 
-                while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-                        pkg_info info = {0};
-                        const char *name = (const char *)sqlite3_column_text(stmt, 0);
-                        const char *version = (const char *)sqlite3_column_text(stmt, 1);
-                        const char *description = (const char *)sqlite3_column_text(stmt, 2);
-                        int installed = sqlite3_column_int(stmt, 3);
+// Show the packages `from` some tables (see prepare_select()).
+// In table format the title is up to the caller, this prints
+// the column headers and the rows. The widths come from one
+// aggregate query, so that rows can be printed straight off
+// the cursor. Returns the number of packages.
+static size_t
+show_pkg_rows(sqlite3    *db,
+              output     *o,
+              const char *cols,
+              const char *from,
+              const char *param,
+              int         color)
+{
+        sqlite3_stmt *stmt = prepare_select(db, cols, from, param);
+        size_t n = 0;
 
-                        info.name = strdup(name ? name : "");
-                        info.version = strdup(version ? version : "");
-                        info.description = strdup(description ? description : "(none)");
-                        info.installed = installed;
+        if (o->fmt != OUTPUT_TABLE) {
+                n = stream_rows(o, stmt);
+                sqlite3_finalize(stmt);
+                return n;
+        }
 
-                        max_name_len = MAX(max_name_len, strlen(info.name));
-                        max_version_len = MAX(max_version_len, strlen(info.version));
-                        max_desc_len = MAX(max_desc_len, strlen(info.description));
-                        max_installed_len = MAX((int)max_installed_len, snprintf(NULL, 0, "%d", installed));
+        sqlite3_stmt *widths = prepare_select(db, PKG_WIDTHS, from, param);
+        int name_w = strlen("Name"), version_w = strlen("Version");
+        int installed_w = strlen("Installed"), desc_w = strlen("Description");
+        if (sqlite3_step(widths) == SQLITE_ROW) {
+                n = (size_t)sqlite3_column_int64(widths, 0);
+                name_w = MAX(name_w, sqlite3_column_int(widths, 1));
+                version_w = MAX(version_w, sqlite3_column_int(widths, 2));
+                desc_w = MAX(desc_w, sqlite3_column_int(widths, 3));
+        }
+        sqlite3_finalize(widths);
 
-                        dyn_array_append(rows, info);
-                }
+        printf("%-*s  %-*s  %*s  %-*s\n",
+               name_w, "Name", version_w, "Version",
+               installed_w, "Installed", desc_w, "Description");
+        printf("%-*s  %-*s  %*s  %-*s\n",
+               name_w, "----", version_w, "-------",
+               installed_w, "---------", desc_w, "-----------");
 
-                if (rc != SQLITE_DONE) {
-                        fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
+        // The package columns are the last four.
+        int c = sqlite3_column_count(stmt) - 4;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                const char *name = (const char *)sqlite3_column_text(stmt, c);
+                const char *version = (const char *)sqlite3_column_text(stmt, c+1);
+                const char *description = (const char *)sqlite3_column_text(stmt, c+2);
+                int installed = sqlite3_column_int(stmt, c+3);
+
+                char ins[16] = {0};
+                if (installed != 0 && installed != 1) {
+                        // Shouldn't ever reach this
+                        snprintf(ins, sizeof(ins), "%d", installed);
+                } else {
+                        snprintf(ins, sizeof(ins), "%s", installed ? "Yes" : "No");
                 }
 
-                sqlite3_finalize(stmt);
-                sqlite3_close(db);
+                if (!name)        name = "";
+                if (!version)     version = "";
+                if (!description) description = "(none)";
 
-                // Print header
-                info_builder(0, "Dependencies for package ", YELLOW BOLD, pkg_name, RESET "\n", NULL);
-                printf("%-*s  %-*s  %*s  %-*s\n",
-                       (int)max_name_len, "Name",
-                       (int)max_version_len, "Version",
-                       (int)max_installed_len, "Installed",
-                       (int)max_desc_len, "Description");
-                printf("%-*s  %-*s  %*s  %-*s\n",
-                       (int)max_name_len, "----",
-                       (int)max_version_len, "-------",
-                       (int)max_installed_len, "---------",
-                       (int)max_desc_len, "-----------");
-
-                // Print rows
-                if (rows.len == 0) {
-                        info_builder(0, "No dependencies found for package ", YELLOW BOLD, pkg_name, RESET "\n", NULL);
-                } else {
-                        for (size_t i = 0; i < rows.len; ++i) {
-                                pkg_info *info = &rows.data[i];
-                                forge_str ins_fs = forge_str_create();
-
-                                if(info->installed != 0 && info->installed != 1) {
-                                        // Shouldn't ever reach this
-                                        char *ins = forge_cstr_of_int(info->installed);
-                                        forge_str_concat(&ins_fs, ins);
-                                        free(ins);
-                                } else {
-                                        forge_str_concat(&ins_fs,
-                                                        info->installed ? "Yes" : "No");
-                                }
+                if (!color) {
+                        printf("%-*s  %-*s  %*s  %-*s\n",
+                               name_w, name, version_w, version,
+                               installed_w, ins, desc_w, description);
+                        continue;
+                }
 
-                                printf("%-*s  %-*s  %*s  %-*s\n",
-                                       (int)max_name_len, info->name,
-                                       (int)max_version_len, info->version,
-                                       (int)max_installed_len, ins_fs.data,
-                                       (int)max_desc_len, info->description);
+                const char *ins_pfx = installed != 0 && installed != 1 ? BOLD RED
+                        : installed ? BOLD GREEN : DIM GRAY;
 
-                                forge_str_destroy(&ins_fs);
-                        }
-                }
+                printf("%s%-*s%s  %s%-*s%s  %s%*s%s  %s%-*s%s\n",
+                       YELLOW,  name_w,      name,        RESET,
+                       GRAY,    version_w,   version,     RESET,
+                       ins_pfx, installed_w, ins,         RESET,
+                       PINK,    desc_w,      description, RESET);
+        }
 
-                // Clean up
-                for (size_t i = 0; i < rows.len; ++i) {
-                        free(rows.data[i].name);
-                        free(rows.data[i].version);
-                        free(rows.data[i].description);
-                }
-                dyn_array_free(rows);
+        if (rc != SQLITE_DONE) {
+                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
         }
+
+        sqlite3_finalize(stmt);
+        return n;
 }
 
 static void
-list_pkgs(const forge_context *ctx)
+show_pkg_deps(str_array names)
 {
-        (void)ctx;
-
         sqlite3 *db;
-        int rc = sqlite3_open_v2(DATABASE_FP, &db, SQLITE_OPEN_READONLY, NULL);
-        CHECK_SQLITE(rc, db);
-
-        sqlite3_stmt *stmt;
-        const char *sql = "SELECT name, version, description, installed FROM Pkgs;";
-        rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+        int rc = open_db_readonly(&db);
         CHECK_SQLITE(rc, db);
 
-        // Collect data and calculate max widths
-        pkg_info_array rows = dyn_array_empty(pkg_info_array);
-        size_t max_name_len = strlen("Name");
-        size_t max_version_len = strlen("Version");
-        size_t max_installed_len = strlen("Installed");
-        size_t max_desc_len = strlen("Description");
-
-        // Find out max lengths
-        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-                pkg_info info = {0};
-                const char *name = (const char *)sqlite3_column_text(stmt, 0);
-                const char *version = (const char *)sqlite3_column_text(stmt, 1);
-                const char *description = (const char *)sqlite3_column_text(stmt, 2);
-                int installed = sqlite3_column_int(stmt, 3);
+        output o;
+        output_begin(&o, g_config.format);
 
-                info.name = strdup(name ? name : "");
-                info.version = strdup(version ? version : "");
-                info.description = strdup(description ? description : "(none)");
-                info.installed = installed;
+        // Only machine-readable rows need to say whose
+        // dependency they are, tables have a title instead.
+        const char *cols = o.fmt == OUTPUT_TABLE ? PKG_COLS : "?1 AS package, " PKG_COLS;
+        const char *from =
+                "FROM Deps "
+                "JOIN Pkgs ON Deps.dep_id = Pkgs.id "
+                "WHERE Deps.pkg_id = (SELECT id FROM Pkgs WHERE name = ?1)";
 
-                max_name_len = MAX(max_name_len, strlen(info.name));
-                max_version_len = MAX(max_version_len, strlen(info.version));
-                max_desc_len = MAX(max_desc_len, strlen(info.description));
-                max_installed_len = MAX((int)max_installed_len, snprintf(NULL, 0, "%d", installed));
+        for (size_t i = 0; i < names.len; ++i) {
+                const char *pkg_name = names.data[i];
 
-                dyn_array_append(rows, info);
-        }
+                if (o.fmt == OUTPUT_TABLE) {
+                        info_builder(0, "Dependencies for package ", YELLOW BOLD, pkg_name, RESET "\n", NULL);
+                }
 
-        if (rc != SQLITE_DONE) {
-                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
+                if (show_pkg_rows(db, &o, cols, from, pkg_name, 0) == 0 && o.fmt == OUTPUT_TABLE) {
+                        info_builder(0, "No dependencies found for package ", YELLOW BOLD, pkg_name, RESET "\n", NULL);
+                }
         }
 
-        sqlite3_finalize(stmt);
+        output_end(&o);
         sqlite3_close(db);
+}
 
-        // Print header
-        info(0, "Available packages:\n");
-        printf("%-*s  %-*s  %*s  %-*s\n",
-               (int)max_name_len, "Name",
-               (int)max_version_len, "Version",
-               (int)max_installed_len, "Installed",
-               (int)max_desc_len, "Description");
-        printf("%-*s  %-*s  %*s  %-*s\n",
-               (int)max_name_len, "----",
-               (int)max_version_len, "-------",
-               (int)max_installed_len, "---------",
-               (int)max_desc_len, "-----------");
+static void
+list_pkgs(const forge_context *ctx)
+{
+        (void)ctx;
 
-        // Print rows
-        if (rows.len == 0) {
-                info(0, "No packages found in the database.\n");
-        } else {
-                for (size_t i = 0; i < rows.len; ++i) {
-                        pkg_info *info = &rows.data[i];
-                        forge_str ins_pfx_fs = forge_str_create();
-                        forge_str ins_fs = forge_str_create();
-
-                        if(info->installed != 0 && info->installed != 1) {
-                                // Shouldn't ever reach this
-                                forge_str_concat(&ins_pfx_fs, BOLD);
-                                forge_str_concat(&ins_pfx_fs, RED);
-
-                                char *ins = forge_cstr_of_int(info->installed);
-                                forge_str_concat(&ins_fs, ins);
-                                free(ins);
-                        } else {
-                                forge_str_concat(&ins_pfx_fs, info->installed ? BOLD : DIM);
-                                forge_str_concat(&ins_pfx_fs, info->installed ? GREEN : GRAY);
-                                forge_str_concat(&ins_fs,
-                                                 info->installed ? "Yes" : "No");
-                        }
+        sqlite3 *db;
+        int rc = open_db_readonly(&db);
+        CHECK_SQLITE(rc, db);
 
-                        printf("%s%-*s%s  %s%-*s%s  %s%*s%s  %s%-*s%s\n",
-                               YELLOW,          (int)max_name_len,      info->name,      RESET,
-                               GRAY,            (int)max_version_len,   info->version,   RESET,
-                               ins_pfx_fs.data, (int)max_installed_len, ins_fs.data,     RESET,
-                               PINK,            (int)max_desc_len, info->description,    RESET);
+        output o;
+        output_begin(&o, g_config.format);
 
-                        forge_str_destroy(&ins_pfx_fs);
-                        forge_str_destroy(&ins_fs);
-                }
+        if (o.fmt == OUTPUT_TABLE) {
+                info(0, "Available packages:\n");
         }
 
-        // Clean up
-        for (size_t i = 0; i < rows.len; ++i) {
-                free(rows.data[i].name);
-                free(rows.data[i].version);
-                free(rows.data[i].description);
+        if (show_pkg_rows(db, &o, PKG_COLS, "FROM Pkgs ORDER BY Pkgs.id", NULL, 1) == 0
+            && o.fmt == OUTPUT_TABLE) {
+                info(0, "No packages found in the database.\n");
         }
-        dyn_array_free(rows);
+
+        output_end(&o);
+        sqlite3_close(db);
 }
 
 static void
@@ -2156,7 +3736,7 @@ interactive(forge_context *ctx)
         // Perform installations
         if (to_install.len > 0) {
                 info(0, "Processing Installations\n");
-                install_pkg(ctx, to_install, 0, /*skip_ask=*/1);
+                install_pkg(ctx, to_install, /*skip_ask=*/1);
         }
 
  clean:
@@ -2182,6 +3762,8 @@ interactive(forge_context *ctx)
 void
 edit_install(forge_context *ctx)
 {
+        assert_sudo();
+
         {
                 struct termios term;
                 forge_ctrl_enable_raw_terminal(STDIN_FILENO, &term);
@@ -2286,15 +3868,8 @@ view_pkg_info(const forge_context *ctx,
         for (size_t i = 0; i < names.len; ++i) {
                 const char *pkgname = names.data[i];
 
-                pkg *pkg = NULL;
-                for (size_t i = 0; i < ctx->pkgs.len; ++i) {
-                        if (!strcmp(ctx->pkgs.data[i]->name(), pkgname)) {
-                                pkg = ctx->pkgs.data[i];
-                                break;
-                        }
-                }
-
-                if (!pkg) {
+                const module *m = modindex_find(&ctx->mi, pkgname);
+                if (!m) {
                         fprintf(stderr, RED "Package '%s' not found in loaded modules.\n" RESET, pkgname);
                         return;
                 }
@@ -2323,10 +3898,10 @@ view_pkg_info(const forge_context *ctx,
                 sqlite3_finalize(stmt);
 
                 info_builder(0, "Package Information for ", YELLOW BOLD, pkgname, RESET, "\n", NULL);
-                printf("%-15s %s\n", "Name:", pkg->name());
-                printf("%-15s %s\n", "Version:", pkg->ver());
-                printf("%-15s %s\n", "Description:", pkg->desc());
-                printf("%-15s %s\n", "Website:", pkg->web ? pkg->web() : "(none)");
+                printf("%-15s %s\n", "Name:", m->name);
+                printf("%-15s %s\n", "Version:", m->ver);
+                printf("%-15s %s\n", "Description:", m->desc);
+                printf("%-15s %s\n", "Website:", m->web ? m->web : "(none)");
                 printf("%-15s %s\n", "Installed:", installed ? "Yes" : "No");
                 printf("%-15s %s\n", "Explicit:", is_explicit ? "Yes" : "No");
                 if (pkg_src_loc) {
@@ -2338,10 +3913,9 @@ view_pkg_info(const forge_context *ctx,
 
                 // List dependencies
                 printf("\n" GREEN BOLD "Dependencies:\n" RESET);
-                char **deps = pkg->deps ? pkg->deps() : NULL;
-                if (deps && deps[0]) {
-                        for (size_t i = 0; deps[i]; ++i) {
-                                printf("  - %s\n", deps[i]);
+                if (m->deps.len > 0) {
+                        for (size_t i = 0; i < m->deps.len; ++i) {
+                                printf("  - %s\n", m->deps.data[i]);
                         }
                 } else {
                         printf("  (none)\n");
@@ -2349,10 +3923,9 @@ view_pkg_info(const forge_context *ctx,
 
                 // Show package messages
                 printf("\n" GREEN BOLD "Messages:\n" RESET);
-                char **msgs = pkg->msgs ? pkg->msgs() : NULL;
-                if (msgs && msgs[0]) {
-                        for (size_t i = 0; msgs[i]; ++i) {
-                                printf("  - %s\n", msgs[i]);
+                if (m->msgs.len > 0) {
+                        for (size_t i = 0; i < m->msgs.len; ++i) {
+                                printf("  - %s\n", m->msgs.data[i]);
                         }
                 } else {
                         printf("  (none)\n");
@@ -2360,10 +3933,9 @@ view_pkg_info(const forge_context *ctx,
 
                 // Show package suggested
                 printf("\n" GREEN BOLD "Suggested Packages:\n" RESET);
-                char **suggested = pkg->suggested ? pkg->suggested() : NULL;
-                if (suggested && suggested[0]) {
-                        for (size_t i = 0; suggested[i]; ++i) {
-                                printf("  - %s\n", suggested[i]);
+                if (m->suggested.len > 0) {
+                        for (size_t i = 0; i < m->suggested.len; ++i) {
+                                printf("  - %s\n", m->suggested.data[i]);
                         }
                 } else {
                         printf("  (none)\n");
@@ -2371,6 +3943,133 @@ view_pkg_info(const forge_context *ctx,
         }
 }
 
+// Print the recorded build times of one package.
+static int
+show_pkg_build_stats(const forge_context *ctx,
+                     const char          *name)
+{
+        sqlite3_stmt *stmt;
+        const char *sql =
+                "SELECT phase, COUNT(*), SUM(ok = 0),"
+                "       AVG(CASE WHEN ok = 1 THEN wall_ms END),"
+                "       AVG(CASE WHEN ok = 1 THEN user_ms + sys_ms END),"
+                "       (SELECT b.wall_ms FROM BuildStats b"
+                "        WHERE b.pkg_name = a.pkg_name AND b.phase = a.phase"
+                "        ORDER BY b.id DESC LIMIT 1),"
+                "       MAX(started) "
+                "FROM BuildStats a WHERE pkg_name = ? GROUP BY phase;";
+        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
+        CHECK_SQLITE(rc, ctx->db);
+
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+
+        struct {
+                int     seen;
+                int     runs, failures;
+                int64_t avg_ms, cpu_ms, last_ms;
+        } rows[PHASE__COUNT] = {0};
+        int64_t last_run = 0;
+        int runs = 0;
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+                const char *phase = (const char *)sqlite3_column_text(stmt, 0);
+                for (int i = 0; i < PHASE__COUNT; ++i) {
+                        if (strcmp(phase, build_phase_name((build_phase)i))) continue;
+                        rows[i].seen     = 1;
+                        rows[i].runs     = sqlite3_column_int(stmt, 1);
+                        rows[i].failures = sqlite3_column_int(stmt, 2);
+                        rows[i].avg_ms   = sqlite3_column_int64(stmt, 3);
+                        rows[i].cpu_ms   = sqlite3_column_int64(stmt, 4);
+                        rows[i].last_ms  = sqlite3_column_int64(stmt, 5);
+                        if (rows[i].runs > runs) runs = rows[i].runs;
+                }
+                last_run = MAX(last_run, sqlite3_column_int64(stmt, 6));
+        }
+        sqlite3_finalize(stmt);
+
+        if (runs == 0) {
+                return 0;
+        }
+
+        char when[64] = {0};
+        time_t t = (time_t)last_run;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&t));
+
+        char *nruns = forge_cstr_of_int(runs);
+        info_builder(0, "Build times for ", YELLOW BOLD, name, RESET, " (", nruns,
+                     runs == 1 ? " run" : " runs", ", last on ", when, ")\n", NULL);
+        free(nruns);
+
+        printf(BOLD "  %-10s %10s %10s %10s %9s\n" RESET,
+               "Phase", "Last", "Average", "CPU", "Failures");
+
+        int64_t total_last = 0, total_avg = 0, total_cpu = 0;
+        for (int i = 0; i < PHASE__COUNT; ++i) {
+                if (!rows[i].seen) continue;
+
+                char *last = fmt_duration_ms(rows[i].last_ms);
+                char *avg = fmt_duration_ms(rows[i].avg_ms);
+                char *cpu = fmt_duration_ms(rows[i].cpu_ms);
+                printf("  %-10s %10s %10s %10s %9d\n",
+                       build_phase_name((build_phase)i), last, avg, cpu,
+                       rows[i].failures);
+                free(last);
+                free(avg);
+                free(cpu);
+
+                total_last += rows[i].last_ms;
+                total_avg += rows[i].avg_ms;
+                total_cpu += rows[i].cpu_ms;
+        }
+
+        char *last = fmt_duration_ms(total_last);
+        char *avg = fmt_duration_ms(total_avg);
+        char *cpu = fmt_duration_ms(total_cpu);
+        printf(BOLD "  %-10s %10s %10s %10s\n" RESET, "total", last, avg, cpu);
+        free(last);
+        free(avg);
+        free(cpu);
+
+        return 1;
+}
+
+// `forge stats [pkg...]`: show the recorded build times of
+// the given packages, or of every package that has any.
+static void
+show_build_stats(const forge_context *ctx,
+                 str_array            names)
+{
+        str_array all = dyn_array_empty(str_array);
+
+        if (names.len == 0) {
+                sqlite3_stmt *stmt;
+                const char *sql = "SELECT DISTINCT pkg_name FROM BuildStats ORDER BY pkg_name;";
+                int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
+                CHECK_SQLITE(rc, ctx->db);
+                while (sqlite3_step(stmt) == SQLITE_ROW) {
+                        dyn_array_append(all, strdup((const char *)sqlite3_column_text(stmt, 0)));
+                }
+                sqlite3_finalize(stmt);
+
+                if (all.len == 0) {
+                        info(0, "No build times recorded yet\n");
+                }
+                names = all;
+        }
+
+        for (size_t i = 0; i < names.len; ++i) {
+                if (i > 0) putchar('\n');
+                if (!show_pkg_build_stats(ctx, names.data[i])) {
+                        info_builder(0, "No build times recorded for ", YELLOW BOLD, names.data[i], RESET, "\n", NULL);
+                }
+        }
+
+        for (size_t i = 0; i < all.len; ++i) {
+                free(all.data[i]);
+        }
+        dyn_array_free(all);
+}
+
 static void
 new_pkg(forge_context *ctx, str_array names)
 {
@@ -2519,6 +4218,8 @@ static void
 savedep(forge_context *ctx,
         str_array      names)
 {
+        assert_sudo();
+
         for (size_t i = 0; i < names.len; ++i) {
                 const char *name = names.data[i];
 
@@ -2568,116 +4269,105 @@ savedep(forge_context *ctx,
         }
 }
 
+// Installed packages that were only pulled in as dependencies,
+// one row per installed package that requires them (NULL if
+// there is none).
+#define DEP_PKGS_FROM                                           \
+        "FROM Pkgs d LEFT JOIN ("                               \
+        "SELECT Deps.dep_id, p.name FROM Deps "                 \
+        "JOIN Pkgs p ON p.id = Deps.pkg_id "                    \
+        "WHERE p.installed = 1 ORDER BY p.name"                 \
+        ") r ON r.dep_id = d.id "                               \
+        "WHERE d.installed = 1 AND d.is_explicit = 0"
+
+// The same, one row per dependency for the table.
+#define DEP_PKGS_TABLE                                                  \
+        "FROM (SELECT d.name AS name, "                                 \
+        "IFNULL(group_concat(r.name, ', '), '(none)') AS required_by "  \
+        DEP_PKGS_FROM " GROUP BY d.id) ORDER BY name"
+
 static void
 list_deps(const forge_context *ctx)
 {
         sqlite3 *db = ctx->db;
-        sqlite3_stmt *stmt;
 
-        // Query all installed packages with is_explicit = 0
-        const char *sql_deps = "SELECT name FROM Pkgs WHERE installed = 1 AND is_explicit = 0 ORDER BY name;";
-        int rc = sqlite3_prepare_v2(db, sql_deps, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, db);
+        output o;
+        output_begin(&o, g_config.format);
 
-        typedef struct {
-                char *name;
-                str_array dependents;
-        } dep_info;
+        if (o.fmt != OUTPUT_TABLE) {
+                sqlite3_stmt *stmt = prepare_select(db, "d.name AS name, r.name AS required_by",
+                                                    DEP_PKGS_FROM " ORDER BY d.name, r.name", NULL);
+                (void)stream_rows(&o, stmt);
+                sqlite3_finalize(stmt);
+                output_end(&o);
+                return;
+        }
 
-        str_array dep_names = dyn_array_empty(str_array);
-        while (sqlite3_step(stmt) == SQLITE_ROW) {
-                const char *name = (const char *)sqlite3_column_text(stmt, 0);
-                dyn_array_append(dep_names, strdup(name));
+        sqlite3_stmt *widths = prepare_select(db, "COUNT(*), MAX(length(CAST(name AS BLOB))), "
+                                              "MAX(length(CAST(required_by AS BLOB)))",
+                                              DEP_PKGS_TABLE, NULL);
+        int n = 0;
+        int name_w = strlen("Dependency"), required_w = strlen("Required By");
+        if (sqlite3_step(widths) == SQLITE_ROW) {
+                n = sqlite3_column_int(widths, 0);
+                name_w = MAX(name_w, sqlite3_column_int(widths, 1));
+                required_w = MAX(required_w, sqlite3_column_int(widths, 2));
         }
-        sqlite3_finalize(stmt);
+        sqlite3_finalize(widths);
 
-        if (dep_names.len == 0) {
+        if (n == 0) {
                 printf(YELLOW "No dependency packages found.\n" RESET);
-                dyn_array_free(dep_names);
+                output_end(&o);
                 return;
         }
 
-        // Collect dependents for each dependency package
-        dep_info *dep_infos = calloc(dep_names.len, sizeof(dep_info));
-        size_t max_name_len = strlen("Dependency");
-        size_t max_dependents_len = strlen("Required By");
-
-        for (size_t i = 0; i < dep_names.len; ++i) {
-                dep_infos[i].name = dep_names.data[i];
-                dep_infos[i].dependents = dyn_array_empty(str_array);
-                max_name_len = MAX(max_name_len, strlen(dep_infos[i].name));
-
-                const char *sql_dependents =
-                        "SELECT p.name FROM Pkgs p "
-                        "JOIN Deps d ON p.id = d.pkg_id "
-                        "WHERE d.dep_id = (SELECT id FROM Pkgs WHERE name = ?) "
-                        "AND p.installed = 1 ORDER BY p.name;";
-                rc = sqlite3_prepare_v2(db, sql_dependents, -1, &stmt, NULL);
-                CHECK_SQLITE(rc, db);
+        printf(GREEN BOLD "Dependency Packages:\n" RESET);
+        printf("%-*s  %-*s\n", name_w, "Dependency", required_w, "Required By");
+        printf("%-*s  %-*s\n", name_w, "----------", required_w, "-----------");
 
-                sqlite3_bind_text(stmt, 1, dep_infos[i].name, -1, SQLITE_STATIC);
+        sqlite3_stmt *stmt = prepare_select(db, "name, required_by", DEP_PKGS_TABLE, NULL);
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                printf("%-*s  %-*s\n",
+                       name_w, (const char *)sqlite3_column_text(stmt, 0),
+                       required_w, (const char *)sqlite3_column_text(stmt, 1));
+        }
+        if (rc != SQLITE_DONE) {
+                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
+        }
+        sqlite3_finalize(stmt);
 
-                char dependents_buf[1024] = {0};
-                size_t buf_len = 0;
-                int first = 1;
-                while (sqlite3_step(stmt) == SQLITE_ROW) {
-                        const char *dep_name = (const char *)sqlite3_column_text(stmt, 0);
-                        size_t dep_len = strlen(dep_name);
-                        if (buf_len + dep_len + (first ? 0 : 2) < sizeof(dependents_buf) - 1) {
-                                if (!first) {
-                                        strcat(dependents_buf, ", ");
-                                        buf_len += 2;
-                                }
-                                strcat(dependents_buf, dep_name);
-                                buf_len += dep_len;
-                                dyn_array_append(dep_infos[i].dependents, strdup(dep_name));
-                                first = 0;
-                        }
-                }
-                sqlite3_finalize(stmt);
+        output_end(&o);
+}
 
-                if (dep_infos[i].dependents.len == 0) {
-                        strcpy(dependents_buf, "(none)");
-                        buf_len = strlen("(none)");
-                }
-                max_dependents_len = MAX(max_dependents_len, buf_len);
+// Download the source of the installed package `name` into
+// PKG_SOURCE_DIR and record where it went. Returns the new
+// (malloc'd) source location, or NULL on failure.
+static char *
+fetch_pkg_source(forge_context *ctx,
+                 const char    *name,
+                 pkg           *p)
+{
+        if (!cd(PKG_SOURCE_DIR)) {
+                return NULL;
         }
 
-        printf(GREEN BOLD "Dependency Packages:\n" RESET);
-        printf("%-*s  %-*s\n",
-               (int)max_name_len, "Dependency",
-               (int)max_dependents_len, "Required By");
-        printf("%-*s  %-*s\n",
-               (int)max_name_len, "----------",
-               (int)max_dependents_len, "-----------");
-
-        for (size_t i = 0; i < dep_names.len; ++i) {
-                char dependents_buf[1024] = {0};
-                if (dep_infos[i].dependents.len == 0) {
-                        strcpy(dependents_buf, "(none)");
-                } else {
-                        int first = 1;
-                        for (size_t j = 0; j < dep_infos[i].dependents.len; ++j) {
-                                if (!first) strcat(dependents_buf, ", ");
-                                strcat(dependents_buf, dep_infos[i].dependents.data[j]);
-                                first = 0;
-                        }
-                }
-                printf("%-*s  %-*s\n",
-                       (int)max_name_len, dep_infos[i].name,
-                       (int)max_dependents_len, dependents_buf);
+        info_builder(1, "download(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
+        const char *pkgname = p->download();
+        if (!pkgname) {
+                return NULL;
         }
+        char *src_loc = forge_cstr_builder(PKG_SOURCE_DIR, "/", pkgname, NULL);
 
-        // Clean up
-        for (size_t i = 0; i < dep_names.len; ++i) {
-                for (size_t j = 0; j < dep_infos[i].dependents.len; ++j) {
-                        free(dep_infos[i].dependents.data[j]);
-                }
-                dyn_array_free(dep_infos[i].dependents);
-                free(dep_infos[i].name);
+        sqlite3_stmt *stmt = ctx_stmt(ctx, "UPDATE Pkgs SET pkg_src_loc = ? WHERE name = ?;");
+        sqlite3_bind_text(stmt, 1, src_loc, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+                fprintf(stderr, "Update pkg_src_loc error: %s\n", sqlite3_errmsg(ctx->db));
         }
-        free(dep_infos);
-        dyn_array_free(dep_names);
+        sqlite3_reset(stmt);
+
+        return src_loc;
 }
 
 static int
@@ -2714,15 +4404,8 @@ update_pkgs(forge_context *ctx, str_array names)
         int any_updated = 0;
         for (size_t i = 0; i < to_update.len; ++i) {
                 const char *name = to_update.data[i];
-                pkg *p = NULL;
-
-                for (size_t j = 0; j < ctx->pkgs.len; ++j) {
-                        if (!strcmp(ctx->pkgs.data[j]->name(), name)) {
-                                p = ctx->pkgs.data[j];
-                                break;
-                        }
-                }
-                if (!p) {
+                module *m = modindex_find(&ctx->mi, name);
+                if (!m) {
                         forge_err_wargs("package `%s` not found in loaded modules", name);
                         continue;
                 }
@@ -2733,29 +4416,30 @@ update_pkgs(forge_context *ctx, str_array names)
                         continue;
                 }
 
+                pkg *p = modindex_load_pkg(m);
+                if (!p) {
+                        forge_err_wargs("could not load module for package `%s`", name);
+                        continue;
+                }
+
                 // Skip if no update() and not forced
                 if (!p->update && !(g_config.flags & FT_FORCE)) {
                         dyn_array_append(skipped, strdup(name));
                         continue;
                 }
 
-                char *src_loc = NULL;
-                {
-                        sqlite3_stmt *stmt;
-                        const char *sql = "SELECT pkg_src_loc FROM Pkgs WHERE name = ?;";
-                        int rc = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx->db);
-                        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
-                        if (sqlite3_step(stmt) == SQLITE_ROW) {
-                                const char *loc = (const char *)sqlite3_column_text(stmt, 0);
-                                if (loc) src_loc = strdup(loc);
-                        }
-                        sqlite3_finalize(stmt);
-                }
+                char *src_loc = get_pkg_src_loc(ctx, name);
 
-                if (!src_loc) {
-                        forge_err_wargs("no source location recorded for %s – reinstall the package", name);
-                        continue;
+                // Packages installed from the binary cache come
+                // without their source, fetch it now.
+                int fetched = 0;
+                if (!src_loc || access(src_loc, F_OK) != 0) {
+                        free(src_loc);
+                        src_loc = fetch_pkg_source(ctx, name, p);
+                        if (!src_loc) {
+                                forge_err_wargs("could not download the source of %s", name);
+                        }
+                        fetched = 1;
                 }
 
                 if (!cd(src_loc)) {
@@ -2765,7 +4449,11 @@ update_pkgs(forge_context *ctx, str_array names)
                 }
 
                 int needs_rebuild = 0;
-                if (p->update && (g_config.flags & FT_FORCE) == 0) {
+                if (fetched) {
+                        // There is no earlier source to compare the fresh
+                        // one with, so the installed build may be behind.
+                        needs_rebuild = 1;
+                } else if (p->update && (g_config.flags & FT_FORCE) == 0) {
                         info_builder(1, "Checking update for ", YELLOW BOLD, name, RESET, "\n", NULL);
                         needs_rebuild = p->update();
                 } else {
@@ -2783,7 +4471,9 @@ update_pkgs(forge_context *ctx, str_array names)
                 any_updated = 1;
 
                 int pull_ok = 1;
-                if (p->get_changes) {
+                if (fetched) {
+                        // Nothing to pull.
+                } else if (p->get_changes) {
                         info_builder(1, "Pulling changes for ", YELLOW BOLD, name, RESET, "\n", NULL);
                         pull_ok = p->get_changes();
                 } else {
@@ -2792,9 +4482,7 @@ update_pkgs(forge_context *ctx, str_array names)
 
                 if (!pull_ok) {
                         info_builder(1, "Re-downloading source for ", YELLOW BOLD, name, RESET, "\n", NULL);
-                        char *rm = forge_cstr_builder("rm -rf ", src_loc, NULL);
-                        cmd_s(rm);
-                        free(rm);
+                        rmrf(src_loc);
                 }
 
                 cd_silent("..");
@@ -2803,31 +4491,39 @@ update_pkgs(forge_context *ctx, str_array names)
                 str_array single = dyn_array_empty(str_array);
                 dyn_array_append(single, strdup(name));
 
-                uninstall_pkg(ctx, single, 0);
+                // No uninstall first, merge_pkg() updates the
+                // installed files in place.
+
+                // The upstream source changed, which the binary cache
+                // key knows nothing about. Always build, but keep
+                // storing the results so the cache has the new build.
+                g_config.refresh_cache = 1;
 
-                if (!install_pkg(ctx, single, /*is_dep=*/0, /*skip_ask=*/1)) {
+                if (!install_pkg(ctx, single, /*skip_ask=*/1)) {
                         //forge_err_wargs("update failed for %s", name);
+                        g_config.refresh_cache = 0;
                         return 0;
                 } else {
                         good(0, forge_cstr_builder("Updated ", YELLOW BOLD, name, RESET, "\n", NULL));
                 }
 
-                if (p->rebuild) {
+                if (m->rebuild.len > 0) {
                         info_builder(1, "rebuild(", YELLOW BOLD, name, RESET, ")\n\n", NULL);
-                        char **rebuilds = p->rebuild();
                         str_array rebuilds_ar = dyn_array_empty(str_array);
-                        for (size_t j = 0; rebuilds[j]; ++j) {
-                                if (pkg_is_installed(ctx, rebuilds[j])) {
-                                        info_builder(0, "Package " YELLOW, rebuilds[j], RESET " needs to be rebuilt...\n", NULL);
-                                        dyn_array_append(rebuilds_ar, rebuilds[j]);
+                        for (size_t j = 0; j < m->rebuild.len; ++j) {
+                                if (pkg_is_installed(ctx, m->rebuild.data[j])) {
+                                        info_builder(0, "Package " YELLOW, m->rebuild.data[j], RESET " needs to be rebuilt...\n", NULL);
+                                        dyn_array_append(rebuilds_ar, m->rebuild.data[j]);
                                 }
                         }
-                        if (!install_pkg(ctx, rebuilds_ar, /*is_dep=*/0, /*skip_ask=*/1)) {
+                        if (!install_pkg(ctx, rebuilds_ar, /*skip_ask=*/1)) {
                                 bad(1, "Failed to rebuild\n");
                         }
                         dyn_array_free(rebuilds_ar);
                 }
 
+                g_config.refresh_cache = 0;
+
                 free(single.data[0]);
                 dyn_array_free(single);
         }
@@ -2850,110 +4546,368 @@ update_pkgs(forge_context *ctx, str_array names)
         return 1;
 }
 
+// Build a query of the search index for the plain text
+// `names`, against the name column only unless `with_desc`.
+// Returns NULL if any of them cannot be served from the index:
+// regexes, terms shorter than a trigram, or no index at all.
+static char *
+search_index_query(sqlite3   *db,
+                   str_array  names,
+                   int        with_desc)
+{
+        if (names.len == 0) {
+                return NULL;
+        }
+
+        sqlite3_stmt *probe;
+        if (sqlite3_prepare_v2(db, "SELECT 1 FROM PkgSearch LIMIT 0;", -1, &probe, NULL) != SQLITE_OK) {
+                return NULL;
+        }
+        sqlite3_finalize(probe);
+
+        // Each name becomes a quoted phrase, which the trigram
+        // tokenizer matches as a substring: name : "a" OR name : "b" ...
+        forge_str query = forge_str_create();
+        for (size_t i = 0; i < names.len; ++i) {
+                const char *name = names.data[i];
+                if (!forge_utils_regex_is_literal(name) || strlen(name) < 3) {
+                        forge_str_destroy(&query);
+                        return NULL;
+                }
+
+                if (i != 0) forge_str_concat(&query, " OR ");
+                if (!with_desc) forge_str_concat(&query, "name : ");
+                forge_str_append(&query, '"');
+                for (const char *c = name; *c; ++c) {
+                        if (*c == '"') forge_str_append(&query, '"');
+                        forge_str_append(&query, *c);
+                }
+                forge_str_append(&query, '"');
+        }
+
+        char *match = strdup(forge_str_to_cstr(&query));
+        forge_str_destroy(&query);
+
+        return match;
+}
+
+typedef struct {
+        forge_regex **regexes;
+        size_t        len;
+} search_regexes;
+
+// SQL function forge_search(name, description): whether any
+// of the search regexes matches either. `description` is NULL
+// unless descriptions are searched as well.
+static void
+sql_forge_search(sqlite3_context  *sctx,
+                 int               argc,
+                 sqlite3_value   **argv)
+{
+        (void)argc;
+        const search_regexes *sr = (const search_regexes *)sqlite3_user_data(sctx);
+        const char *name = (const char *)sqlite3_value_text(argv[0]);
+        const char *description = (const char *)sqlite3_value_text(argv[1]);
+
+        int found = 0;
+        for (size_t i = 0; !found && i < sr->len; ++i) {
+                if (!sr->regexes[i]) continue;
+                found = (name && forge_utils_regex_match(sr->regexes[i], name))
+                        || (description && forge_utils_regex_match(sr->regexes[i], description));
+        }
+
+        sqlite3_result_int(sctx, found);
+}
+
 static void
 pkg_search(str_array names)
 {
         sqlite3 *db;
-        int rc = sqlite3_open_v2(DATABASE_FP, &db, SQLITE_OPEN_READONLY, NULL);
+        int rc = open_db_readonly(&db);
         CHECK_SQLITE(rc, db);
 
-        sqlite3_stmt *stmt;
-        const char *sql = "SELECT name, version, description, installed FROM Pkgs;";
-        rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-        CHECK_SQLITE(rc, db);
+        // Plain text is looked up in the search index. Otherwise
+        // fall back to matching every package against the
+        // regexes, compiling each of them only once. Either way
+        // the filtering happens in the query, so rows can be
+        // shown as they come.
+        const char *from =
+                "FROM PkgSearch JOIN Pkgs ON Pkgs.id = PkgSearch.rowid "
+                "WHERE PkgSearch MATCH ?1 ORDER BY Pkgs.id";
+        int with_desc = (g_config.flags & FT_DESC) != 0;
+        char *match = search_index_query(db, names, with_desc);
+        search_regexes sr = {0};
+
+        if (!match) {
+                sr.len = names.len;
+                sr.regexes = (forge_regex **)calloc(names.len + 1, sizeof(forge_regex *));
+                for (size_t i = 0; i < names.len; ++i) {
+                        sr.regexes[i] = forge_utils_regex_compile(names.data[i]);
+                }
 
-        // Collect data and calculate max widths
-        pkg_info_array rows = dyn_array_empty(pkg_info_array);
-        size_t max_name_len = strlen("Name");
-        size_t max_version_len = strlen("Version");
-        size_t max_installed_len = strlen("Installed");
-        size_t max_desc_len = strlen("Description");
+                rc = sqlite3_create_function(db, "forge_search", 2, SQLITE_UTF8 | SQLITE_DETERMINISTIC,
+                                             &sr, sql_forge_search, NULL, NULL);
+                CHECK_SQLITE(rc, db);
 
-        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-                pkg_info info = {0};
-                const char *name = (const char *)sqlite3_column_text(stmt, 0);
-                const char *version = (const char *)sqlite3_column_text(stmt, 1);
-                const char *description = (const char *)sqlite3_column_text(stmt, 2);
-                int installed = sqlite3_column_int(stmt, 3);
+                from = with_desc
+                        ? "FROM Pkgs WHERE forge_search(Pkgs.name, Pkgs.description) ORDER BY Pkgs.id"
+                        : "FROM Pkgs WHERE forge_search(Pkgs.name, NULL) ORDER BY Pkgs.id";
+        }
 
-                int found = 0;
-                for (size_t i = 0; i < names.len; ++i) {
-                        if (forge_utils_regex(names.data[i], name)) {
-                                found = 1;
-                                break;
-                        }
-                }
+        output o;
+        output_begin(&o, g_config.format);
+
+        if (o.fmt == OUTPUT_TABLE) {
+                printf("Available packages:\n");
+        }
 
-                if (found) {
-                        info.name = strdup(name ? name : "");
-                        info.version = strdup(version ? version : "");
-                        info.description = strdup(description ? description : "(none)");
-                        info.installed = installed;
+        if (show_pkg_rows(db, &o, PKG_COLS, from, match, 0) == 0 && o.fmt == OUTPUT_TABLE) {
+                printf("No packages matched the search.\n");
+        }
+
+        output_end(&o);
+        sqlite3_close(db);
 
-                        max_name_len = MAX(max_name_len, strlen(info.name));
-                        max_version_len = MAX(max_version_len, strlen(info.version));
-                        max_desc_len = MAX(max_desc_len, strlen(info.description));
-                        max_installed_len = MAX((int)max_installed_len, snprintf(NULL, 0, "%d", installed));
+        free(match);
+        for (size_t i = 0; i < sr.len; ++i) {
+                forge_utils_regex_free(sr.regexes[i]);
+        }
+        free(sr.regexes);
+}
 
-                        dyn_array_append(rows, info);
+// Print the owners of `path`, which may be a glob. Returns
+// the number of files that were found.
+static size_t
+show_path_owners(sqlite3_stmt *exact,
+                 sqlite3_stmt *glob,
+                 const char   *path)
+{
+        char abspath[PATH_MAX] = {0};
+        if (path[0] == '/') {
+                snprintf(abspath, sizeof(abspath), "%s", path);
+        } else {
+                char cwd[PATH_MAX] = {0};
+                if (!getcwd(cwd, sizeof(cwd))) {
+                        perror("getcwd");
+                        return 0;
                 }
+                snprintf(abspath, sizeof(abspath), "%s/%s", cwd, path);
+        }
+
+        // Installed paths never end with a slash.
+        size_t n = strlen(abspath);
+        while (n > 1 && abspath[n-1] == '/') {
+                abspath[--n] = '\0';
         }
 
+        sqlite3_stmt *stmt = abspath[strcspn(abspath, "*?[")] ? glob : exact;
+        sqlite3_bind_text(stmt, 1, abspath, -1, SQLITE_STATIC);
+
+        size_t found = 0;
+        int rc;
+        while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                const char *file = (const char *)sqlite3_column_text(stmt, 0);
+                const char *name = (const char *)sqlite3_column_text(stmt, 1);
+                const char *ver = (const char *)sqlite3_column_text(stmt, 2);
+                printf("%s is owned by " YELLOW BOLD "%s" RESET " %s\n", file, name, ver);
+                ++found;
+        }
         if (rc != SQLITE_DONE) {
-                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
+                fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(sqlite3_db_handle(stmt)));
         }
 
-        sqlite3_finalize(stmt);
+        sqlite3_reset(stmt);
+        sqlite3_clear_bindings(stmt);
+
+        if (found == 0) {
+                fprintf(stderr, RED "No package owns %s\n" RESET, abspath);
+        }
+
+        return found;
+}
+
+static void
+show_owners(str_array paths)
+{
+        sqlite3 *db;
+        int rc = open_db_readonly(&db);
+        if (rc != SQLITE_OK) {
+                forge_err_wargs("Cannot open database: %s\n", sqlite3_errmsg(db));
+        }
+
+        // Both queries use the index on Files(path); a glob
+        // only has to look at paths sharing its literal prefix.
+        sqlite3_stmt *exact, *glob;
+        const char *sql_exact =
+                "SELECT Files.path, Pkgs.name, Pkgs.version FROM Files "
+                "JOIN Pkgs ON Pkgs.id = Files.pkg_id "
+                "WHERE Files.path = ? AND Files.type != 'dir' ORDER BY Pkgs.name;";
+        const char *sql_glob =
+                "SELECT Files.path, Pkgs.name, Pkgs.version FROM Files "
+                "JOIN Pkgs ON Pkgs.id = Files.pkg_id "
+                "WHERE Files.path GLOB ? AND Files.type != 'dir' ORDER BY Files.path, Pkgs.name;";
+        rc = sqlite3_prepare_v2(db, sql_exact, -1, &exact, NULL);
+        CHECK_SQLITE(rc, db);
+        rc = sqlite3_prepare_v2(db, sql_glob, -1, &glob, NULL);
+        CHECK_SQLITE(rc, db);
+
+        int from_stdin = paths.len == 0;
+        for (size_t i = 0; i < paths.len; ++i) {
+                if (!strcmp(paths.data[i], "-")) {
+                        from_stdin = 1;
+                } else {
+                        (void)show_path_owners(exact, glob, paths.data[i]);
+                }
+        }
+
+        if (from_stdin) {
+                char *line = NULL;
+                size_t cap = 0;
+                ssize_t len;
+                while ((len = getline(&line, &cap, stdin)) != -1) {
+                        if (len > 0 && line[len-1] == '\n') line[--len] = '\0';
+                        if (len == 0) continue;
+                        (void)show_path_owners(exact, glob, line);
+                }
+                free(line);
+        }
+
+        sqlite3_finalize(exact);
+        sqlite3_finalize(glob);
         sqlite3_close(db);
+}
 
-        // Print header
-        printf("Available packages:\n");
-        printf("%-*s  %-*s  %*s  %-*s\n",
-               (int)max_name_len, "Name",
-               (int)max_version_len, "Version",
-               (int)max_installed_len, "Installed",
-               (int)max_desc_len, "Description");
-        printf("%-*s  %-*s  %*s  %-*s\n",
-               (int)max_name_len, "----",
-               (int)max_version_len, "-------",
-               (int)max_installed_len, "---------",
-               (int)max_desc_len, "-----------");
+static void
+verify_progress_cb(size_t done,
+                   size_t total)
+{
+        fprintf(stderr, "\rVerifying " YELLOW BOLD "%zu" RESET "/" YELLOW BOLD "%zu" RESET, done, total);
+        if (done == total) fputs("\r\033[2K", stderr);
+}
 
-        // Print rows
-        if (rows.len == 0) {
-                printf("No packages matched the search.\n");
-        } else {
-                for (size_t i = 0; i < rows.len; ++i) {
-                        pkg_info *info = &rows.data[i];
-                        forge_str ins_fs = forge_str_create();
-
-                        if(info->installed != 0 && info->installed != 1) {
-                                // Shouldn't ever reach this
-                                char *ins = forge_cstr_of_int(info->installed);
-                                forge_str_concat(&ins_fs, ins);
-                                free(ins);
-                        } else {
-                                forge_str_concat(&ins_fs,
-                                                info->installed ? "Yes" : "No");
+// Check the installed files of `names` (everything if empty)
+// against the database. Returns 0 if anything is off.
+static int
+verify_pkgs(str_array names)
+{
+        sqlite3 *db;
+        int rc = open_db_readonly(&db);
+        if (rc != SQLITE_OK) {
+                forge_err_wargs("Cannot open database: %s\n", sqlite3_errmsg(db));
+        }
+
+        forge_context rctx = { .db = db, .stmts = forge_smap_create() };
+        int ok = 1;
+
+        // Only root can migrate the database, so the hashes may
+        // not have a column yet.
+        sqlite3_stmt *probe;
+        int have_hash = sqlite3_prepare_v2(db, "SELECT hash FROM Files LIMIT 0;", -1, &probe, NULL) == SQLITE_OK;
+        sqlite3_finalize(probe);
+
+        // All files of a package, or of every installed one
+        // when ?1 is NULL.
+        sqlite3_stmt *stmt = ctx_stmt(&rctx, have_hash
+                ? "SELECT Pkgs.name, Files.path, Files.type, Files.size, Files.mode, Files.mtime, Files.hash "
+                  "FROM Files JOIN Pkgs ON Pkgs.id = Files.pkg_id "
+                  "WHERE Pkgs.installed = 1 AND (?1 IS NULL OR Pkgs.name = ?1) ORDER BY Files.path;"
+                : "SELECT Pkgs.name, Files.path, Files.type, Files.size, Files.mode, Files.mtime, NULL "
+                  "FROM Files JOIN Pkgs ON Pkgs.id = Files.pkg_id "
+                  "WHERE Pkgs.installed = 1 AND (?1 IS NULL OR Pkgs.name = ?1) ORDER BY Files.path;");
+
+        // The threads need all of them up front.
+        verify_entry *entries = NULL;
+        str_array owners = dyn_array_empty(str_array);
+        size_t len = 0, cap = 0;
+
+        for (size_t i = 0; i < (names.len ? names.len : 1); ++i) {
+                if (names.len && get_pkg_id(&rctx, names.data[i]) == -1) {
+                        fprintf(stderr, RED "Package '%s' not found in database.\n" RESET, names.data[i]);
+                        ok = 0;
+                        continue;
+                }
+
+                if (names.len) {
+                        sqlite3_bind_text(stmt, 1, names.data[i], -1, SQLITE_STATIC);
+                }
+
+                while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                        if (len == cap) {
+                                cap = cap ? cap * 2 : 256;
+                                entries = (verify_entry *)realloc(entries, cap * sizeof(verify_entry));
                         }
+                        const char *hash = (const char *)sqlite3_column_text(stmt, 6);
+                        entries[len++] = (verify_entry) {
+                                .path = strdup((const char *)sqlite3_column_text(stmt, 1)),
+                                .type = strdup((const char *)sqlite3_column_text(stmt, 2)),
+                                .size = sqlite3_column_int64(stmt, 3),
+                                .mode = sqlite3_column_int(stmt, 4),
+                                .mtime = sqlite3_column_int64(stmt, 5),
+                                .hash = hash ? strdup(hash) : NULL,
+                        };
+                        dyn_array_append(owners, strdup((const char *)sqlite3_column_text(stmt, 0)));
+                }
+                if (rc != SQLITE_DONE) {
+                        fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
+                        ok = 0;
+                }
+                sqlite3_reset(stmt);
+        }
 
-                        printf("%-*s  %-*s  %*s  %-*s\n",
-                               (int)max_name_len, info->name,
-                               (int)max_version_len, info->version,
-                               (int)max_installed_len, ins_fs.data,
-                               (int)max_desc_len, info->description);
+        ctx_stmts_destroy(&rctx);
+        sqlite3_close(db);
+
+        int full = (g_config.flags & FT_FULL) != 0;
+        size_t bad = verify_files(entries, len, full, isatty(STDERR_FILENO) ? verify_progress_cb : NULL);
 
-                        forge_str_destroy(&ins_fs);
+        size_t hashed = 0, unhashed = 0;
+        for (size_t i = 0; i < len; ++i) {
+                const verify_entry *e = &entries[i];
+                hashed += e->hashed;
+                unhashed += !e->hash && !strcmp(e->type, "file");
+                if (e->status == VERIFY_OK) continue;
+
+                if (e->err) {
+                        printf(RED BOLD "%-12s" RESET " %s (" YELLOW "%s" RESET "): %s\n",
+                               verify_status_str(e->status), e->path, owners.data[i], strerror(e->err));
+                } else {
+                        printf(RED BOLD "%-12s" RESET " %s (" YELLOW "%s" RESET ")\n",
+                               verify_status_str(e->status), e->path, owners.data[i]);
                 }
         }
 
-        // Clean up
-        for (size_t i = 0; i < rows.len; ++i) {
-                free(rows.data[i].name);
-                free(rows.data[i].version);
-                free(rows.data[i].description);
+        printf("%zu files checked, %zu read, %s%zu problem%s" RESET "\n",
+               len, hashed, bad ? RED BOLD : GREEN BOLD, bad, bad == 1 ? "" : "s");
+        if (unhashed) {
+                printf(YELLOW "%zu files were installed without a hash and were only checked by size\n" RESET, unhashed);
+        }
+
+        for (size_t i = 0; i < len; ++i) {
+                free((char *)entries[i].path);
+                free((char *)entries[i].type);
+                free((char *)entries[i].hash);
+                free(owners.data[i]);
         }
-        dyn_array_free(rows);
+        free(entries);
+        dyn_array_free(owners);
+
+        return ok && bad == 0;
+}
+
+static void
+show_pkg_file(output     *o,
+              const char *pkgname,
+              const char *path)
+{
+        if (o->fmt == OUTPUT_TABLE) {
+                printf("%s\n", path);
+                return;
+        }
+
+        output_row_begin(o);
+        output_text(o, "package", pkgname);
+        output_text(o, "path", path);
+        output_row_end(o);
 }
 
 static void
@@ -2964,79 +4918,72 @@ show_pkg_files(str_array names)
         }
 
         sqlite3 *db;
-        int rc = sqlite3_open_v2(DATABASE_FP, &db, SQLITE_OPEN_READONLY, NULL);
+        int rc = open_db_readonly(&db);
         if (rc != SQLITE_OK) {
                 forge_err_wargs("Cannot open database: %s\n", sqlite3_errmsg(db));
         }
 
+        forge_context rctx = { .db = db, .stmts = forge_smap_create() };
+
+        output o;
+        output_begin(&o, g_config.format);
+        size_t shown = 0;
+
         for (size_t i = 0; i < names.len; ++i) {
                 const char *pkgname = names.data[i];
 
                 // Check if package exists
-                int pkg_id = get_pkg_id(&(forge_context){.db = db}, pkgname);
+                int pkg_id = get_pkg_id(&rctx, pkgname);
                 if (pkg_id == -1) {
                         fprintf(stderr, RED "Package '%s' not found in database.\n" RESET, pkgname);
                         continue;
                 }
 
-                sqlite3_stmt *stmt;
-                const char *sql = "SELECT path FROM Files WHERE pkg_id = ? ORDER BY path;";
-                rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-                if (rc != SQLITE_OK) {
-                        fprintf(stderr, "SQL prepare error: %s\n", sqlite3_errmsg(db));
-                        continue;
-                }
-
-                sqlite3_bind_int(stmt, 1, pkg_id);
-
-                str_array files = dyn_array_empty(str_array);
-                size_t file_count = 0;
+                if (o.fmt == OUTPUT_TABLE) {
+                        sqlite3_stmt *count = ctx_stmt(&rctx, "SELECT COUNT(*) FROM Files WHERE pkg_id = ?;");
+                        sqlite3_bind_int(count, 1, pkg_id);
+                        int file_count = sqlite3_step(count) == SQLITE_ROW ? sqlite3_column_int(count, 0) : 0;
+                        sqlite3_reset(count);
 
-                while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
-                        const char *path = (const char *)sqlite3_column_text(stmt, 0);
-                        dyn_array_append(files, strdup(path));
-                        file_count++;
-                }
+                        if (file_count == 0) {
+                                info_builder(0, "Package ", YELLOW BOLD, pkgname, RESET, " has no tracked files.\n", NULL);
+                                continue;
+                        }
 
-                if (rc != SQLITE_DONE) {
-                        fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
-                        sqlite3_finalize(stmt);
-                        continue;
-                }
-                sqlite3_finalize(stmt);
+                        if (shown++ > 0) {
+                                putchar('\n');  // Separator between packages
+                        }
 
-                if (file_count == 0) {
-                        info_builder(0, "Package ", YELLOW BOLD, pkgname, RESET, " has no tracked files.\n", NULL);
-                        dyn_array_free(files);
-                        continue;
+                        // Header
+                        char *count_str = forge_cstr_of_int(file_count);
+                        info_builder(0, "Files installed by ", YELLOW BOLD, pkgname, RESET, " [", YELLOW, count_str, RESET, "]\n", NULL);
+                        free(count_str);
                 }
 
-                // Header
-                char *count_str = forge_cstr_of_int(file_count);
-                info_builder(0, "Files installed by ", YELLOW BOLD, pkgname, RESET, " [", YELLOW, count_str, RESET, "]\n", NULL);
-                free(count_str);
+                sqlite3_stmt *stmt = ctx_stmt(&rctx, "SELECT path FROM Files WHERE pkg_id = ? ORDER BY path;");
+                sqlite3_bind_int(stmt, 1, pkg_id);
 
                 // Print files
                 int is_forge = !strcmp(pkgname, "forge");
-                for (size_t j = 0; j < files.len; ++j) {
+                while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+                        const char *path = (const char *)sqlite3_column_text(stmt, 0);
+
                         // Hack because of the self-updating nature
                         // of the PM, we cannot track conf.h.
-                        if (is_forge && !strcmp(files.data[j], PREFIX "/include/forge/arg.h"))
-                                printf(PREFIX "/include/forge/conf.h\n");
-                        printf("%s\n", files.data[j]);
-                }
-
-                // Cleanup
-                for (size_t j = 0; j < files.len; ++j) {
-                        free(files.data[j]);
+                        if (is_forge && !strcmp(path, PREFIX "/include/forge/arg.h")) {
+                                show_pkg_file(&o, pkgname, PREFIX "/include/forge/conf.h");
+                        }
+                        show_pkg_file(&o, pkgname, path);
                 }
-                dyn_array_free(files);
 
-                if (i < names.len - 1) {
-                        putchar('\n');  // Separator between packages
+                if (rc != SQLITE_DONE) {
+                        fprintf(stderr, "Query error: %s\n", sqlite3_errmsg(db));
                 }
+                sqlite3_reset(stmt);
         }
 
+        output_end(&o);
+        ctx_stmts_destroy(&rctx);
         sqlite3_close(db);
 }
 
@@ -3458,6 +5405,22 @@ list_repos(void)
         dyn_array_free(repos);
 }
 
+static size_t
+parse_jobs(const char *s)
+{
+        if (!s) {
+                long n = sysconf(_SC_NPROCESSORS_ONLN);
+                return n > 0 ? (size_t)n : 1;
+        }
+
+        char *end = NULL;
+        long n = strtol(s, &end, 10);
+        if (!*s || *end || n < 1) {
+                forge_err_wargs("invalid number of jobs `%s`", s);
+        }
+        return (size_t)n;
+}
+
 static str_array
 fold_args(forge_arg **hd)
 {
@@ -3469,6 +5432,148 @@ fold_args(forge_arg **hd)
         return args;
 }
 
+// Read-only commands that `forge daemon` answers. Anything that
+// changes the system still runs in the caller's own process, as
+// forge.lock already serializes those.
+static int
+is_daemon_cmd(const char *cmd)
+{
+        static const char *const cmds[] = {
+                CMD_LIST, CMD_FILES, CMD_DEPS, CMD_INFO, CMD_SEARCH,
+                CMD_OWNS, CMD_STATS, CMD_LIST_DEPS, "l", "f", "s",
+        };
+        for (size_t i = 0; i < sizeof(cmds)/sizeof(*cmds); ++i) {
+                if (streq(cmd, cmds[i])) return 1;
+        }
+        return 0;
+}
+
+// Where the command is in `argv` if the daemon can answer it,
+// otherwise -1. Only --format may come before it.
+static int
+daemon_cmd_at(int argc, char **argv)
+{
+        const char *format = "--" FLAG_2HY_FORMAT "=";
+        int i = 0;
+        while (i < argc && !strncmp(argv[i], format, strlen(format))) {
+                ++i;
+        }
+        return i < argc && is_daemon_cmd(argv[i]) ? i : -1;
+}
+
+static struct timespec g_modules_mtime = {0};
+
+static void
+modules_mtime(struct timespec *ts)
+{
+        struct stat st;
+        if (stat(MODULE_LIB_DIR, &st) == 0) {
+                *ts = st.st_mtim;
+        }
+}
+
+// Called by the daemon before each request. Modules are only
+// written by (re)building them, which replaces the .so files,
+// so the directory's mtime tells us when to reload.
+static void
+daemon_refresh(void *ud)
+{
+        forge_context *ctx = (forge_context *)ud;
+        struct timespec now = g_modules_mtime;
+
+        modules_mtime(&now);
+        if (now.tv_sec == g_modules_mtime.tv_sec && now.tv_nsec == g_modules_mtime.tv_nsec) {
+                return;
+        }
+
+        modindex_destroy(&ctx->mi);
+        depgraph_destroy(&ctx->dg);
+        ctx->loaded &= ~CTX_MODULES;
+        ctx_need(ctx, CTX_MODULES);
+        ctx_close_db(ctx);
+        g_modules_mtime = now;
+}
+
+// Runs one request in a process forked from the daemon, so
+// the loaded modules come for free. It runs as the client, so
+// unless that is root the database is opened read-only and
+// init_db() migrates nothing. The daemon keeps no database
+// open (see serve_daemon()), so none is inherited either.
+static int
+daemon_run_cmd(int argc, char **argv, void *ud)
+{
+        forge_context *ctx = (forge_context *)ud;
+
+        int at = daemon_cmd_at(argc, argv);
+        if (at == -1) {
+                fprintf(stderr, "forge daemon: refusing to run `%s`\n", argc < 1 ? "" : argv[0]);
+                return 2;
+        }
+
+        for (int i = 0; i < at; ++i) {
+                if (!output_format_parse(strchr(argv[i], '=') + 1, &g_config.format)) {
+                        fprintf(stderr, "invalid format `%s`, expected json, tsv, null or table\n",
+                                strchr(argv[i], '=') + 1);
+                        return 1;
+                }
+        }
+
+        const char *cmd = argv[at];
+        str_array args = dyn_array_empty(str_array);
+        for (int i = at + 1; i < argc; ++i) {
+                dyn_array_append(args, strdup(argv[i]));
+        }
+
+        if (streq(cmd, CMD_LIST) || streq(cmd, "l")) {
+                list_pkgs(ctx);
+        } else if (streq(cmd, CMD_FILES) || streq(cmd, "f")) {
+                show_pkg_files(args);
+        } else if (streq(cmd, CMD_DEPS)) {
+                show_pkg_deps(args);
+        } else if (streq(cmd, CMD_INFO)) {
+                ctx_need(ctx, CTX_MODULES);
+                view_pkg_info(ctx, args);
+        } else if (streq(cmd, CMD_SEARCH) || streq(cmd, "s")) {
+                pkg_search(args);
+        } else if (streq(cmd, CMD_OWNS)) {
+                show_owners(args);
+        } else if (streq(cmd, CMD_STATS)) {
+                ctx_need(ctx, CTX_DB);
+                show_build_stats(ctx, args);
+        } else if (streq(cmd, CMD_LIST_DEPS)) {
+                ctx_need(ctx, CTX_DB);
+                list_deps(ctx);
+        }
+
+        return 0;
+}
+
+static void
+serve_daemon(forge_context *ctx)
+{
+        if (geteuid() != 0) {
+                forge_err("forge daemon must be run as root");
+        }
+
+        // Not assert_sudo(), the daemon must not hold forge.lock.
+        ctx_need(ctx, CTX_MODULES);
+        modules_mtime(&g_modules_mtime);
+
+        // The database is only needed to load the modules. Keeping
+        // it open would hand root's read-write descriptors to every
+        // request, which runs as the client.
+        ctx_close_db(ctx);
+
+        daemon_handler h = {
+                .refresh = daemon_refresh,
+                .run = daemon_run_cmd,
+                .ud = ctx,
+        };
+        if (!daemon_serve(&h)) {
+                exit(1);
+        }
+}
+
 int
 main(int argc, char **argv)
 {
@@ -3489,24 +5594,20 @@ main(int argc, char **argv)
                 exit(0);
         }
 
+        // Let a running `forge daemon` answer read-only commands.
+        if (daemon_cmd_at(argc - 1, argv + 1) != -1) {
+                int status = daemon_forward(argc - 1, argv + 1);
+                if (status != -1) {
+                        return status;
+                }
+        }
+
         if (init_env()) {
                 first_time_reposync();
         }
 
-        forge_context ctx = (forge_context) {
-                .db = init_db(DATABASE_FP),
-                .dll = {
-                        .handles = dyn_array_empty(handle_array),
-                        .paths = dyn_array_empty(str_array),
-                },
-                .dg = depgraph_create(),
-                .pkgs = dyn_array_empty(pkg_ptr_array),
-        };
-
-        // Load existing .so files and packages
-        obtain_handles_and_pkgs_from_dll(&ctx);
-        construct_depgraph(&ctx);
-        size_t_array indices = depgraph_gen_order(&ctx.dg);
+        // Filled in by ctx_need() for the commands that need it.
+        forge_context ctx = {0};
 
         forge_arg *arghd = forge_arg_alloc(argc, argv, 1);
         forge_arg *arg = arghd;
@@ -3522,6 +5623,8 @@ main(int argc, char **argv)
                                 }
                                 else if (c == FLAG_1HY_ONLY[0]) g_config.flags |= FT_ONLY;
                                 else if (c == FLAG_1HY_PRETEND[0]) g_config.flags |= FT_PRETEND;
+                                else if (c == FLAG_1HY_JOBS[0]) g_config.jobs = parse_jobs(arg->eq);
+                                else if (c == FLAG_1HY_YES[0]) g_config.flags |= FT_YES;
                                 else forge_err_wargs("unknown option `%c`", c);
                         }
                 } else if (arg->h == 2) {
@@ -3542,6 +5645,21 @@ main(int argc, char **argv)
                                 g_config.flags |= FT_KEEP_FAKEROOT;
                         } else if (streq(arg->s, FLAG_2HY_PRETEND)) {
                                 g_config.flags |= FT_PRETEND;
+                        } else if (streq(arg->s, FLAG_2HY_JOBS)) {
+                                g_config.jobs = parse_jobs(arg->eq);
+                        } else if (streq(arg->s, FLAG_2HY_NO_CACHE)) {
+                                g_config.flags |= FT_NO_CACHE;
+                        } else if (streq(arg->s, FLAG_2HY_YES)) {
+                                g_config.flags |= FT_YES;
+                        } else if (streq(arg->s, FLAG_2HY_DESC)) {
+                                g_config.flags |= FT_DESC;
+                        } else if (streq(arg->s, FLAG_2HY_FULL)) {
+                                g_config.flags |= FT_FULL;
+                        } else if (streq(arg->s, FLAG_2HY_FORMAT)) {
+                                if (!output_format_parse(arg->eq, &g_config.format)) {
+                                        forge_err_wargs("invalid format `%s`, expected json, tsv, null or table",
+                                                        arg->eq ? arg->eq : "");
+                                }
                         } else {
                                 forge_err_wargs("unknown option `%s`", arg->s);
                         }
@@ -3550,7 +5668,8 @@ main(int argc, char **argv)
                         arg = arg->n;
                         if (streq(argcmd, CMD_INSTALL) || (argcmd[0] == 'i' && !argcmd[1])) {
                                 str_array pkgs = fold_args(&arg);
-                                int install_ok = install_pkg(&ctx, pkgs, /*is_dep=*/0, /*skip_ask=*/0);
+                                ctx_need(&ctx, CTX_MODULES);
+                                int install_ok = install_pkg(&ctx, pkgs, /*skip_ask=*/0);
 
                                 if (install_ok && pkgs.len == 1 && !strcmp(pkgs.data[0], "forge")) {
                                         info(0, "forge updated - restarting with the new binary\n");
@@ -3579,16 +5698,46 @@ main(int argc, char **argv)
                         } else if (streq(argcmd, CMD_NEW)) {
                                 new_pkg(&ctx, fold_args(&arg));
                         } else if (streq(argcmd, CMD_UNINSTALL) || (argcmd[0] == 'u' && !argcmd[1])) {
+                                ctx_need(&ctx, CTX_DB);
                                 uninstall_pkg(&ctx, fold_args(&arg), 1);
                         } else if (streq(argcmd, CMD_INT)) {
+                                ctx_need(&ctx, CTX_MODULES);
                                 interactive(&ctx);
                         } else if (streq(argcmd, CMD_INFO)) {
+                                ctx_need(&ctx, CTX_MODULES);
                                 view_pkg_info(&ctx, fold_args(&arg));
+                        } else if (streq(argcmd, CMD_STATS)) {
+                                ctx_need(&ctx, CTX_DB);
+                                show_build_stats(&ctx, fold_args(&arg));
+                        } else if (streq(argcmd, CMD_OWNS)) {
+                                show_owners(fold_args(&arg));
+                        } else if (streq(argcmd, CMD_VERIFY)) {
+                                if (!verify_pkgs(fold_args(&arg))) {
+                                        exit(1);
+                                }
+                        } else if (streq(argcmd, CMD_DAEMON)) {
+                                serve_daemon(&ctx);
+                        } else if (streq(argcmd, CMD_BENCH)) {
+                                assert_sudo();
+                                bench_opts opts = bench_opts_default();
+                                if (g_config.jobs) opts.jobs = g_config.jobs;
+                                opts.no_cache = (g_config.flags & FT_NO_CACHE) != 0;
+                                for (; arg; arg = arg->n) {
+                                        if (!bench_opts_set(&opts, arg->s, arg->eq)) {
+                                                forge_err_wargs("invalid bench parameter `%s`", arg->s);
+                                        }
+                                }
+                                if (!bench_run(&opts)) {
+                                        exit(1);
+                                }
                         } else if (streq(argcmd, CMD_EDIT_INSTALL)) {
+                                ctx_need(&ctx, CTX_DB);
                                 edit_install(&ctx);
                         } else if (streq(argcmd, CMD_LIST_DEPS)) {
+                                ctx_need(&ctx, CTX_DB);
                                 list_deps(&ctx);
                         } else if (streq(argcmd, CMD_SAVE_DEP)) {
+                                ctx_need(&ctx, CTX_DB);
                                 savedep(&ctx, fold_args(&arg));
                         } else if (streq(argcmd, CMD_API)) {
                                 str_array names = dyn_array_empty(str_array);
@@ -3612,10 +5761,12 @@ main(int argc, char **argv)
                         } else if (streq(argcmd, CMD_NEW)) {
                                 new_pkg(&ctx, fold_args(&arg));
                         } else if (streq(argcmd, CMD_CLEAN)) {
+                                ctx_need(&ctx, CTX_DB);
                                 clean_pkgs(&ctx);
                         } else if (streq(argcmd, CMD_DEPS)) {
                                 show_pkg_deps(fold_args(&arg));
                         } else if (streq(argcmd, CMD_DROP)) {
+                                ctx_need(&ctx, CTX_DB);
                                 drop_pkg(&ctx, fold_args(&arg));
                         } else if (streq(argcmd, CMD_RESTORE)) {
                                 restore_pkg(fold_args(&arg));
@@ -3626,6 +5777,7 @@ main(int argc, char **argv)
                                 }
                         } else if (streq(argcmd, CMD_UPDATE)) {
                                 str_array pkgs = fold_args(&arg);
+                                ctx_need(&ctx, CTX_MODULES);
                                 int install_ok = update_pkgs(&ctx, pkgs);
 
                                 if (install_ok && pkgs.len == 1 && !strcmp(pkgs.data[0], "forge")) {
@@ -3663,6 +5815,7 @@ main(int argc, char **argv)
                                 add_repo(fold_args(&arg));
                         } else if (streq(argcmd, CMD_DROP_REPO)) {
                                 g_config.flags |= FT_REBUILD;
+                                ctx_need(&ctx, CTX_DB);
                                 drop_repo(&ctx, fold_args(&arg));
                         } else if (streq(argcmd, CMD_CREATE_REPO)) {
                                 if (!arg) forge_err_wargs("flag `%s` requires a repo name", CMD_CREATE_REPO);
@@ -3674,6 +5827,7 @@ main(int argc, char **argv)
                         } else if (streq(argcmd, CMD_LIST_REPOS)) {
                                 list_repos();
                         } else if (streq(argcmd, CMD_DEPGRAPH)) {
+                                ctx_need(&ctx, CTX_MODULES);
                                 depgraph_dump(&ctx.dg);
                         }
 
@@ -3698,54 +5852,47 @@ main(int argc, char **argv)
 
         if (g_config.flags & FT_REBUILD) {
                 // Clean up existing context to avoid stale handles
-                for (size_t i = 0; i < ctx.dll.handles.len; ++i) {
-                        dlclose(ctx.dll.handles.data[i]);
-                        free(ctx.dll.paths.data[i]);
-                }
-                dyn_array_free(ctx.dll.handles);
-                dyn_array_free(ctx.dll.paths);
-                dyn_array_free(ctx.pkgs);
-                depgraph_destroy(&ctx.dg);
-
-                // Reinitialize context
-                ctx.dll.handles = dyn_array_empty(handle_array);
-                ctx.dll.paths = dyn_array_empty(str_array);
-                ctx.pkgs = dyn_array_empty(pkg_ptr_array);
-                ctx.dg = depgraph_create();
-
-                // Rebuild packages and load new .so files
-                rebuild_pkgs();
-                obtain_handles_and_pkgs_from_dll(&ctx);
-                construct_depgraph(&ctx);
-                indices = depgraph_gen_order(&ctx.dg);
+                ctx_need(&ctx, CTX_DB);
+                if (ctx.loaded & CTX_MODULES) {
+                        modindex_destroy(&ctx.mi);
+                        depgraph_destroy(&ctx.dg);
+                        ctx.loaded &= ~CTX_MODULES;
+                }
+
+                // Rebuild packages and refresh the index from the new .so files
+                rebuild_pkgs(ctx.db);
+                ctx_need(&ctx, CTX_MODULES);
+                size_t_array indices = depgraph_gen_order(&ctx.dg);
 
                 // Register packages, preserving is_explicit status
                 for (size_t i = 0; i < indices.len; ++i) {
-                        pkg *pkg = ctx.pkgs.data[indices.data[i]];
-                        const char *name = pkg->name();
+                        // Graph ids are not module indices: duplicate names
+                        // are only inserted once.
+                        const module *m = modindex_find(&ctx.mi, ctx.dg.names[indices.data[i]]);
+                        if (!m) continue;
+                        const char *name = m->name;
 
                         // Query the current is_explicit status
                         int is_explicit = 0;
-                        sqlite3_stmt *stmt;
                         const char *sql = "SELECT is_explicit FROM Pkgs WHERE name = ?;";
-                        int rc = sqlite3_prepare_v2(ctx.db, sql, -1, &stmt, NULL);
-                        CHECK_SQLITE(rc, ctx.db);
+                        sqlite3_stmt *stmt = ctx_stmt(&ctx, sql);
 
                         sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
                         if (sqlite3_step(stmt) == SQLITE_ROW) {
                                 is_explicit = sqlite3_column_int(stmt, 0);
                         }
-                        sqlite3_finalize(stmt);
+                        sqlite3_reset(stmt);
 
                         // Register package with the existing is_explicit value
-                        register_pkg(&ctx, pkg, is_explicit);
+                        register_pkg(&ctx, m, is_explicit);
                 }
+
+                dyn_array_free(indices);
         }
 
         unsetenv("FORGE_PREFIX");
         unsetenv("FORGE_LIBDIR");
 
-        dyn_array_free(indices);
         cleanup_forge_context(&ctx);
         return 0;
 }
@@ -0,0 +1,405 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <sys/stat.h>
+
+#include "modindex.h"
+
+static module *
+module_alloc(void)
+{
+        module *m = (module *)calloc(1, sizeof(module));
+        m->deps      = dyn_array_empty(str_array);
+        m->msgs      = dyn_array_empty(str_array);
+        m->suggested = dyn_array_empty(str_array);
+        m->rebuild   = dyn_array_empty(str_array);
+        return m;
+}
+
+static void
+strlist_free(str_array *ar)
+{
+        for (size_t i = 0; i < ar->len; ++i) {
+                free(ar->data[i]);
+        }
+        dyn_array_free(*ar);
+}
+
+static void
+module_free(module *m)
+{
+        if (m->handle) {
+                dlclose(m->handle);
+        }
+        free(m->name);
+        free(m->ver);
+        free(m->desc);
+        free(m->web);
+        free(m->so_path);
+        strlist_free(&m->deps);
+        strlist_free(&m->msgs);
+        strlist_free(&m->suggested);
+        strlist_free(&m->rebuild);
+        free(m);
+}
+
+// Lists are stored in the index as newline separated text.
+static void
+strlist_from_text(str_array *ar, const char *s)
+{
+        while (s && *s) {
+                const char *nl = strchr(s, '\n');
+                size_t n = nl ? (size_t)(nl - s) : strlen(s);
+                dyn_array_append(*ar, strndup(s, n));
+                s = nl ? nl + 1 : NULL;
+        }
+}
+
+static char *
+strlist_to_text(const str_array *ar)
+{
+        size_t n = 1;
+        for (size_t i = 0; i < ar->len; ++i) {
+                n += strlen(ar->data[i]) + 1;
+        }
+
+        char *s = (char *)malloc(n);
+        s[0] = '\0';
+        for (size_t i = 0; i < ar->len; ++i) {
+                if (i != 0) strcat(s, "\n");
+                strcat(s, ar->data[i]);
+        }
+        return s;
+}
+
+static void
+strlist_from_pkg(str_array *ar, char **(*fn)(void))
+{
+        if (!fn) return;
+        char **items = fn();
+        for (size_t i = 0; items && items[i]; ++i) {
+                dyn_array_append(*ar, strdup(items[i]));
+        }
+}
+
+static int
+module_open(module *m)
+{
+        void *handle = dlopen(m->so_path, RTLD_LAZY);
+        if (!handle) {
+                fprintf(stderr, "Error loading dll path: `%s`, %s\n", m->so_path, dlerror());
+                return 0;
+        }
+
+        dlerror();
+        pkg *pkg = dlsym(handle, "package");
+        char *error = dlerror();
+        if (error != NULL) {
+                fprintf(stderr, "Error finding 'package' symbol in %s: %s\n", m->so_path, error);
+                dlclose(handle);
+                return 0;
+        }
+
+        m->handle = handle;
+        m->pkg = pkg;
+        return 1;
+}
+
+// Load the module and (re)populate its metadata from the `pkg` struct.
+static int
+module_refresh(module *m)
+{
+        if (!m->pkg && !module_open(m)) {
+                return 0;
+        }
+
+        pkg *pkg = m->pkg;
+        if (!pkg->name) {
+                fprintf(stderr, "module %s: pkg (unknown) does not have a name\n", m->so_path);
+                return 0;
+        }
+        if (!pkg->ver) {
+                fprintf(stderr, "module %s: pkg %s does not have a version\n", m->so_path, pkg->name());
+                return 0;
+        }
+        if (!pkg->desc) {
+                fprintf(stderr, "module %s: pkg %s does not have a description\n", m->so_path, pkg->name());
+                return 0;
+        }
+
+        m->name = strdup(pkg->name());
+        m->ver  = strdup(pkg->ver());
+        m->desc = strdup(pkg->desc());
+        m->web  = pkg->web ? strdup(pkg->web()) : NULL;
+        strlist_from_pkg(&m->deps,      pkg->deps);
+        strlist_from_pkg(&m->msgs,      pkg->msgs);
+        strlist_from_pkg(&m->suggested, pkg->suggested);
+        strlist_from_pkg(&m->rebuild,   pkg->rebuild);
+
+        return 1;
+}
+
+static void
+read_index(sqlite3 *db, forge_smap *rows)
+{
+        sqlite3_stmt *stmt;
+        const char *sql =
+                "SELECT so_path, name, version, description, web, deps, msgs, "
+                "suggested, rebuild, mtime, size, ino FROM Modules;";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+                // No index yet, everything gets loaded.
+                return;
+        }
+
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+                module *m = module_alloc();
+                const char *web = (const char *)sqlite3_column_text(stmt, 4);
+
+                m->so_path = strdup((const char *)sqlite3_column_text(stmt, 0));
+                m->name    = strdup((const char *)sqlite3_column_text(stmt, 1));
+                m->ver     = strdup((const char *)sqlite3_column_text(stmt, 2));
+                m->desc    = strdup(sqlite3_column_text(stmt, 3) ? (const char *)sqlite3_column_text(stmt, 3) : "");
+                m->web     = web ? strdup(web) : NULL;
+                strlist_from_text(&m->deps,      (const char *)sqlite3_column_text(stmt, 5));
+                strlist_from_text(&m->msgs,      (const char *)sqlite3_column_text(stmt, 6));
+                strlist_from_text(&m->suggested, (const char *)sqlite3_column_text(stmt, 7));
+                strlist_from_text(&m->rebuild,   (const char *)sqlite3_column_text(stmt, 8));
+                m->mtime = sqlite3_column_int64(stmt, 9);
+                m->size  = sqlite3_column_int64(stmt, 10);
+                m->ino   = sqlite3_column_int64(stmt, 11);
+
+                forge_smap_insert(rows, m->so_path, m);
+        }
+
+        sqlite3_finalize(stmt);
+}
+
+static void
+write_index(sqlite3            *db,
+            const module_array *dirty,
+            const forge_smap   *stale)
+{
+        // Not root, keep serving from the .so files.
+        if (sqlite3_db_readonly(db, "main") == 1) {
+                return;
+        }
+
+        if (sqlite3_exec(db, "BEGIN;", NULL, NULL, NULL) != SQLITE_OK) {
+                return;
+        }
+
+        sqlite3_stmt *stmt;
+        const char *sql_upsert =
+                "INSERT OR REPLACE INTO Modules "
+                "(so_path, name, version, description, web, deps, msgs, "
+                "suggested, rebuild, mtime, size, ino) "
+                "VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);";
+        if (sqlite3_prepare_v2(db, sql_upsert, -1, &stmt, NULL) != SQLITE_OK) {
+                goto bad;
+        }
+
+        for (size_t i = 0; i < dirty->len; ++i) {
+                const module *m = dirty->data[i];
+
+                char *deps      = strlist_to_text(&m->deps);
+                char *msgs      = strlist_to_text(&m->msgs);
+                char *suggested = strlist_to_text(&m->suggested);
+                char *rebuild   = strlist_to_text(&m->rebuild);
+
+                sqlite3_bind_text(stmt, 1, m->so_path, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 2, m->name, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 3, m->ver, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 4, m->desc, -1, SQLITE_STATIC);
+                if (m->web) sqlite3_bind_text(stmt, 5, m->web, -1, SQLITE_STATIC);
+                else        sqlite3_bind_null(stmt, 5);
+                sqlite3_bind_text(stmt, 6, deps, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 7, msgs, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 8, suggested, -1, SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 9, rebuild, -1, SQLITE_STATIC);
+                sqlite3_bind_int64(stmt, 10, m->mtime);
+                sqlite3_bind_int64(stmt, 11, m->size);
+                sqlite3_bind_int64(stmt, 12, m->ino);
+
+                int rc = sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+
+                free(deps);
+                free(msgs);
+                free(suggested);
+                free(rebuild);
+
+                if (rc != SQLITE_DONE) {
+                        sqlite3_finalize(stmt);
+                        goto bad;
+                }
+        }
+        sqlite3_finalize(stmt);
+
+        const char *sql_delete = "DELETE FROM Modules WHERE so_path = ?;";
+        if (sqlite3_prepare_v2(db, sql_delete, -1, &stmt, NULL) != SQLITE_OK) {
+                goto bad;
+        }
+
+        char **keys = forge_smap_iter(stale);
+        for (size_t i = 0; keys && keys[i]; ++i) {
+                sqlite3_bind_text(stmt, 1, keys[i], -1, SQLITE_STATIC);
+                (void)sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+        }
+        free(keys);
+        sqlite3_finalize(stmt);
+
+        if (sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK) {
+                return;
+        }
+
+ bad:
+        fprintf(stderr, "could not update the module index: %s\n", sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+}
+
+static int
+is_so_file(const char *name)
+{
+        size_t n = strlen(name);
+        return n > 3 && !strcmp(name + n - 3, ".so");
+}
+
+modindex
+modindex_load(sqlite3    *db,
+              const char *dir)
+{
+        modindex mi = (modindex) {
+                .mods = dyn_array_empty(module_array),
+                .by_name = forge_smap_create(),
+        };
+
+        forge_smap rows = forge_smap_create();
+        read_index(db, &rows);
+
+        DIR *dp = opendir(dir);
+        if (!dp) {
+                perror("Failed to open package directory");
+                forge_smap_destroy(&rows);
+                return mi;
+        }
+
+        // Changed modules, by .so rather than by name, since two
+        // repositories can each have a module of the same name.
+        module_array dirty = dyn_array_empty(module_array);
+        struct dirent *entry;
+
+        while ((entry = readdir(dp))) {
+                if (!is_so_file(entry->d_name)) continue;
+
+                char path[512] = {0};
+                snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+
+                struct stat st;
+                if (stat(path, &st) != 0) {
+                        perror("stat");
+                        continue;
+                }
+
+                long long mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+                module *m = (module *)forge_smap_get(&rows, path);
+
+                if (m) {
+                        // Claim the row so it does not get dropped as stale.
+                        forge_smap_insert(&rows, path, NULL);
+                }
+
+                if (!m || m->mtime != mtime || m->size != (long long)st.st_size
+                    || m->ino != (long long)st.st_ino) {
+                        if (m) module_free(m);
+                        m = module_alloc();
+                        m->so_path = strdup(path);
+                        m->mtime = mtime;
+                        m->size = (long long)st.st_size;
+                        m->ino = (long long)st.st_ino;
+
+                        if (!module_refresh(m)) {
+                                module_free(m);
+                                continue;
+                        }
+                        dyn_array_append(dirty, m);
+                }
+
+                dyn_array_append(mi.mods, m);
+                forge_smap_insert(&mi.by_name, m->name, m);
+        }
+
+        closedir(dp);
+
+        // Whatever is left in `rows` no longer exists on disk.
+        forge_smap stale = forge_smap_create();
+        char **keys = forge_smap_iter(&rows);
+        for (size_t i = 0; keys && keys[i]; ++i) {
+                module *m = (module *)forge_smap_get(&rows, keys[i]);
+                if (m) {
+                        forge_smap_insert(&stale, keys[i], NULL);
+                        module_free(m);
+                }
+        }
+        free(keys);
+
+        if (dirty.len > 0 || forge_smap_size(&stale) > 0) {
+                write_index(db, &dirty, &stale);
+        }
+
+        dyn_array_free(dirty);
+        forge_smap_destroy(&stale);
+        forge_smap_destroy(&rows);
+
+        return mi;
+}
+
+module *
+modindex_find(const modindex *mi,
+              const char     *name)
+{
+        return (module *)forge_smap_get(&mi->by_name, name);
+}
+
+pkg *
+modindex_load_pkg(module *m)
+{
+        if (m->pkg) {
+                return m->pkg;
+        }
+        if (!module_open(m)) {
+                return NULL;
+        }
+        return m->pkg;
+}
+
+void
+modindex_destroy(modindex *mi)
+{
+        for (size_t i = 0; i < mi->mods.len; ++i) {
+                module_free(mi->mods.data[i]);
+        }
+        dyn_array_free(mi->mods);
+        forge_smap_destroy(&mi->by_name);
+}
@@ -0,0 +1,163 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "output.h"
+
+int
+output_format_parse(const char *s,
+                    output_format *fmt)
+{
+        if (!s)                        return 0;
+        else if (!strcmp(s, "table"))  *fmt = OUTPUT_TABLE;
+        else if (!strcmp(s, "json"))   *fmt = OUTPUT_JSON;
+        else if (!strcmp(s, "tsv"))    *fmt = OUTPUT_TSV;
+        else if (!strcmp(s, "null"))   *fmt = OUTPUT_NULL;
+        else                           return 0;
+        return 1;
+}
+
+static void
+put_json_string(const char *s)
+{
+        putchar('"');
+        for (; *s; ++s) {
+                unsigned char c = (unsigned char)*s;
+                switch (c) {
+                case '"':  fputs("\\\"", stdout); break;
+                case '\\': fputs("\\\\", stdout); break;
+                case '\n': fputs("\\n", stdout);  break;
+                case '\r': fputs("\\r", stdout);  break;
+                case '\t': fputs("\\t", stdout);  break;
+                default:
+                        if (c < 0x20) printf("\\u%04x", c);
+                        else putchar(c);
+                }
+        }
+        putchar('"');
+}
+
+static void
+put_tsv_string(const char *s)
+{
+        for (; *s; ++s) {
+                switch (*s) {
+                case '\\': fputs("\\\\", stdout); break;
+                case '\t': fputs("\\t", stdout);  break;
+                case '\n': fputs("\\n", stdout);  break;
+                case '\r': fputs("\\r", stdout);  break;
+                default:   putchar(*s);
+                }
+        }
+}
+
+// Write one field. `s` is the text of the value, or NULL. With
+// `number` set, JSON gets it unquoted.
+static void
+put_field(output     *o,
+          const char *key,
+          const char *s,
+          int         number)
+{
+        switch (o->fmt) {
+        case OUTPUT_JSON:
+                if (o->fields) putchar(',');
+                put_json_string(key);
+                putchar(':');
+                if (!s)          fputs("null", stdout);
+                else if (number) fputs(s, stdout);
+                else             put_json_string(s);
+                break;
+        case OUTPUT_TSV:
+                if (o->fields) putchar('\t');
+                if (s) put_tsv_string(s);
+                break;
+        case OUTPUT_NULL:
+                if (s) fputs(s, stdout);
+                putchar('\0');
+                break;
+        case OUTPUT_TABLE:
+                break;
+        }
+        ++o->fields;
+}
+
+void
+output_begin(output        *o,
+             output_format  fmt)
+{
+        o->fmt = fmt;
+        o->rows = 0;
+        o->fields = 0;
+        if (fmt == OUTPUT_JSON) {
+                putchar('[');
+        }
+}
+
+void
+output_end(output *o)
+{
+        if (o->fmt == OUTPUT_JSON) {
+                fputs(o->rows ? "\n]\n" : "]\n", stdout);
+        }
+        fflush(stdout);
+}
+
+void
+output_row_begin(output *o)
+{
+        if (o->fmt == OUTPUT_JSON) {
+                fputs(o->rows ? ",\n{" : "\n{", stdout);
+        }
+        o->fields = 0;
+}
+
+void
+output_text(output     *o,
+            const char *key,
+            const char *s)
+{
+        put_field(o, key, s, 0);
+}
+
+void
+output_row_end(output *o)
+{
+        if (o->fmt == OUTPUT_JSON)     putchar('}');
+        else if (o->fmt == OUTPUT_TSV) putchar('\n');
+        ++o->rows;
+}
+
+void
+output_stmt_row(output       *o,
+                sqlite3_stmt *stmt)
+{
+        output_row_begin(o);
+        for (int i = 0; i < sqlite3_column_count(stmt); ++i) {
+                int type = sqlite3_column_type(stmt, i);
+                const char *s = type == SQLITE_NULL ? NULL
+                        : (const char *)sqlite3_column_text(stmt, i);
+                put_field(o, sqlite3_column_name(stmt, i), s,
+                          type == SQLITE_INTEGER || type == SQLITE_FLOAT);
+        }
+        output_row_end(o);
+}
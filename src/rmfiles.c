@@ -0,0 +1,331 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "forge/cstr.h"
+#include "forge/smap.h"
+
+#include "rmfiles.h"
+
+// Below this many paths, threads cost more than they save.
+#define RMFILES_PARALLEL_MIN 2048
+#define RMFILES_MAX_THREADS  8
+
+typedef struct {
+        const char *path;
+        const char *base;   // last component of `path`
+        size_t      dirlen; // length of the parent directory in `path`
+        int         err;
+        int         is_dir; // pruned with the other directories
+} rm_entry;
+
+// Entries [first, first + count) share a parent directory.
+typedef struct {
+        size_t first;
+        size_t count;
+} rm_group;
+
+typedef struct {
+        rm_entry         *entries;
+        rm_group         *groups;
+        size_t            ngroups;
+        size_t            total;
+        rmfiles_progress  progress;
+
+        pthread_mutex_t   lock;
+        size_t            next; // next group to take
+        size_t            done;
+        size_t            removed;
+} rm_job;
+
+static int
+entry_cmp(const void *a,
+          const void *b)
+{
+        const rm_entry *x = (const rm_entry *)a, *y = (const rm_entry *)b;
+        size_t n = x->dirlen < y->dirlen ? x->dirlen : y->dirlen;
+
+        int c = memcmp(x->path, y->path, n);
+        if (c) return c;
+        if (x->dirlen != y->dirlen) return x->dirlen < y->dirlen ? -1 : 1;
+        return strcmp(x->base, y->base);
+}
+
+static int
+same_dir(const rm_entry *a,
+         const rm_entry *b)
+{
+        return a->dirlen == b->dirlen && !memcmp(a->path, b->path, a->dirlen);
+}
+
+static void
+group_dir(const rm_entry *e,
+          char            buf[PATH_MAX])
+{
+        if (e->dirlen == 0) {
+                strcpy(buf, "/");
+        } else {
+                snprintf(buf, PATH_MAX, "%.*s", (int)e->dirlen, e->path);
+        }
+}
+
+// Returns the number of entries of `g` that were removed.
+static size_t
+remove_group(rm_entry       *entries,
+             const rm_group *g)
+{
+        char dir[PATH_MAX];
+        group_dir(&entries[g->first], dir);
+
+        int dfd = open(dir, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (dfd == -1) {
+                int err = errno == ENOENT || errno == ENOTDIR ? 0 : errno;
+                for (size_t i = 0; i < g->count; ++i) {
+                        entries[g->first + i].err = err;
+                }
+                return 0;
+        }
+
+        size_t removed = 0;
+        for (size_t i = 0; i < g->count; ++i) {
+                rm_entry *e = &entries[g->first + i];
+                if (unlinkat(dfd, e->base, 0) == 0) {
+                        ++removed;
+                } else if (errno == EISDIR) {
+                        e->is_dir = 1;
+                } else if (errno != ENOENT) {
+                        e->err = errno;
+                }
+        }
+
+        close(dfd);
+        return removed;
+}
+
+static void *
+rm_worker(void *arg)
+{
+        rm_job *job = (rm_job *)arg;
+
+        while (1) {
+                pthread_mutex_lock(&job->lock);
+                size_t g = job->next++;
+                pthread_mutex_unlock(&job->lock);
+
+                if (g >= job->ngroups) break;
+
+                const rm_group *grp = &job->groups[g];
+                size_t removed = remove_group(job->entries, grp);
+
+                pthread_mutex_lock(&job->lock);
+                job->done += grp->count;
+                job->removed += removed;
+                if (job->progress) {
+                        job->progress(job->entries[grp->first + grp->count - 1].path, job->done, job->total);
+                }
+                pthread_mutex_unlock(&job->lock);
+        }
+
+        return NULL;
+}
+
+// Whether `dir` must survive even if it is empty.
+static int
+is_kept(const char        *dir,
+        const char *const *keep)
+{
+        // `/` and top-level directories.
+        if (!strchr(dir + 1, '/')) {
+                return 1;
+        }
+
+        size_t n = strlen(dir);
+        for (size_t i = 0; keep && keep[i]; ++i) {
+                const char *k = keep[i];
+                // `dir` is `/<k>` or one of its parents.
+                if (!strncmp(dir + 1, k, n - 1) && (k[n - 1] == '\0' || k[n - 1] == '/')) {
+                        return 1;
+                }
+        }
+
+        return 0;
+}
+
+static size_t
+depth_of(const char *path)
+{
+        size_t depth = 0;
+        for (; *path; ++path) depth += *path == '/';
+        return depth;
+}
+
+static int
+deeper_first(const void *a,
+             const void *b)
+{
+        size_t x = depth_of(*(char *const *)a), y = depth_of(*(char *const *)b);
+        return (x < y) - (x > y);
+}
+
+// Add `dir` and its parents to `dirs`, up to the first one
+// that is kept or already in `seen`.
+static void
+add_dirs(char               dir[PATH_MAX],
+         const char *const *keep,
+         forge_smap        *seen,
+         str_array         *dirs)
+{
+        while (!is_kept(dir, keep) && !forge_smap_contains(seen, dir)) {
+                forge_smap_insert(seen, dir, (void *)1);
+                dyn_array_append(*dirs, strdup(dir));
+                *strrchr(dir, '/') = '\0';
+        }
+}
+
+// Remove the directories of `groups`, the directories among
+// `entries` and their parents if they are empty, deepest first
+// so that children go before parents.
+static void
+prune_dirs(const rm_entry     *entries,
+           size_t              len,
+           const rm_group     *groups,
+           size_t              ngroups,
+           const char *const  *keep)
+{
+        forge_smap seen = forge_smap_create();
+        str_array dirs = dyn_array_empty(str_array);
+        char dir[PATH_MAX];
+
+        for (size_t g = 0; g < ngroups; ++g) {
+                group_dir(&entries[groups[g].first], dir);
+                add_dirs(dir, keep, &seen, &dirs);
+        }
+        for (size_t i = 0; i < len; ++i) {
+                if (entries[i].is_dir) {
+                        snprintf(dir, sizeof(dir), "%s", entries[i].path);
+                        add_dirs(dir, keep, &seen, &dirs);
+                }
+        }
+
+        qsort(dirs.data, dirs.len, sizeof(char *), deeper_first);
+
+        for (size_t i = 0; i < dirs.len; ++i) {
+                (void)rmdir(dirs.data[i]); // fails if something else lives there
+                free(dirs.data[i]);
+        }
+
+        dyn_array_free(dirs);
+        forge_smap_destroy(&seen);
+}
+
+size_t
+rmfiles(char *const       *paths,
+        size_t             n,
+        const char *const *keep,
+        rmfiles_progress   progress,
+        str_array         *failed)
+{
+        if (n == 0) {
+                return 0;
+        }
+
+        rm_entry *entries = (rm_entry *)malloc(n * sizeof(rm_entry));
+        size_t len = 0;
+        for (size_t i = 0; i < n; ++i) {
+                const char *slash = strrchr(paths[i], '/');
+                if (!slash || !slash[1]) {
+                        continue; // not an absolute path to a file
+                }
+                entries[len++] = (rm_entry) {
+                        .path = paths[i],
+                        .base = slash + 1,
+                        .dirlen = (size_t)(slash - paths[i]),
+                        .err = 0,
+                        .is_dir = 0,
+                };
+        }
+
+        qsort(entries, len, sizeof(rm_entry), entry_cmp);
+
+        rm_group *groups = (rm_group *)malloc((len + 1) * sizeof(rm_group));
+        size_t ngroups = 0;
+        for (size_t i = 0; i < len; ++i) {
+                if (i == 0 || !same_dir(&entries[i], &entries[i - 1])) {
+                        groups[ngroups++] = (rm_group) { .first = i, .count = 0 };
+                }
+                ++groups[ngroups - 1].count;
+        }
+
+        rm_job job = {
+                .entries = entries,
+                .groups = groups,
+                .ngroups = ngroups,
+                .total = len,
+                .progress = progress,
+                .next = 0,
+                .done = 0,
+                .removed = 0,
+        };
+        pthread_mutex_init(&job.lock, NULL);
+
+        size_t nthreads = 0;
+        if (len >= RMFILES_PARALLEL_MIN && ngroups > 1) {
+                long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+                nthreads = ncpu > 1 ? (size_t)ncpu : 1;
+                if (nthreads > RMFILES_MAX_THREADS) nthreads = RMFILES_MAX_THREADS;
+                if (nthreads > ngroups) nthreads = ngroups;
+        }
+
+        // This thread always takes part, the others only help out.
+        pthread_t threads[RMFILES_MAX_THREADS];
+        size_t started = 0;
+        for (size_t i = 1; i < nthreads; ++i) {
+                if (pthread_create(&threads[started], NULL, rm_worker, &job) == 0) {
+                        ++started;
+                }
+        }
+        rm_worker(&job);
+        for (size_t i = 0; i < started; ++i) {
+                pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&job.lock);
+
+        prune_dirs(entries, len, groups, ngroups, keep);
+
+        for (size_t i = 0; i < len; ++i) {
+                if (entries[i].err) {
+                        dyn_array_append(*failed, forge_cstr_builder(entries[i].path, " (", strerror(entries[i].err), ")", NULL));
+                }
+        }
+
+        free(groups);
+        free(entries);
+
+        return job.removed;
+}
@@ -0,0 +1,241 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+
+#include "schema.h"
+
+typedef struct {
+        const char *sql;             // run first, if any
+        int (*fn)(sqlite3 *db);      // then this, if any
+} migration;
+
+// Full-text index over package names and descriptions for
+// `forge search`. Triggers keep it in step with Pkgs, so
+// register_pkg() and drop_pkg() maintain it for free. Builds
+// of SQLite without FTS5 go without (see pkg_search()), and
+// schema_migrate() tries again every time in case SQLite
+// gained FTS5 since.
+static int
+create_search_index(sqlite3 *db)
+{
+        sqlite3_stmt *stmt;
+        const char *sql = "SELECT 1 FROM sqlite_master WHERE name = 'PkgSearch';";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+                return 0;
+        }
+        int exists = sqlite3_step(stmt) == SQLITE_ROW;
+        sqlite3_finalize(stmt);
+
+        if (exists) {
+                return 1;
+        }
+
+        const char *create_search =
+                "SAVEPOINT search_index;"
+                "CREATE VIRTUAL TABLE PkgSearch USING fts5("
+                "name, description, tokenize = 'trigram');"
+                "INSERT INTO PkgSearch (rowid, name, description) "
+                "SELECT id, name, description FROM Pkgs;"
+                "CREATE TRIGGER PkgSearch_insert AFTER INSERT ON Pkgs BEGIN "
+                "INSERT INTO PkgSearch (rowid, name, description) "
+                "VALUES (new.id, new.name, new.description); END;"
+                "CREATE TRIGGER PkgSearch_update AFTER UPDATE OF name, description ON Pkgs "
+                "WHEN old.name IS NOT new.name OR old.description IS NOT new.description BEGIN "
+                "UPDATE PkgSearch SET name = new.name, description = new.description "
+                "WHERE rowid = old.id; END;"
+                "CREATE TRIGGER PkgSearch_delete AFTER DELETE ON Pkgs BEGIN "
+                "DELETE FROM PkgSearch WHERE rowid = old.id; END;"
+                "RELEASE search_index;";
+        if (sqlite3_exec(db, create_search, NULL, NULL, NULL) != SQLITE_OK) {
+                (void)sqlite3_exec(db, "ROLLBACK TO search_index; RELEASE search_index;", NULL, NULL, NULL);
+        }
+
+        return 1;
+}
+
+// Migration N brings a database from user_version N-1 to N.
+static const migration migrations[] = {
+        // 1: the schema from before it was versioned, so
+        // everything has to cope with already existing.
+        {
+                .sql =
+                "CREATE TABLE IF NOT EXISTS Pkgs ("
+                "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                "name TEXT NOT NULL UNIQUE,"
+                "version TEXT NOT NULL,"
+                "description TEXT,"
+                "installed INTEGER NOT NULL DEFAULT 0,"
+                "is_explicit INTEGER NOT NULL DEFAULT 0,"
+                "pkg_src_loc TEXT);"
+
+                "CREATE TABLE IF NOT EXISTS Deps ("
+                "pkg_id INTEGER NOT NULL,"
+                "dep_id INTEGER NOT NULL,"
+                "FOREIGN KEY (pkg_id) REFERENCES Pkgs(id),"
+                "FOREIGN KEY (dep_id) REFERENCES Pkgs(id),"
+                "PRIMARY KEY (pkg_id, dep_id));"
+
+                "CREATE TABLE IF NOT EXISTS Files ("
+                "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                "pkg_id INTEGER NOT NULL,"
+                "path TEXT NOT NULL,"
+                "size INTEGER,"
+                "mode INTEGER," // permissions only: 0755, etc.
+                "mtime INTEGER,"
+                "type TEXT NOT NULL DEFAULT 'file',"
+                "FOREIGN KEY (pkg_id) REFERENCES Pkgs(id) ON DELETE CASCADE,"
+                "UNIQUE(pkg_id, path));"
+
+                // Hash of the last successful compilation of each C module and
+                // the .so it went into (see rebuild_pkgs() and binpkg_key()).
+                "CREATE TABLE IF NOT EXISTS ModuleBuilds ("
+                "src TEXT PRIMARY KEY,"
+                "hash TEXT NOT NULL,"
+                "so TEXT NOT NULL);"
+
+                // One row per phase (download, build, install, merge)
+                // of every install. See buildstats.h.
+                "CREATE TABLE IF NOT EXISTS BuildStats ("
+                "id INTEGER PRIMARY KEY AUTOINCREMENT,"
+                "pkg_name TEXT NOT NULL,"
+                "version TEXT,"
+                "phase TEXT NOT NULL,"
+                "ok INTEGER NOT NULL,"
+                "started INTEGER NOT NULL,"
+                "wall_ms INTEGER NOT NULL,"
+                "user_ms INTEGER NOT NULL,"
+                "sys_ms INTEGER NOT NULL,"
+                "jobs INTEGER NOT NULL DEFAULT 1);"
+                "CREATE INDEX IF NOT EXISTS BuildStats_pkg_name ON BuildStats(pkg_name, phase);"
+
+                // The module index (see modindex.h).
+                "CREATE TABLE IF NOT EXISTS Modules ("
+                "so_path TEXT PRIMARY KEY,"
+                "name TEXT NOT NULL,"
+                "version TEXT NOT NULL,"
+                "description TEXT,"
+                "web TEXT,"
+                "deps TEXT,"
+                "msgs TEXT,"
+                "suggested TEXT,"
+                "rebuild TEXT,"
+                "mtime INTEGER NOT NULL,"
+                "size INTEGER NOT NULL,"
+                "ino INTEGER NOT NULL);",
+        },
+
+        // 2: indexes for the hot queries.
+        {
+                .sql =
+                // Reverse dependencies (orphans, `forge deps`).
+                "CREATE INDEX IF NOT EXISTS Deps_dep_id ON Deps(dep_id);"
+                // Installed and explicit packages (clean, update, list).
+                "CREATE INDEX IF NOT EXISTS Pkgs_installed ON Pkgs(installed, is_explicit);"
+                // Owner of a path (`forge owns`, file conflicts).
+                "CREATE INDEX IF NOT EXISTS Files_path ON Files(path);",
+        },
+
+        // 3: `forge search` index. Without FTS5 this does nothing,
+        // and schema_migrate() creates the index once SQLite has it.
+        {
+                .fn = create_search_index,
+        },
+
+        // 4: SHA-256 of regular files, recorded when they are
+        // merged (see copy_regular()) and checked by `forge verify`.
+        // Files merged before have none.
+        {
+                .sql = "ALTER TABLE Files ADD COLUMN hash TEXT;",
+        },
+};
+
+#define MIGRATIONS_N (int)(sizeof(migrations) / sizeof(*migrations))
+
+static int
+get_user_version(sqlite3 *db)
+{
+        sqlite3_stmt *stmt;
+        if (sqlite3_prepare_v2(db, "PRAGMA user_version;", -1, &stmt, NULL) != SQLITE_OK) {
+                return -1;
+        }
+
+        int version = -1;
+        if (sqlite3_step(stmt) == SQLITE_ROW) {
+                version = sqlite3_column_int(stmt, 0);
+        }
+        sqlite3_finalize(stmt);
+
+        return version;
+}
+
+static int
+apply_migration(sqlite3 *db,
+                int      version)
+{
+        const migration *m = &migrations[version - 1];
+
+        // IMMEDIATE so that two forges starting at the same
+        // time cannot both migrate the same version.
+        if (sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, NULL) != SQLITE_OK) {
+                return 0;
+        }
+
+        // Somebody else may have gotten here first.
+        if (get_user_version(db) >= version) {
+                return sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK;
+        }
+
+        char set_version[64] = {0};
+        snprintf(set_version, sizeof(set_version), "PRAGMA user_version = %d;", version);
+
+        if ((m->sql && sqlite3_exec(db, m->sql, NULL, NULL, NULL) != SQLITE_OK)
+            || (m->fn && !m->fn(db))
+            || sqlite3_exec(db, set_version, NULL, NULL, NULL) != SQLITE_OK) {
+                fprintf(stderr, "schema migration %d failed: %s\n", version, sqlite3_errmsg(db));
+                (void)sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+                return 0;
+        }
+
+        return sqlite3_exec(db, "COMMIT;", NULL, NULL, NULL) == SQLITE_OK;
+}
+
+int
+schema_migrate(sqlite3 *db)
+{
+        int version = get_user_version(db);
+        if (version < 0) {
+                return 0;
+        }
+
+        // A database from a newer forge is left alone, all
+        // migrations only ever add to the schema.
+        for (int v = version + 1; v <= MIGRATIONS_N; ++v) {
+                if (!apply_migration(db, v)) {
+                        return 0;
+                }
+        }
+
+        // Only a cheap lookup once the index exists. Without FTS5
+        // it fails again and `forge search` keeps using regexes.
+        (void)create_search_index(db);
+
+        return 1;
+}
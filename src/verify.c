@@ -0,0 +1,197 @@
+/*
+ * forge: Forge your own packages
+ * Copyright (C) 2025  malloc-nbytes
+ * Contact: zdhdev@yahoo.com
+
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sha256.h"
+#include "verify.h"
+
+#define VERIFY_MAX_THREADS 32
+
+// Files taken from the queue at once, so that the lock is not
+// taken for every small file.
+#define VERIFY_BATCH 16
+
+typedef struct {
+        verify_entry    *entries;
+        size_t           total;
+        int              full;
+        verify_progress  progress;
+
+        pthread_mutex_t  lock;
+        size_t           next; // next entry to take
+        size_t           done;
+        size_t           bad;
+} verify_job;
+
+static void
+verify_one(verify_entry *e,
+           int           full)
+{
+        struct stat st;
+        if (lstat(e->path, &st) != 0) {
+                e->err = errno;
+                e->status = errno == ENOENT || errno == ENOTDIR ? VERIFY_MISSING : VERIFY_UNREADABLE;
+                return;
+        }
+
+        int want_link = !strcmp(e->type, "symlink");
+        int want_dir = !strcmp(e->type, "dir");
+        if ((want_link && !S_ISLNK(st.st_mode))
+            || (want_dir && !S_ISDIR(st.st_mode))
+            || (!want_link && !want_dir && !S_ISREG(st.st_mode))) {
+                e->status = VERIFY_TYPE;
+                return;
+        }
+
+        if (!S_ISREG(st.st_mode)) {
+                return;
+        }
+
+        if ((int)(st.st_mode & 07777) != e->mode) {
+                e->status = VERIFY_MODE;
+                return;
+        }
+
+        int same_stat = st.st_size == e->size && st.st_mtim.tv_sec == e->mtime;
+        if (same_stat && !full) {
+                return;
+        }
+
+        if (!e->hash) {
+                if (st.st_size != e->size) {
+                        e->status = VERIFY_CONTENT;
+                }
+                return;
+        }
+
+        sha256_ctx c;
+        char hex[SHA256_HEX_SZ];
+        sha256_init(&c);
+        e->hashed = 1;
+        if (!sha256_update_file(&c, e->path)) {
+                e->err = errno;
+                e->status = VERIFY_UNREADABLE;
+                return;
+        }
+        sha256_final_hex(&c, hex);
+
+        if (strcmp(hex, e->hash)) {
+                e->status = VERIFY_CONTENT;
+        }
+}
+
+static void *
+verify_worker(void *arg)
+{
+        verify_job *job = (verify_job *)arg;
+
+        while (1) {
+                pthread_mutex_lock(&job->lock);
+                size_t first = job->next;
+                job->next += VERIFY_BATCH;
+                pthread_mutex_unlock(&job->lock);
+
+                if (first >= job->total) break;
+
+                size_t last = first + VERIFY_BATCH < job->total ? first + VERIFY_BATCH : job->total;
+                size_t bad = 0;
+                for (size_t i = first; i < last; ++i) {
+                        verify_one(&job->entries[i], job->full);
+                        bad += job->entries[i].status != VERIFY_OK;
+                }
+
+                pthread_mutex_lock(&job->lock);
+                job->done += last - first;
+                job->bad += bad;
+                if (job->progress) {
+                        job->progress(job->done, job->total);
+                }
+                pthread_mutex_unlock(&job->lock);
+        }
+
+        return NULL;
+}
+
+size_t
+verify_files(verify_entry    *entries,
+             size_t           n,
+             int              full,
+             verify_progress  progress)
+{
+        verify_job job = {
+                .entries = entries,
+                .total = n,
+                .full = full,
+                .progress = progress,
+                .next = 0,
+                .done = 0,
+                .bad = 0,
+        };
+        pthread_mutex_init(&job.lock, NULL);
+
+        for (size_t i = 0; i < n; ++i) {
+                entries[i].status = VERIFY_OK;
+                entries[i].hashed = 0;
+                entries[i].err = 0;
+        }
+
+        // Reading files mostly waits on the disk, so more
+        // threads than cores still help a little.
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        size_t nthreads = ncpu > 1 ? (size_t)ncpu * 2 : 1;
+        if (nthreads > VERIFY_MAX_THREADS) nthreads = VERIFY_MAX_THREADS;
+        if (nthreads > (n + VERIFY_BATCH - 1) / VERIFY_BATCH) nthreads = (n + VERIFY_BATCH - 1) / VERIFY_BATCH;
+
+        // This thread always takes part, the others only help out.
+        pthread_t threads[VERIFY_MAX_THREADS];
+        size_t started = 0;
+        for (size_t i = 1; i < nthreads; ++i) {
+                if (pthread_create(&threads[started], NULL, verify_worker, &job) == 0) {
+                        ++started;
+                }
+        }
+        verify_worker(&job);
+        for (size_t i = 0; i < started; ++i) {
+                pthread_join(threads[i], NULL);
+        }
+        pthread_mutex_destroy(&job.lock);
+
+        return job.bad;
+}
+
+const char *
+verify_status_str(verify_status status)
+{
+        switch (status) {
+        case VERIFY_OK:         return "ok";
+        case VERIFY_MISSING:    return "missing";
+        case VERIFY_TYPE:       return "type changed";
+        case VERIFY_MODE:       return "mode changed";
+        case VERIFY_CONTENT:    return "modified";
+        case VERIFY_UNREADABLE: return "unreadable";
+        }
+        return "?";
+}